@@ -0,0 +1,106 @@
+/**
+ * @file bench-bitmap.c
+ * @brief microbenchmark of the word kernels of bmblock: the same
+ *        operations with each kernel this CPU has (scalar, sse, avx2).
+ *
+ * usage: ./bench-bitmap [number of bits, 65535 by default]
+ *
+ * @author José Ferro Pinto
+ * @author Marc Favrod-Coune
+ * @date march 2017
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include "bmblock.h"
+#include "histo.h"
+#include "error.h"
+
+#define BENCH_ROUNDS 2000
+
+// empêche le compilateur d'enlever les appels dont le résultat n'est pas utilisé
+static volatile uint64_t sink;
+
+/**
+ * @brief print the time of one call, in nanoseconds
+ */
+static void bench_print(const char *op, uint64_t start, int rounds)
+{
+    printf("  %-12s %10.1f ns\n", op, (double) (histo_now() - start) / rounds);
+}
+
+/**
+ * @brief time the operations on a and b with the kernels in use
+ */
+static void bench_run(struct bmblock_array *a, struct bmblock_array *b)
+{
+    const uint64_t nb_bits = a -> max - a -> min + 1;
+    uint64_t start = 0;
+
+    start = histo_now();
+    for (int r = 0; r < BENCH_ROUNDS; ++r) {
+        sink += bm_count(a);
+    }
+    bench_print("count", start, BENCH_ROUNDS);
+
+    start = histo_now();
+    for (int r = 0; r < BENCH_ROUNDS; ++r) {
+        bm_set_range(b, b -> min, nb_bits);
+        bm_clear_range(b, b -> min + 1, nb_bits - 2);
+    }
+    bench_print("set+clear", start, BENCH_ROUNDS);
+
+    // presque plein: le seul bit libre est le dernier
+    bm_set_range(b, b -> min, nb_bits - 1);
+    start = histo_now();
+    for (int r = 0; r < BENCH_ROUNDS; ++r) {
+        sink += (uint64_t) bm_find_zero(b, b -> min);
+    }
+    bench_print("find_zero", start, BENCH_ROUNDS);
+
+    start = histo_now();
+    for (int r = 0; r < BENCH_ROUNDS; ++r) {
+        bm_combine(b, a, BM_AND);
+        bm_combine(b, a, BM_OR);
+        bm_combine(b, a, BM_XOR);
+    }
+    bench_print("and/or/xor", start, 3 * BENCH_ROUNDS);
+}
+
+int main(int argc, char *argv[])
+{
+    const uint64_t nb_bits = argc > 1 ? strtoull(argv[1], NULL, 10) : UINT64_C(65535);
+    const enum bm_kernel kinds[] = { BM_KERNEL_SCALAR, BM_KERNEL_SSE, BM_KERNEL_AVX2 };
+
+    if (nb_bits < 3) {
+        fprintf(stderr, "at least 3 bits\n");
+        return 1;
+    }
+    struct bmblock_array *a = bm_alloc(UINT64_C(1), nb_bits);
+    struct bmblock_array *b = bm_alloc(UINT64_C(1), nb_bits);
+    if (a == NULL || b == NULL) {
+        free(a);
+        free(b);
+        return 1;
+    }
+
+    // un bit sur trois utilisé
+    for (uint64_t x = a -> min; x <= a -> max; x += 3) {
+        bm_set(a, x);
+    }
+
+    printf("%" PRIu64 " bits, %d rounds\n", nb_bits, BENCH_ROUNDS);
+    for (size_t k = 0; k < sizeof(kinds) / sizeof(kinds[0]); ++k) {
+        if (bm_set_kernel(kinds[k]) != 0) {
+            continue;
+        }
+        printf("%s:\n", bm_kernel_name());
+        bench_run(a, b);
+    }
+
+    free(a);
+    free(b);
+    return 0;
+}
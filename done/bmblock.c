@@ -14,6 +14,379 @@
 #include "bmblock.h"
 #include "error.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define BMBLOCK_X86 1
+#endif
+
+/*
+ * Kernels of the operations on whole words of a bitmap. The AVX2 and SSE
+ * ones are used when the CPU has them (checked once, at the first call),
+ * otherwise the scalar ones; bm_set_kernel() can choose one.
+ */
+struct bm_kernels {
+    enum bm_kernel kind;
+    const char *name;
+    /* number of set bits of words[0..n) */
+    uint64_t (*count)(const uint64_t *words, size_t n);
+    /* bit k set if words[k] has a zero bit (n <= 64) */
+    uint64_t (*not_full)(const uint64_t *words, size_t n);
+    /* words[0..n) = value */
+    void (*fill)(uint64_t *words, size_t n, uint64_t value);
+    /* dst[k] = dst[k] op src[k] for k < n */
+    void (*combine)(uint64_t *dst, const uint64_t *src, size_t n, enum bm_op op);
+};
+
+static uint64_t count_scalar(const uint64_t *words, size_t n)
+{
+    uint64_t total = 0;
+    for (size_t i = 0; i < n; ++i) {
+        total += (uint64_t) __builtin_popcountll(words[i]);
+    }
+    return total;
+}
+
+static uint64_t not_full_scalar(const uint64_t *words, size_t n)
+{
+    uint64_t mask = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (words[i] != UINT64_MAX) {
+            mask |= UINT64_C(1) << i;
+        }
+    }
+    return mask;
+}
+
+static void fill_scalar(uint64_t *words, size_t n, uint64_t value)
+{
+    for (size_t i = 0; i < n; ++i) {
+        words[i] = value;
+    }
+}
+
+static void combine_scalar(uint64_t *dst, const uint64_t *src, size_t n, enum bm_op op)
+{
+    for (size_t i = 0; i < n; ++i) {
+        switch (op) {
+        case BM_AND:
+            dst[i] &= src[i];
+            break;
+        case BM_OR:
+            dst[i] |= src[i];
+            break;
+        default:
+            dst[i] ^= src[i];
+            break;
+        }
+    }
+}
+
+static const struct bm_kernels kernels_scalar = {
+    BM_KERNEL_SCALAR, "scalar", count_scalar, not_full_scalar, fill_scalar, combine_scalar
+};
+
+#ifdef BMBLOCK_X86
+/**
+ * @brief popcount 2 words at a time: the bits of each nibble are counted by
+ *        a table lookup (pshufb), then the bytes are summed (psadbw)
+ */
+__attribute__((target("ssse3")))
+static uint64_t count_sse(const uint64_t *words, size_t n)
+{
+    const __m128i table = _mm_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m128i low = _mm_set1_epi8(0x0f);
+    __m128i acc = _mm_setzero_si128();
+    uint64_t lanes[2];
+    size_t i = 0;
+
+    for (; i + 2 <= n; i += 2) {
+        const __m128i v = _mm_loadu_si128((const __m128i *) (words + i));
+        const __m128i lo = _mm_shuffle_epi8(table, _mm_and_si128(v, low));
+        const __m128i hi = _mm_shuffle_epi8(table, _mm_and_si128(_mm_srli_epi16(v, 4), low));
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_add_epi8(lo, hi), _mm_setzero_si128()));
+    }
+    _mm_storeu_si128((__m128i *) lanes, acc);
+    return lanes[0] + lanes[1] + count_scalar(words + i, n - i);
+}
+
+/**
+ * @brief the words equal to all ones, 2 at a time: each one is full if the
+ *        8 bytes of its compare mask are set
+ */
+__attribute__((target("sse2")))
+static uint64_t not_full_sse(const uint64_t *words, size_t n)
+{
+    const __m128i ones = _mm_set1_epi32(-1);
+    uint64_t mask = 0;
+    size_t i = 0;
+
+    for (; i + 2 <= n; i += 2) {
+        const __m128i v = _mm_loadu_si128((const __m128i *) (words + i));
+        const int full = _mm_movemask_epi8(_mm_cmpeq_epi32(v, ones));
+        if ((full & 0xff) != 0xff) {
+            mask |= UINT64_C(1) << i;
+        }
+        if ((full >> 8) != 0xff) {
+            mask |= UINT64_C(1) << (i + 1);
+        }
+    }
+    return mask | (i < n ? not_full_scalar(words + i, n - i) << i : 0);
+}
+
+__attribute__((target("sse2")))
+static void fill_sse(uint64_t *words, size_t n, uint64_t value)
+{
+    const __m128i v = _mm_set1_epi64x((long long) value);
+    size_t i = 0;
+
+    for (; i + 2 <= n; i += 2) {
+        _mm_storeu_si128((__m128i *) (words + i), v);
+    }
+    fill_scalar(words + i, n - i, value);
+}
+
+__attribute__((target("sse2")))
+static void combine_sse(uint64_t *dst, const uint64_t *src, size_t n, enum bm_op op)
+{
+    size_t i = 0;
+
+    for (; i + 2 <= n; i += 2) {
+        const __m128i a = _mm_loadu_si128((const __m128i *) (dst + i));
+        const __m128i b = _mm_loadu_si128((const __m128i *) (src + i));
+        const __m128i r = op == BM_AND ? _mm_and_si128(a, b) : op == BM_OR ? _mm_or_si128(a, b) : _mm_xor_si128(a, b);
+        _mm_storeu_si128((__m128i *) (dst + i), r);
+    }
+    combine_scalar(dst + i, src + i, n - i, op);
+}
+
+/**
+ * @brief popcount 4 words at a time, as count_sse()
+ */
+__attribute__((target("avx2")))
+static uint64_t count_avx2(const uint64_t *words, size_t n)
+{
+    const __m256i table = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                           0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low = _mm256_set1_epi8(0x0f);
+    __m256i acc = _mm256_setzero_si256();
+    uint64_t lanes[4];
+    size_t i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        const __m256i v = _mm256_loadu_si256((const __m256i *) (words + i));
+        const __m256i lo = _mm256_shuffle_epi8(table, _mm256_and_si256(v, low));
+        const __m256i hi = _mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi16(v, 4), low));
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(_mm256_add_epi8(lo, hi), _mm256_setzero_si256()));
+    }
+    _mm256_storeu_si256((__m256i *) lanes, acc);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + count_scalar(words + i, n - i);
+}
+
+/**
+ * @brief the words equal to all ones, 4 at a time (one sign bit per word)
+ */
+__attribute__((target("avx2")))
+static uint64_t not_full_avx2(const uint64_t *words, size_t n)
+{
+    const __m256i ones = _mm256_set1_epi64x(-1);
+    uint64_t full = 0;
+    size_t i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        const __m256i v = _mm256_loadu_si256((const __m256i *) (words + i));
+        full |= (uint64_t) _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(v, ones))) << i;
+    }
+    // les mots pleins parmi les i premiers sont à 1 dans full
+    full = ~full & (i == BITS_PER_VECTOR ? UINT64_MAX : (UINT64_C(1) << i) - 1);
+    return full | (i < n ? not_full_scalar(words + i, n - i) << i : 0);
+}
+
+__attribute__((target("avx2")))
+static void fill_avx2(uint64_t *words, size_t n, uint64_t value)
+{
+    const __m256i v = _mm256_set1_epi64x((long long) value);
+    size_t i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        _mm256_storeu_si256((__m256i *) (words + i), v);
+    }
+    fill_scalar(words + i, n - i, value);
+}
+
+__attribute__((target("avx2")))
+static void combine_avx2(uint64_t *dst, const uint64_t *src, size_t n, enum bm_op op)
+{
+    size_t i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        const __m256i a = _mm256_loadu_si256((const __m256i *) (dst + i));
+        const __m256i b = _mm256_loadu_si256((const __m256i *) (src + i));
+        const __m256i r = op == BM_AND ? _mm256_and_si256(a, b)
+                          : op == BM_OR ? _mm256_or_si256(a, b) : _mm256_xor_si256(a, b);
+        _mm256_storeu_si256((__m256i *) (dst + i), r);
+    }
+    combine_scalar(dst + i, src + i, n - i, op);
+}
+
+static const struct bm_kernels kernels_sse = {
+    BM_KERNEL_SSE, "sse", count_sse, not_full_sse, fill_sse, combine_sse
+};
+
+static const struct bm_kernels kernels_avx2 = {
+    BM_KERNEL_AVX2, "avx2", count_avx2, not_full_avx2, fill_avx2, combine_avx2
+};
+#endif
+
+static const struct bm_kernels *kernels = NULL;
+
+/**
+ * @brief the kernels for kind, NULL if this CPU cannot run them
+ */
+static const struct bm_kernels *kernels_for(enum bm_kernel kind)
+{
+#ifdef BMBLOCK_X86
+    __builtin_cpu_init();
+    if ((kind == BM_KERNEL_AUTO || kind == BM_KERNEL_AVX2) && __builtin_cpu_supports("avx2")) {
+        return &kernels_avx2;
+    }
+    if ((kind == BM_KERNEL_AUTO || kind == BM_KERNEL_SSE) && __builtin_cpu_supports("ssse3")) {
+        return &kernels_sse;
+    }
+#endif
+    if (kind == BM_KERNEL_AUTO || kind == BM_KERNEL_SCALAR) {
+        return &kernels_scalar;
+    }
+    return NULL;
+}
+
+/**
+ * @brief the kernels in use, chosen at the first call
+ */
+static const struct bm_kernels *bm_kernels(void)
+{
+    if (kernels == NULL) {
+        kernels = kernels_for(BM_KERNEL_AUTO);
+    }
+    return kernels;
+}
+
+/**
+ * @brief choose the kernels of the word operations (for benchmarks and tests)
+ * @param kind BM_KERNEL_AUTO for the best one this CPU has
+ * @return 0 on success; ERR_BAD_PARAMETER if this CPU cannot run them
+ */
+int bm_set_kernel(enum bm_kernel kind)
+{
+    const struct bm_kernels *chosen = kernels_for(kind);
+
+    if (chosen == NULL) {
+        return ERR_BAD_PARAMETER;
+    }
+    kernels = chosen;
+    return 0;
+}
+
+/**
+ * @brief the name of the kernels in use: "avx2", "sse" or "scalar"
+ */
+const char *bm_kernel_name(void)
+{
+    return bm_kernels() -> name;
+}
+
+
+/**
+ * @brief the free bits of word i of bm[]; the bits after max are not free
+ */
+static uint64_t word_free(const struct bmblock_array *b, size_t i)
+{
+    const uint64_t nb_bits = b -> max - b -> min + 1;
+    uint64_t bits = ~(b -> bm[i]);
+
+    if (i == b -> length - 1 && nb_bits % BITS_PER_VECTOR != 0) {
+        bits &= (UINT64_C(1) << (nb_bits % BITS_PER_VECTOR)) - 1;
+    }
+    return bits;
+}
+
+/**
+ * @brief bring the summary bits of word i of bm[] up to date
+ */
+static void summary_update(struct bmblock_array *b, size_t i)
+{
+    const size_t j = i / BITS_PER_VECTOR;
+    const uint64_t bit = UINT64_C(1) << (i % BITS_PER_VECTOR);
+    const uint64_t top_bit = UINT64_C(1) << (j % BITS_PER_VECTOR);
+
+    if (word_free(b, i) != 0) {
+        b -> summary[j] |= bit;
+    } else {
+        b -> summary[j] &= ~bit;
+    }
+    if (b -> summary[j] != 0) {
+        b -> top[j / BITS_PER_VECTOR] |= top_bit;
+    } else {
+        b -> top[j / BITS_PER_VECTOR] &= ~top_bit;
+    }
+}
+
+/**
+ * @brief rebuild the summary bits of all the words of bm[], 64 words at a time
+ */
+static void summary_build(struct bmblock_array *b)
+{
+    const struct bm_kernels *k = bm_kernels();
+    const size_t summary_length = (b -> length + BITS_PER_VECTOR - 1) / BITS_PER_VECTOR;
+
+    for (size_t j = 0; j < summary_length; ++j) {
+        const size_t first = j * BITS_PER_VECTOR;
+        const size_t n = b -> length - first < BITS_PER_VECTOR ? b -> length - first : BITS_PER_VECTOR;
+        b -> summary[j] = k -> not_full(b -> bm + first, n);
+    }
+    memset(b -> top, 0, b -> top_length * sizeof(uint64_t));
+    for (size_t j = 0; j < summary_length; ++j) {
+        if (b -> summary[j] != 0) {
+            b -> top[j / BITS_PER_VECTOR] |= UINT64_C(1) << (j % BITS_PER_VECTOR);
+        }
+    }
+    // le dernier mot n'est pas forcément entier
+    summary_update(b, b -> length - 1);
+}
+
+/**
+ * @brief the first word of bm[], from word i on, that has a free bit
+ * @return the index of the word; length if there is none
+ */
+static size_t next_free_word(const struct bmblock_array *b, size_t i)
+{
+    if (i >= b -> length) {
+        return b -> length;
+    }
+
+    // dans le mot de résumé de i
+    size_t j = i / BITS_PER_VECTOR;
+    uint64_t bits = b -> summary[j] & (UINT64_MAX << (i % BITS_PER_VECTOR));
+    if (bits != 0) {
+        return j * BITS_PER_VECTOR + (size_t) __builtin_ctzll(bits);
+    }
+
+    // sinon le premier mot de résumé non nul après j, trouvé au niveau du dessus
+    ++j;
+    size_t k = j / BITS_PER_VECTOR;
+    if (k >= b -> top_length) {
+        return b -> length;
+    }
+    bits = b -> top[k] & (UINT64_MAX << (j % BITS_PER_VECTOR));
+    while (bits == 0) {
+        if (++k >= b -> top_length) {
+            return b -> length;
+        }
+        bits = b -> top[k];
+    }
+    j = k * BITS_PER_VECTOR + (size_t) __builtin_ctzll(bits);
+    return j * BITS_PER_VECTOR + (size_t) __builtin_ctzll(b -> summary[j]);
+}
+
 
 /**
  * @brief allocate a new bmblock_array to handle elements indexed
@@ -31,7 +404,10 @@ struct bmblock_array *bm_alloc(uint64_t min, uint64_t max)
         err = ERR_BAD_PARAMETER;
     } else {
         size_t taille = (max - min)/(sizeof(uint64_t)*8);
-        b = calloc(1, sizeof(struct bmblock_array) + sizeof(uint64_t)*(taille));
+        size_t summary_length = (taille + 1 + BITS_PER_VECTOR - 1) / BITS_PER_VECTOR;
+        size_t top_length = (summary_length + BITS_PER_VECTOR - 1) / BITS_PER_VECTOR;
+        // les deux niveaux de résumé suivent bm[] dans le même bloc
+        b = calloc(1, sizeof(struct bmblock_array) + sizeof(uint64_t)*(taille + summary_length + top_length));
 
         if (b == NULL) {
             err = ERR_NOMEM;
@@ -40,8 +416,12 @@ struct bmblock_array *bm_alloc(uint64_t min, uint64_t max)
             b -> cursor = 0;
             b -> min = min;
             b -> max = max;
+            b -> summary = b -> bm + b -> length;
+            b -> top = b -> summary + summary_length;
+            b -> top_length = top_length;
 
-            memset(b -> bm, 0, b -> length);
+            // tout est libre au départ
+            summary_build(b);
         }
     }
     if (err) {
@@ -79,6 +459,7 @@ void bm_set(struct bmblock_array *bmblock_array, uint64_t x)
     if (bmblock_array != NULL && x >= bmblock_array -> min && x <= bmblock_array -> max) {
         uint64_t i = (x - bmblock_array-> min)/(sizeof(uint64_t)*8);
         (bmblock_array -> bm[i]) = (bmblock_array -> bm[i]) | (UINT64_C(1) << ((x - bmblock_array -> min)%(sizeof(uint64_t)*8)));
+        summary_update(bmblock_array, i);
     }
 }
 
@@ -92,13 +473,187 @@ void bm_clear(struct bmblock_array *bmblock_array, uint64_t x)
     if (bmblock_array != NULL && x >= bmblock_array -> min && x <= bmblock_array -> max) {
         uint64_t i = (x - bmblock_array -> min)/(sizeof(uint64_t)*8);
         (bmblock_array -> bm[i]) = (bmblock_array -> bm[i]) & ~(UINT64_C(1) << ((x - bmblock_array -> min)%(sizeof(uint64_t)*8)));
+        summary_update(bmblock_array, i);
+
+        if ((x - bmblock_array -> min) < bmblock_array -> cursor) {
+            bmblock_array -> cursor = x - bmblock_array -> min;
+        }
+    }
+}
+
+/**
+ * @brief the mask of the bits [from, to) of a word (0 <= from < to <= 64)
+ */
+static uint64_t range_mask(uint64_t from, uint64_t to)
+{
+    const uint64_t high = to == BITS_PER_VECTOR ? UINT64_MAX : (UINT64_C(1) << to) - 1;
+    return high & (UINT64_MAX << from);
+}
+
+/**
+ * @brief set (value 1) or clear (value 0) the bits [first, end) of words:
+ *        the words in between the two ends are filled by the kernel
+ */
+static void bits_fill(uint64_t *words, uint64_t first, uint64_t end, int value)
+{
+    const size_t w0 = (size_t) (first / BITS_PER_VECTOR);
+    const size_t w1 = (size_t) ((end - 1) / BITS_PER_VECTOR);
+    const uint64_t head = range_mask(first % BITS_PER_VECTOR, w0 == w1 ? end - w0 * BITS_PER_VECTOR : BITS_PER_VECTOR);
+    const uint64_t tail = range_mask(0, end - w1 * BITS_PER_VECTOR);
+
+    words[w0] = value ? words[w0] | head : words[w0] & ~head;
+    if (w1 > w0) {
+        bm_kernels() -> fill(words + w0 + 1, w1 - w0 - 1, value ? UINT64_MAX : 0);
+        words[w1] = value ? words[w1] | tail : words[w1] & ~tail;
     }
+}
 
-    if ((x - bmblock_array -> min) < bmblock_array -> cursor) {
+/**
+ * @brief set (value 1) or clear (value 0) the bits [x, x+n) that are in the array
+ */
+static void bm_fill_range(struct bmblock_array *b, uint64_t x, uint64_t n, int value)
+{
+    if (b == NULL || n == 0 || x < b -> min || x > b -> max) {
+        return;
+    }
+    const uint64_t first = x - b -> min;
+    const uint64_t end = (n > b -> max - x + 1 ? b -> max - x + 1 : n) + first;
+    const size_t w0 = (size_t) (first / BITS_PER_VECTOR);
+    const size_t w1 = (size_t) ((end - 1) / BITS_PER_VECTOR);
+
+    bits_fill(b -> bm, first, end, value);
+
+    // les mots entiers du milieu deviennent pleins (ou vides) dans le résumé
+    if (w1 > w0 + 1) {
+        bits_fill(b -> summary, w0 + 1, w1, !value);
+        for (size_t j = (w0 + 1) / BITS_PER_VECTOR; j <= (w1 - 1) / BITS_PER_VECTOR; ++j) {
+            const uint64_t top_bit = UINT64_C(1) << (j % BITS_PER_VECTOR);
+            if (b -> summary[j] != 0) {
+                b -> top[j / BITS_PER_VECTOR] |= top_bit;
+            } else {
+                b -> top[j / BITS_PER_VECTOR] &= ~top_bit;
+            }
+        }
+    }
+    summary_update(b, w0);
+    summary_update(b, w1);
+}
+
+/**
+ * @brief set to 1 the bits of the values [x, x+n), a word at a time
+ * @param bmblock_array the array containing the values we want to set
+ * @param x the first value of the range
+ * @param n the number of values of the range; the part after max is ignored
+ */
+void bm_set_range(struct bmblock_array *bmblock_array, uint64_t x, uint64_t n)
+{
+    bm_fill_range(bmblock_array, x, n, 1);
+}
+
+/**
+ * @brief set to 0 the bits of the values [x, x+n), a word at a time
+ * @param bmblock_array the array containing the values we want to clear
+ * @param x the first value of the range
+ * @param n the number of values of the range; the part after max is ignored
+ */
+void bm_clear_range(struct bmblock_array *bmblock_array, uint64_t x, uint64_t n)
+{
+    bm_fill_range(bmblock_array, x, n, 0);
+
+    if (bmblock_array != NULL && n > 0 && x >= bmblock_array -> min && x <= bmblock_array -> max
+        && (x - bmblock_array -> min) < bmblock_array -> cursor) {
         bmblock_array -> cursor = x - bmblock_array -> min;
     }
 }
 
+/**
+ * @brief the first run of n free bits within the bits [start, end) of b
+ * @return the index of its first bit; end if there is none
+ */
+static uint64_t find_run_in(const struct bmblock_array *b, uint64_t n, uint64_t start, uint64_t end)
+{
+    uint64_t pos = start;
+    uint64_t run_start = start;
+    uint64_t run = 0;
+    int in_run = 0;
+
+    while (pos < end && run_start + n <= end) {
+        const size_t i = (size_t) (pos / BITS_PER_VECTOR);
+        const uint64_t shift = pos % BITS_PER_VECTOR;
+        const uint64_t free_bits = word_free(b, i) & (UINT64_MAX << shift);
+
+        if (!in_run) {
+            // début d'une suite: le prochain bit libre, en sautant les mots pleins
+            if (free_bits == 0) {
+                pos = (uint64_t) next_free_word(b, i + 1) * BITS_PER_VECTOR;
+                run_start = pos;
+            } else {
+                pos = i * BITS_PER_VECTOR + (uint64_t) __builtin_ctzll(free_bits);
+                run_start = pos;
+                run = 0;
+                in_run = 1;
+            }
+            continue;
+        }
+
+        // la suite continue jusqu'au prochain bit occupé du mot
+        const uint64_t used = ~free_bits & (UINT64_MAX << shift);
+        if (used == 0) {
+            run += BITS_PER_VECTOR - shift;
+            pos = (i + 1) * BITS_PER_VECTOR;
+        } else {
+            const uint64_t stop = (uint64_t) __builtin_ctzll(used);
+            run += stop - shift;
+            pos = i * BITS_PER_VECTOR + stop;
+            in_run = run >= n;
+        }
+        if (run >= n) {
+            return run_start;
+        }
+    }
+    return end;
+}
+
+/**
+ * @brief find n contiguous unused bits and set them: the first such run
+ *        from goal on, else the first one before goal
+ * @param bmblock_array the array we want to search for place
+ * @param n the length of the run (>0)
+ * @param goal the value where the run should preferably start (a value
+ *        outside [min, max] means min)
+ * @return <0 on failure (ERR_NO_PLACE if there is no such run), the first
+ *         value of the run otherwise
+ */
+int bm_find_run(struct bmblock_array *bmblock_array, uint64_t n, uint64_t goal)
+{
+    M_REQUIRE_NON_NULL(bmblock_array);
+    const uint64_t nb_bits = bmblock_array -> max - bmblock_array -> min + 1;
+
+    if (n == 0) {
+        return ERR_BAD_PARAMETER;
+    }
+    if (n > nb_bits) {
+        return ERR_NO_PLACE;
+    }
+    const uint64_t from = goal >= bmblock_array -> min && goal <= bmblock_array -> max ? goal - bmblock_array -> min : 0;
+
+    uint64_t found = find_run_in(bmblock_array, n, from, nb_bits);
+    if (found == nb_bits && from > 0) {
+        // puis avant le but; la suite peut finir au-delà de lui
+        const uint64_t end = from + n - 1 < nb_bits ? from + n - 1 : nb_bits;
+        found = find_run_in(bmblock_array, n, 0, end);
+        if (found == end) {
+            found = nb_bits;
+        }
+    }
+    if (found == nb_bits) {
+        return ERR_NO_PLACE;
+    }
+
+    bm_set_range(bmblock_array, found + bmblock_array -> min, n);
+    return (int) (found + bmblock_array -> min);
+}
+
 void bm_print(struct bmblock_array *bmblock_array)
 {
     if (bmblock_array != NULL) {
@@ -133,39 +688,151 @@ void bm_print(struct bmblock_array *bmblock_array)
 int bm_find_next(struct bmblock_array *bmblock_array)
 {
     M_REQUIRE_NON_NULL(bmblock_array);
-    int err = 0;
-    uint64_t i = 0;
-    int k = 0;
-
-    while (k == 0) {
-        i = (bmblock_array -> cursor)/(sizeof(uint64_t)*8);
-
-        if (bmblock_array -> bm[i] != UINT64_C(-1)) {
-            // il reste encore la place
-            if (!((bmblock_array -> bm[i]) & (UINT64_C(1) << ((bmblock_array -> cursor)%(sizeof(uint64_t)*8))))) {
-                // si la valeur du curseur actuelle est zero
-                err = bmblock_array -> cursor + bmblock_array -> min;
-                k = 1;
-            }
+    const uint64_t nb_bits = bmblock_array -> max - bmblock_array -> min + 1;
 
-            if ((bmblock_array -> cursor < bmblock_array -> max - bmblock_array -> min ) && k == 0) {
-                // si on n'a pas atteint la taille de la structure, on incrémente le curseur
-                ++(bmblock_array -> cursor);
-            } else if (k == 0) {
-                err = ERR_NO_PLACE;
-                k = 1;
-            }
-        } else { // passer au block de 64 bits suivant
-            ++i;
-            if (i < bmblock_array -> length) {
-                bmblock_array -> cursor = i * sizeof(uint64_t) * 8;
-            } else {
-                err = ERR_NO_PLACE;
-                bmblock_array -> cursor = i * sizeof(uint64_t) * 8 - 1;
-                k = 1;
-            }
+    if (bmblock_array -> cursor < nb_bits) {
+        const int found = bm_find_zero(bmblock_array, bmblock_array -> cursor + bmblock_array -> min);
+        if (found >= 0) {
+            bmblock_array -> cursor = (uint64_t) found - bmblock_array -> min;
+            return found;
+        }
+    }
+
+    bmblock_array -> cursor = nb_bits - 1;
+    return ERR_NO_PLACE;
+}
+
+/**
+ * @brief return the first unused value from x on, without changing the cursor
+ * @param bmblock_array the array we want to search for place
+ * @param x the value where the search starts (min if it is smaller)
+ * @return <0 on failure (ERR_NO_PLACE if every value from x on is used),
+ *         the first unused value otherwise
+ */
+int bm_find_zero(const struct bmblock_array *bmblock_array, uint64_t x)
+{
+    M_REQUIRE_NON_NULL(bmblock_array);
+
+    if (x < bmblock_array -> min) {
+        x = bmblock_array -> min;
+    }
+    if (x > bmblock_array -> max) {
+        return ERR_NO_PLACE;
+    }
+
+    // d'abord la fin du mot de x
+    const uint64_t pos = x - bmblock_array -> min;
+    size_t i = (size_t) (pos / BITS_PER_VECTOR);
+    uint64_t bits = word_free(bmblock_array, i) & (UINT64_MAX << (pos % BITS_PER_VECTOR));
+
+    if (bits == 0) {
+        // puis le premier mot suivant qui a un bit libre, d'après le résumé
+        i = next_free_word(bmblock_array, i + 1);
+        if (i >= bmblock_array -> length) {
+            return ERR_NO_PLACE;
+        }
+        bits = word_free(bmblock_array, i);
+    }
+    return (int) (i * BITS_PER_VECTOR + (uint64_t) __builtin_ctzll(bits) + bmblock_array -> min);
+}
+
+/**
+ * @brief return the number of used values (bits set to 1)
+ * @param bmblock_array the array we want to count
+ * @return the number of bits set; 0 if bmblock_array is NULL
+ */
+uint64_t bm_count(const struct bmblock_array *bmblock_array)
+{
+    if (bmblock_array == NULL) {
+        return 0;
+    }
+    const uint64_t nb_bits = bmblock_array -> max - bmblock_array -> min + 1;
+    const size_t last = bmblock_array -> length - 1;
+    // dans le dernier mot, les bits après max ne comptent pas
+    const uint64_t valid = nb_bits % BITS_PER_VECTOR ? (UINT64_C(1) << (nb_bits % BITS_PER_VECTOR)) - 1 : UINT64_MAX;
+
+    return bm_kernels() -> count(bmblock_array -> bm, last)
+           + (uint64_t) __builtin_popcountll(bmblock_array -> bm[last] & valid);
+}
+
+/**
+ * @brief the size of the bits of an array in bytes, as written by bm_export()
+ * @param bmblock_array the array
+ * @return the number of bytes; 0 if bmblock_array is NULL
+ */
+size_t bm_size(const struct bmblock_array *bmblock_array)
+{
+    return bmblock_array == NULL ? 0 : bmblock_array -> length * sizeof(uint64_t);
+}
+
+/**
+ * @brief copy the bits of an array to memory (to write them to the disk):
+ *        bit k of byte i is the value min + 8*i + k
+ * @param bmblock_array the array (IN)
+ * @param data bm_size() bytes of memory (OUT)
+ */
+void bm_export(const struct bmblock_array *bmblock_array, void *data)
+{
+    if (bmblock_array == NULL || data == NULL) {
+        return;
+    }
+    uint8_t *ptr = data;
+
+    for (size_t i = 0; i < bmblock_array -> length; ++i) {
+        for (size_t k = 0; k < sizeof(uint64_t); ++k) {
+            ptr[i * sizeof(uint64_t) + k] = (uint8_t) (bmblock_array -> bm[i] >> (8 * k));
         }
     }
+}
 
-    return err;
+/**
+ * @brief set all the bits of an array from memory written by bm_export()
+ * @param bmblock_array the array (IN-OUT)
+ * @param data bm_size() bytes of memory (IN)
+ */
+void bm_import(struct bmblock_array *bmblock_array, const void *data)
+{
+    if (bmblock_array == NULL || data == NULL) {
+        return;
+    }
+    const uint8_t *ptr = data;
+    const uint64_t nb_bits = bmblock_array -> max - bmblock_array -> min + 1;
+
+    for (size_t i = 0; i < bmblock_array -> length; ++i) {
+        uint64_t word = 0;
+        for (size_t k = 0; k < sizeof(uint64_t); ++k) {
+            word |= (uint64_t) ptr[i * sizeof(uint64_t) + k] << (8 * k);
+        }
+        bmblock_array -> bm[i] = word;
+    }
+    // les bits après max restent à 0, comme ceux de bm_set()
+    if (nb_bits % BITS_PER_VECTOR != 0) {
+        bmblock_array -> bm[bmblock_array -> length - 1] &= (UINT64_C(1) << (nb_bits % BITS_PER_VECTOR)) - 1;
+    }
+    summary_build(bmblock_array);
+    bmblock_array -> cursor = 0;
+}
+
+/**
+ * @brief combine two arrays of the same values bit by bit: dst = dst op src
+ *        (to compare two bitmaps, e.g. one read from the disk and one rebuilt)
+ * @param dst the array changed (IN-OUT)
+ * @param src the other array (IN)
+ * @param op BM_AND, BM_OR or BM_XOR
+ * @return 0 on success; ERR_BAD_PARAMETER if the arrays do not have the same min and max
+ */
+int bm_combine(struct bmblock_array *dst, const struct bmblock_array *src, enum bm_op op)
+{
+    M_REQUIRE_NON_NULL(dst);
+    M_REQUIRE_NON_NULL(src);
+
+    if (dst -> min != src -> min || dst -> max != src -> max
+        || (op != BM_AND && op != BM_OR && op != BM_XOR)) {
+        return ERR_BAD_PARAMETER;
+    }
+    bm_kernels() -> combine(dst -> bm, src -> bm, dst -> length, op);
+    summary_build(dst);
+    // des valeurs ont pu se libérer n'importe où
+    dst -> cursor = 0;
+    return 0;
 }
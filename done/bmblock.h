@@ -15,16 +15,40 @@
 extern "C" {
 #endif
 
+/*
+ * Two summary levels above bm[] make bm_find_next() independent of the
+ * number of full words: bit i of summary[] is set when bm[i] has a free
+ * bit, bit j of top[] when summary[j] is not zero. Both point into the
+ * same allocation as the structure, which a single free() releases.
+ */
 struct bmblock_array {
-   size_t length;
-   uint64_t cursor;
+   size_t length;          /* number of words of bm[] */
+   uint64_t cursor;        /* bm_find_next() searches from this bit on */
    uint64_t min;
    uint64_t max;
+   uint64_t *summary;      /* (length+63)/64 words: words of bm[] with a free bit */
+   uint64_t *top;          /* (length+4095)/4096 words: non-zero words of summary[] */
+   size_t top_length;      /* number of words of top[] */
    uint64_t bm[1];
 };
 
 #define BITS_PER_VECTOR (8*sizeof(((struct bmblock_array*)0)->bm[0]))
 
+/* kernels of the operations on whole words, see bm_set_kernel() */
+enum bm_kernel {
+   BM_KERNEL_AUTO,    /* the best one this CPU has */
+   BM_KERNEL_SCALAR,
+   BM_KERNEL_SSE,     /* SSE2 and SSSE3 */
+   BM_KERNEL_AVX2
+};
+
+/* operations of bm_combine() */
+enum bm_op {
+   BM_AND,
+   BM_OR,
+   BM_XOR
+};
+
 /**
  * @brief allocate a new bmblock_array to handle elements indexed
  * between min and max (included, thus (max-min+1) elements).
@@ -63,6 +87,95 @@ void bm_clear(struct bmblock_array *bmblock_array, uint64_t x);
  */
 int bm_find_next(struct bmblock_array *bmblock_array);
 
+/**
+ * @brief set to 1 the bits of the values [x, x+n), a word at a time
+ * @param bmblock_array the array containing the values we want to set
+ * @param x the first value of the range
+ * @param n the number of values of the range; the part after max is ignored
+ */
+void bm_set_range(struct bmblock_array *bmblock_array, uint64_t x, uint64_t n);
+
+/**
+ * @brief set to 0 the bits of the values [x, x+n), a word at a time
+ * @param bmblock_array the array containing the values we want to clear
+ * @param x the first value of the range
+ * @param n the number of values of the range; the part after max is ignored
+ */
+void bm_clear_range(struct bmblock_array *bmblock_array, uint64_t x, uint64_t n);
+
+/**
+ * @brief find n contiguous unused bits and set them: the first such run
+ *        from goal on, else the first one before goal
+ * @param bmblock_array the array we want to search for place
+ * @param n the length of the run (>0)
+ * @param goal the value where the run should preferably start (a value
+ *        outside [min, max] means min)
+ * @return <0 on failure (ERR_NO_PLACE if there is no such run), the first
+ *         value of the run otherwise
+ */
+int bm_find_run(struct bmblock_array *bmblock_array, uint64_t n, uint64_t goal);
+
+/**
+ * @brief return the first unused value from x on, without changing the cursor
+ * @param bmblock_array the array we want to search for place
+ * @param x the value where the search starts (min if it is smaller)
+ * @return <0 on failure (ERR_NO_PLACE if every value from x on is used),
+ *         the first unused value otherwise
+ */
+int bm_find_zero(const struct bmblock_array *bmblock_array, uint64_t x);
+
+/**
+ * @brief return the number of used values (bits set to 1)
+ * @param bmblock_array the array we want to count
+ * @return the number of bits set; 0 if bmblock_array is NULL
+ */
+uint64_t bm_count(const struct bmblock_array *bmblock_array);
+
+/**
+ * @brief the size of the bits of an array in bytes, as written by bm_export()
+ * @param bmblock_array the array
+ * @return the number of bytes; 0 if bmblock_array is NULL
+ */
+size_t bm_size(const struct bmblock_array *bmblock_array);
+
+/**
+ * @brief copy the bits of an array to memory (to write them to the disk):
+ *        bit k of byte i is the value min + 8*i + k
+ * @param bmblock_array the array (IN)
+ * @param data bm_size() bytes of memory (OUT)
+ */
+void bm_export(const struct bmblock_array *bmblock_array, void *data);
+
+/**
+ * @brief set all the bits of an array from memory written by bm_export()
+ * @param bmblock_array the array (IN-OUT)
+ * @param data bm_size() bytes of memory (IN)
+ */
+void bm_import(struct bmblock_array *bmblock_array, const void *data);
+
+/**
+ * @brief combine two arrays of the same values bit by bit: dst = dst op src
+ *        (to compare two bitmaps, e.g. one read from the disk and one rebuilt)
+ * @param dst the array changed (IN-OUT)
+ * @param src the other array (IN)
+ * @param op BM_AND, BM_OR or BM_XOR
+ * @return 0 on success; ERR_BAD_PARAMETER if the arrays do not have the same min and max
+ */
+int bm_combine(struct bmblock_array *dst, const struct bmblock_array *src, enum bm_op op);
+
+/**
+ * @brief choose the kernels of the word operations (count, range fills,
+ *        combinations, summary); by default the best one this CPU has
+ * @param kind the kernels to use
+ * @return 0 on success; ERR_BAD_PARAMETER if this CPU cannot run them
+ */
+int bm_set_kernel(enum bm_kernel kind);
+
+/**
+ * @brief the name of the kernels in use: "avx2", "sse" or "scalar"
+ */
+const char *bm_kernel_name(void);
+
 /**
  * @brief usefull to see (and debug) content of a bmblock_array
  * @param bmblock_array the array we want to see
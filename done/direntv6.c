@@ -16,6 +16,8 @@
 #include <string.h>
 #include "direntv6.h"
 #include "inode.h"
+#include "inode_pool.h"
+#include "histo.h"
 
 /**
  * @brief opens a directory reader for the specified inode 'inr'
@@ -41,6 +43,9 @@ int direntv6_opendir(const struct unix_filesystem *u, uint16_t inr, struct direc
     }
 
     d -> fv6 = fiv6;
+    // un répertoire est toujours lu en entier: préchargement maximal dès le début
+    d -> fv6.ra_window = FILEV6_RA_MAX;
+    d -> entries = d -> dirs;
     d -> cur = 0;
     d -> last = 0;
 
@@ -62,10 +67,13 @@ int direntv6_readdir(struct directory_reader *d, char *name, uint16_t *child_inr
 
     // si on est à la fin du block, on essaie de lire la suite
     if (d -> cur >= d -> last) {
-        int err = filev6_readblock(&(d -> fv6), d -> dirs);
+        const void *sector = NULL;
+        int err = filev6_readblock_ref(&(d -> fv6), d -> dirs, &sector);
         if (err <= 0) {
             return err; // s'il n'y a pas de suite, => C'est la fin du fichier donc on renvoie 0
         }
+        // pas de copie si le disque est mappé en mémoire
+        d -> entries = sector;
         // s'il y a une suite, on regarde combien de fichiers il y a dans le dossier, et on remplit dirs
         d -> last = err / (int)sizeof(struct direntv6);
         d -> cur = 0;
@@ -79,9 +87,9 @@ int direntv6_readdir(struct directory_reader *d, char *name, uint16_t *child_inr
 
     // si on est pas à la fin du block, on lit juste le répertoire suivant
 
-    *child_inr = (d -> dirs[d -> cur]).d_inumber;
-    strncpy(name, (d -> dirs[d -> cur]).d_name, DIRENT_MAXLEN);
-    name[DIRENT_MAXLEN+1] = '\0';
+    *child_inr = (d -> entries[d -> cur]).d_inumber;
+    strncpy(name, (d -> entries[d -> cur]).d_name, DIRENT_MAXLEN);
+    name[DIRENT_MAXLEN] = '\0';
 
     ++(d -> cur);
 
@@ -146,13 +154,9 @@ int direntv6_print_tree(const struct unix_filesystem *u, uint16_t inr, const cha
 }
 
 /**
- * @brief get the inode number for the given path
- * @param u a mounted filesystem
- * @param inr the root of the subtree
- * @param entry the pathname relative to the subtree
- * @return inr on success; <0 on error
+ * @brief direntv6_dirlookup() without the latency measure
  */
-int direntv6_dirlookup(const struct unix_filesystem *u, uint16_t inr, const char *entry)
+static int direntv6_dirlookup_impl(const struct unix_filesystem *u, uint16_t inr, const char *entry)
 {
     M_REQUIRE_NON_NULL(u);
     M_REQUIRE_NON_NULL(entry);
@@ -227,7 +231,7 @@ int direntv6_dirlookup(const struct unix_filesystem *u, uint16_t inr, const char
 
     // Ouvrir le prochain dossier ou retourner l'inode number
     if (tailleTot > shiftTaille + taille) { // il faut encore lire un dossier
-        err = direntv6_dirlookup(u, inr_next, entry+taille+shiftTaille);
+        err = direntv6_dirlookup_impl(u, inr_next, entry+taille+shiftTaille);
 
         if (err == 0) {
             err = (int) inr_next;
@@ -242,13 +246,25 @@ int direntv6_dirlookup(const struct unix_filesystem *u, uint16_t inr, const char
 }
 
 /**
- * @brief create a new direntv6 with the given name and given mode
+ * @brief get the inode number for the given path
  * @param u a mounted filesystem
- * @param entry the path of the new entry
- * @param mode the mode of the new inode
+ * @param inr the root of the subtree
+ * @param entry the pathname relative to the subtree
  * @return inr on success; <0 on error
  */
-int direntv6_create(struct unix_filesystem *u, const char *entry, uint16_t mode)
+int direntv6_dirlookup(const struct unix_filesystem *u, uint16_t inr, const char *entry)
+{
+    uint64_t start = histo_now();
+    int ret = direntv6_dirlookup_impl(u, inr, entry);
+
+    histo_record(HISTO_DIRENTV6_DIRLOOKUP, start);
+    return ret;
+}
+
+/**
+ * @brief direntv6_create() without the latency measure
+ */
+static int direntv6_create_impl(struct unix_filesystem *u, const char *entry, uint16_t mode)
 {
     M_REQUIRE_NON_NULL(u);
     M_REQUIRE_NON_NULL(entry);
@@ -329,6 +345,7 @@ int direntv6_create(struct unix_filesystem *u, const char *entry, uint16_t mode)
 
     // vérifier que le fils n'existe pas
     uint16_t child = 0;
+    uint16_t sibling = 0;
     char nom_cmp[DIRENT_MAXLEN+1] = "";
     do {
         err =  direntv6_readdir(&d_parent, nom_cmp, &child);
@@ -336,10 +353,23 @@ int direntv6_create(struct unix_filesystem *u, const char *entry, uint16_t mode)
             free(entry_usable);
             return ERR_FILENAME_ALREADY_EXISTS;
         }
+        if (err > 0) {
+            sibling = child;
+        }
     } while (err > 0);
 
     // Création de l'inode: (si on a le droit de le faire)
-    err = inode_alloc(u);
+    // un répertoire commence un groupe de secteurs d'inodes libre; un fichier
+    // va près du dernier frère de ce groupe, sinon du parent, pour lire le
+    // répertoire et ses inodes dans peu de secteurs
+    const uint16_t group = INODE_POOL_GROUP_SECTORS * INODES_PER_SECTOR;
+    if (mode & IFDIR) {
+        err = inode_alloc_dir(u, d_parent.fv6.i_number);
+    } else if (sibling != 0 && sibling / group == d_parent.fv6.i_number / group) {
+        err = inode_alloc_near(u, sibling);
+    } else {
+        err = inode_alloc_near(u, d_parent.fv6.i_number);
+    }
     if (err < 0) {
         free(entry_usable);
         return err;
@@ -364,3 +394,19 @@ int direntv6_create(struct unix_filesystem *u, const char *entry, uint16_t mode)
     return filev6_writebytes(u, &(d_parent.fv6), &dirs, sizeof(struct direntv6));
 }
 
+/**
+ * @brief create a new direntv6 with the given name and given mode
+ * @param u a mounted filesystem
+ * @param entry the path of the new entry
+ * @param mode the mode of the new inode
+ * @return inr on success; <0 on error
+ */
+int direntv6_create(struct unix_filesystem *u, const char *entry, uint16_t mode)
+{
+    uint64_t start = histo_now();
+    int ret = direntv6_create_impl(u, entry, mode);
+
+    histo_record(HISTO_DIRENTV6_CREATE, start);
+    return ret;
+}
+
@@ -20,6 +20,7 @@ extern "C" {
 struct directory_reader {
     struct filev6 fv6;
     struct direntv6 dirs[DIRENTRIES_PER_SECTOR];
+    const struct direntv6 *entries;   /* current sector: dirs or a mapped sector */
     int cur ;
     int last;
 };
@@ -15,11 +15,18 @@
 #include "inode.h"
 #include "sector.h"
 #include "bmblock.h"
+#include "histo.h"
+
+// nombre maximal de secteurs lus d'un coup par filev6_readbytes (64 ko)
+#define READV_MAX_SECTORS 128
 
 int write_small_file(struct unix_filesystem *u, struct filev6 *fv6, const void *buf, int len);
 int write_big_file(struct unix_filesystem *u, struct filev6 *fv6, const void *buf, int len);
 int write_change(struct unix_filesystem *u, struct filev6 *fv6);
 int filev6_writesector(struct unix_filesystem *u, struct filev6 *fv6, const void* data, int len, uint32_t* sector_number);
+static void filev6_readahead(struct filev6 *fv6, int32_t size);
+static void filev6_prefetch(struct filev6 *fv6);
+static enum sector_class filev6_class(const struct filev6 *fv6, struct sector_device *dev);
 
 /**
  * @brief open the file corresponding to a given inode; set offset to zero
@@ -29,6 +36,21 @@ int filev6_writesector(struct unix_filesystem *u, struct filev6 *fv6, const void
  * @return 0 on success; the appropriate error code (<0) on error
  */
 int filev6_open(const struct unix_filesystem *u, uint16_t inr, struct filev6 *fv6)
+{
+    return filev6_open_with(u, inr, fv6, 0);
+}
+
+/**
+ * @brief open the file corresponding to a given inode with the given
+ *        options; set offset to zero
+ * @param u the filesystem (IN)
+ * @param inr the inode number (IN)
+ * @param fv6 the complete filve6 data structure (OUT)
+ * @param flags FILEV6_PREFETCH: queue the reads of the first sectors of a
+ *        regular file in the sector cache
+ * @return 0 on success; the appropriate error code (<0) on error
+ */
+int filev6_open_with(const struct unix_filesystem *u, uint16_t inr, struct filev6 *fv6, int flags)
 {
     //required_arguments
     M_REQUIRE_NON_NULL(u);
@@ -43,10 +65,53 @@ int filev6_open(const struct unix_filesystem *u, uint16_t inr, struct filev6 *fv
     fv6->u = u;
     fv6->i_number = inr;
     fv6->offset = 0;
+    fv6->ra_next = 0;
+    fv6->ra_end = 0;
+    fv6->ra_window = 0;
+
+    if ((flags & FILEV6_PREFETCH) && !(fv6 -> i_node.i_mode & IFDIR)) {
+        filev6_prefetch(fv6);
+    }
 
     return 0;
 }
 
+/**
+ * @brief queue the reads of the first sectors of the file in the sector
+ *        cache: all of them up to FILEV6_PREFETCH_ALL sectors, else those of
+ *        its first FILEV6_PREFETCH_RUNS runs of contiguous sectors. The
+ *        sequential readahead of filev6_readblock() goes on after them.
+ * @param fv6 the filev6 just opened (IN-OUT; readahead state will be changed)
+ */
+static void filev6_prefetch(struct filev6 *fv6)
+{
+    uint32_t sectors[FILEV6_PREFETCH_ALL];
+    const int32_t nb_sect = (inode_getsize(&(fv6 -> i_node)) + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    const int whole = nb_sect <= FILEV6_PREFETCH_ALL;
+    uint32_t count = 0;
+    int runs = 0;
+
+    while ((int32_t) count < nb_sect && count < FILEV6_PREFETCH_ALL && (whole || runs < FILEV6_PREFETCH_RUNS)) {
+        uint32_t n = 0;
+        int first = inode_findrange(fv6 -> u, fv6 -> i_number, &(fv6 -> i_node), (int32_t) count,
+                                    FILEV6_PREFETCH_ALL - count, &n);
+        if (first <= 0) {
+            break;
+        }
+        for (uint32_t k = 0; k < n; ++k) {
+            sectors[count++] = (uint32_t) first + k;
+        }
+        ++runs;
+    }
+
+    // ce n'est qu'une indication: l'erreur éventuelle sera vue par la lecture elle-même
+    enum sector_class cls = filev6_class(fv6, fv6 -> u -> dev);
+    sector_prefetch(fv6 -> u -> dev, sectors, count);
+    sector_set_class(fv6 -> u -> dev, cls);
+
+    fv6 -> ra_end = (int32_t) count * SECTOR_SIZE;
+}
+
 /**
  * @brief change the current offset of the given file to the one specified
  * @param fv6 the filev6 (IN-OUT; offset will be changed)
@@ -76,10 +141,25 @@ int filev6_lseek(struct filev6 *fv6, int32_t offset)
  *             the appropriate error code (<0) on error
  */
 int filev6_readblock(struct filev6 *fv6, void *buf)
+{
+    const void *data = NULL;
+    int lu = filev6_readblock_ref(fv6, buf, &data);
+
+    if (lu > 0 && data != buf) {
+        memcpy(buf, data, SECTOR_SIZE);
+    }
+    return lu;
+}
+
+/**
+ * @brief filev6_readblock_ref() without the latency measure
+ */
+static int filev6_readblock_ref_impl(struct filev6 *fv6, void *buf, const void **data)
 {
     //required arguments
     M_REQUIRE_NON_NULL(fv6);
     M_REQUIRE_NON_NULL(buf);
+    M_REQUIRE_NON_NULL(data);
 
     //Already been fully read
     int inodeSize = inode_getsize(&(fv6 -> i_node));
@@ -89,12 +169,16 @@ int filev6_readblock(struct filev6 *fv6, void *buf)
         return 0;
     }
 
-    int findSector = inode_findsector(fv6 -> u, &(fv6 -> i_node), (fv6 -> offset)/SECTOR_SIZE);
+    filev6_readahead(fv6, inodeSize);
+
+    int findSector = inode_bmap(fv6 -> u, fv6 -> i_number, &(fv6 -> i_node), (fv6 -> offset)/SECTOR_SIZE);
     if (findSector < 0) {
         return findSector;
     }
 
-    int sectorRead = sector_read(fv6 -> u -> f, (uint32_t)findSector, buf);
+    enum sector_class cls = filev6_class(fv6, fv6 -> u -> dev);
+    int sectorRead = sector_read_ref(fv6 -> u -> dev, (uint32_t)findSector, buf, data);
+    sector_set_class(fv6 -> u -> dev, cls);
 
     if (sectorRead <0) {
         return sectorRead;
@@ -103,11 +187,182 @@ int filev6_readblock(struct filev6 *fv6, void *buf)
     int diff = inodeSize - fv6 -> offset;
     if (diff <= SECTOR_SIZE) {
         fv6 -> offset = inodeSize;
-        return diff;
     } else {
+        diff = SECTOR_SIZE;
         fv6 -> offset += SECTOR_SIZE;
-        return SECTOR_SIZE;
     }
+    fv6 -> ra_next = fv6 -> offset;
+    return diff;
+}
+
+/**
+ * @brief read at most SECTOR_SIZE from the file at the current cursor,
+ *        without copying the data when the disk is mapped in memory
+ * @param fv6 the filev6 (IN-OUT; offset will be changed)
+ * @param buf points to SECTOR_SIZE bytes of available memory, used only
+ *        if the sector cannot be referenced directly
+ * @param data set to the address of the data read (OUT)
+ * @return >0: the number of bytes of the file read; 0: end of file;
+ *             the appropriate error code (<0) on error
+ */
+int filev6_readblock_ref(struct filev6 *fv6, void *buf, const void **data)
+{
+    uint64_t start = histo_now();
+    int ret = filev6_readblock_ref_impl(fv6, buf, data);
+
+    histo_record(HISTO_FILEV6_READBLOCK, start);
+    return ret;
+}
+
+/**
+ * @brief prefetch the next sectors of the file if it is read sequentially.
+ *        A new window is requested when the cursor enters the second half
+ *        of the previous one, so that the reads stay ahead of the cursor.
+ * @param fv6 the filev6 (IN-OUT; readahead state will be changed)
+ * @param size the size of the file
+ */
+static void filev6_readahead(struct filev6 *fv6, int32_t size)
+{
+    uint32_t sectors[FILEV6_RA_MAX];
+    size_t count = 0;
+    int32_t pos = fv6 -> offset - fv6 -> offset % SECTOR_SIZE;
+
+    if (fv6 -> offset != fv6 -> ra_next) {
+        // accès aléatoire: pas de préchargement
+        fv6 -> ra_window = 0;
+        fv6 -> ra_end = pos;
+        return;
+    }
+
+    if (fv6 -> ra_window == 0) {
+        fv6 -> ra_window = FILEV6_RA_MIN;
+    }
+    if (fv6 -> ra_end < pos) {
+        fv6 -> ra_end = pos;
+    }
+    if (fv6 -> ra_end - pos > (int32_t) (fv6 -> ra_window / 2 * SECTOR_SIZE)) {
+        return;
+    }
+
+    while (count < fv6 -> ra_window && fv6 -> ra_end < size) {
+        int sector = inode_bmap(fv6 -> u, fv6 -> i_number, &(fv6 -> i_node), fv6 -> ra_end / SECTOR_SIZE);
+        if (sector <= 0) {
+            break;
+        }
+        sectors[count++] = (uint32_t) sector;
+        fv6 -> ra_end += SECTOR_SIZE;
+    }
+
+    // ce n'est qu'une indication: l'erreur éventuelle sera vue par la lecture elle-même
+    enum sector_class cls = filev6_class(fv6, fv6 -> u -> dev);
+    sector_prefetch(fv6 -> u -> dev, sectors, count);
+    sector_set_class(fv6 -> u -> dev, cls);
+
+    if (fv6 -> ra_window < FILEV6_RA_MAX) {
+        fv6 -> ra_window *= 2;
+    }
+}
+
+/**
+ * @brief count the accesses that follow as content of fv6 (directory or
+ *        regular file), unless the caller already chose a class: the
+ *        sectors of addresses of write_big_file() are such a "file"
+ * @param fv6 the file
+ * @param dev the device of its filesystem
+ * @return the previous class, to give back to sector_set_class()
+ */
+static enum sector_class filev6_class(const struct filev6 *fv6, struct sector_device *dev)
+{
+    if (dev -> io_class != SECTOR_CLASS_OTHER) {
+        return dev -> io_class;
+    }
+    return sector_set_class(dev, (fv6 -> i_node.i_mode & IFDIR) ? SECTOR_CLASS_DIRDATA : SECTOR_CLASS_FILEDATA);
+}
+
+/**
+ * @brief read at most len bytes from the file at the current cursor.
+ *        The sectors of the file that are contiguous on disk are read
+ *        with a single I/O (see sector_readv()).
+ * @param fv6 the filev6 (IN-OUT; offset will be changed)
+ * @param buf points to len bytes of available memory (OUT)
+ * @param len the maximum number of bytes to read
+ * @return >=0: the number of bytes of the file read (0: end of file);
+ *             the appropriate error code (<0) on error
+ */
+int filev6_readbytes(struct filev6 *fv6, void *buf, int len)
+{
+    M_REQUIRE_NON_NULL(fv6);
+    M_REQUIRE_NON_NULL(buf);
+
+    uint8_t *ptr = buf;
+    uint8_t sector[SECTOR_SIZE];
+    const void *data = NULL;
+    uint32_t sectors[READV_MAX_SECTORS];
+    int32_t inodeSize = inode_getsize(&(fv6 -> i_node));
+    enum sector_class cls = SECTOR_CLASS_OTHER;
+    int lu = 0;
+    int err = 0;
+
+    if (len < 0) {
+        return ERR_BAD_PARAMETER;
+    }
+    if (fv6 -> offset >= inodeSize) {
+        fv6 -> offset = inodeSize;
+        return 0;
+    }
+    if (len > inodeSize - fv6 -> offset) {
+        len = inodeSize - fv6 -> offset;
+    }
+
+    while (lu < len) {
+        int k = fv6 -> offset % SECTOR_SIZE;
+
+        if (k != 0 || len - lu < SECTOR_SIZE) {
+            // début ou fin partielle d'un secteur: on passe par un tampon
+            int n = SECTOR_SIZE - k < len - lu ? SECTOR_SIZE - k : len - lu;
+            err = inode_bmap(fv6 -> u, fv6 -> i_number, &(fv6 -> i_node), fv6 -> offset / SECTOR_SIZE);
+            if (err < 0) {
+                return err;
+            }
+            cls = filev6_class(fv6, fv6 -> u -> dev);
+            err = sector_read_ref(fv6 -> u -> dev, (uint32_t) err, sector, &data);
+            sector_set_class(fv6 -> u -> dev, cls);
+            if (err < 0) {
+                return err;
+            }
+            memcpy(ptr + lu, (const uint8_t *) data + k, (size_t) n);
+            lu += n;
+            fv6 -> offset += n;
+        } else {
+            // secteurs complets: une seule lecture par suite contiguë
+            int nb = (len - lu) / SECTOR_SIZE;
+            if (nb > READV_MAX_SECTORS) {
+                nb = READV_MAX_SECTORS;
+            }
+            // une recherche d'adresses par suite, pas par secteur
+            for (int i = 0; i < nb; ) {
+                uint32_t run = 0;
+                err = inode_findrange(fv6 -> u, fv6 -> i_number, &(fv6 -> i_node),
+                                      fv6 -> offset / SECTOR_SIZE + i, (uint32_t) (nb - i), &run);
+                if (err < 0) {
+                    return err;
+                }
+                for (uint32_t k = 0; k < run; ++k) {
+                    sectors[i++] = (uint32_t) err + k;
+                }
+            }
+            cls = filev6_class(fv6, fv6 -> u -> dev);
+            err = sector_readv(fv6 -> u -> dev, sectors, (size_t) nb, ptr + lu);
+            sector_set_class(fv6 -> u -> dev, cls);
+            if (err < 0) {
+                return err;
+            }
+            lu += nb * SECTOR_SIZE;
+            fv6 -> offset += nb * SECTOR_SIZE;
+        }
+    }
+
+    return lu;
 }
 
 /**
@@ -147,6 +402,9 @@ int filev6_create(struct unix_filesystem *u, uint16_t mode, struct filev6 *fv6)
     fv6 -> i_node = inode;
     fv6 -> u = u;
     fv6 -> offset = 0;
+    fv6 -> ra_next = 0;
+    fv6 -> ra_end = 0;
+    fv6 -> ra_window = 0;
 
 
     // écrire l'inode sur le disk
@@ -154,20 +412,20 @@ int filev6_create(struct unix_filesystem *u, uint16_t mode, struct filev6 *fv6)
 }
 
 /**
- * @brief write the len bytes of the given buffer on disk to the given filev6.
- * 		  this function choose between 3 functions if the file is big or small
- * @param u the filesystem (IN)
- * @param fv6 the filev6 (IN)
- * @param buf the data we want to write (IN)
- * @param len the length of the bytes we want to write
- * @return 0 on success; <0 on errror
+ * @brief filev6_writebytes() without the latency measure
  */
-int filev6_writebytes(struct unix_filesystem *u, struct filev6 *fv6, const void *buf, int len)
+static int filev6_writebytes_impl(struct unix_filesystem *u, struct filev6 *fv6, const void *buf, int len)
 {
     M_REQUIRE_NON_NULL(fv6);
     M_REQUIRE_NON_NULL(u);
     M_REQUIRE_NON_NULL(buf);
 
+    // toute écriture peut allouer des secteurs: la fbm doit être prête
+    int err_bm = mountv6_wait_bitmaps(u);
+    if (err_bm) {
+        return err_bm;
+    }
+
     int32_t taille_fichier_actu = inode_getsize(&(fv6 -> i_node));
     size_t taille_fichier_futur = (size_t) taille_fichier_actu + len;
 
@@ -181,7 +439,7 @@ int filev6_writebytes(struct unix_filesystem *u, struct filev6 *fv6, const void
     const uint8_t *buf_new = buf;
 
     // test que le fichier à écrire n'est pas trop grand:
-    if (taille_fichier_futur > 7*ADDRESSES_PER_SECTOR*SECTOR_SIZE) {
+    if (taille_fichier_futur > INODE_MAX_SIZE) {
         return ERR_FILE_TOO_LARGE;
     }
 
@@ -217,146 +475,312 @@ int filev6_writebytes(struct unix_filesystem *u, struct filev6 *fv6, const void
     return err;
 }
 
-
 /**
- * @brief write the len bytes of the given buffer on disk to the given filev6 for big files
+ * @brief write the len bytes of the given buffer on disk to the given filev6.
+ * 		  this function choose between 3 functions if the file is big or small
  * @param u the filesystem (IN)
  * @param fv6 the filev6 (IN)
  * @param buf the data we want to write (IN)
  * @param len the length of the bytes we want to write
  * @return 0 on success; <0 on errror
  */
-int write_big_file(struct unix_filesystem *u, struct filev6 *fv6, const void *buf, int len)
+int filev6_writebytes(struct unix_filesystem *u, struct filev6 *fv6, const void *buf, int len)
 {
-    M_REQUIRE_NON_NULL(fv6);
-    M_REQUIRE_NON_NULL(u);
-    M_REQUIRE_NON_NULL(buf);
+    uint64_t start = histo_now();
+    int ret = filev6_writebytes_impl(u, fv6, buf, len);
 
-    const uint8_t* ptr = buf;
-    uint8_t address_sector[SECTOR_SIZE];
-    int k = 0;
+    histo_record(HISTO_FILEV6_WRITEBYTES, start);
+    return ret;
+}
 
-    // on crée un petit fichier qui contiendra les adresses
-    struct filev6 address_file;
-    memset(&address_file, 0, sizeof(struct filev6));
-    memset(address_sector, 0, SECTOR_SIZE);
 
-    int32_t taille_data = inode_getsize(&(fv6 -> i_node));
-    int nb_sector_used = 0;
-    uint32_t data_sector_number = 0;
+/**
+ * @brief write one address into an indirect sector of a big file
+ * @param u the filesystem (IN)
+ * @param indirect the indirect sector; set to a newly allocated sector if fresh (IN-OUT)
+ * @param fresh whether the indirect sector must be allocated (its other addresses are 0)
+ * @param index the index of the address in the indirect sector
+ * @param value the address to write
+ * @return 0 on success; <0 on errror
+ */
+static int write_indirect(struct unix_filesystem *u, uint16_t *indirect, int fresh, int index, uint16_t value)
+{
+    uint16_t addr[ADDRESSES_PER_SECTOR];
+    int err = 0;
 
-    if (taille_data % SECTOR_SIZE) {
-        nb_sector_used = taille_data/SECTOR_SIZE +1;
+    if (fresh) {
+        memset(addr, 0, SECTOR_SIZE);
+        err = bm_find_next(u -> fbm);
+        if (err < 0) {
+            return err;
+        }
+        *indirect = (uint16_t) err;
+        bm_set(u -> fbm, *indirect);
     } else {
-        nb_sector_used = taille_data/SECTOR_SIZE;
+        err = sector_read(u -> dev, *indirect, addr);
+        if (err) {
+            return err;
+        }
     }
 
-    // créer un inode pour un faux fichier contenant des addresses
-    int err = inode_alloc(u);
-    if (err < 0) {
-        return err;
+    addr[index] = value;
+    err = sector_write(u -> dev, *indirect, addr);
+    if (err && fresh) {
+        // le secteur indirect n'est lié nulle part
+        bm_clear(u -> fbm, *indirect);
     }
+    return err;
+}
 
-    address_file.i_number = err;
-    address_file.i_node = fv6 -> i_node;
+/**
+ * @brief write the address of a new data sector of a big file: in the
+ *        indirect sector i_addr[file_sec_off/ADDRESSES_PER_SECTOR], or past
+ *        INODE_DOUBLE_OFF in an indirect sector listed by the double-indirect
+ *        sector i_addr[7]. The indirect sectors are allocated with their first address.
+ * @param u the filesystem (IN)
+ * @param inode the inode of the file; its addresses may change (IN-OUT)
+ * @param file_sec_off the offset of the new sector within the file (in sector-size units)
+ * @param sector the new data sector
+ * @return 0 on success; <0 on errror
+ */
+static int write_big_addr(struct unix_filesystem *u, struct inode *inode, int32_t file_sec_off, uint16_t sector)
+{
+    uint16_t dbl[ADDRESSES_PER_SECTOR];
+    uint16_t indirect = 0;
+    int32_t off = file_sec_off - INODE_DOUBLE_OFF;
+    int err = 0;
 
-    int32_t taille_addr = nb_sector_used*sizeof(uint8_t);
-    // changer la taille
-    err = inode_setsize(&address_file.i_node, 2*taille_addr);
-    if (err < 0) {
+    if (file_sec_off < INODE_DOUBLE_OFF) {
+        return write_indirect(u, &(inode -> i_addr[file_sec_off/ADDRESSES_PER_SECTOR]),
+                              file_sec_off%ADDRESSES_PER_SECTOR == 0,
+                              file_sec_off%ADDRESSES_PER_SECTOR, sector);
+    }
+    if (off/ADDRESSES_PER_SECTOR >= ADDRESSES_PER_SECTOR) {
+        return ERR_FILE_TOO_LARGE;
+    }
+
+    if (off%ADDRESSES_PER_SECTOR == 0) {
+        // nouveau secteur indirect, puis son adresse dans le secteur doublement indirect
+        err = write_indirect(u, &indirect, 1, 0, sector);
+        if (!err) {
+            err = write_indirect(u, &(inode -> i_addr[ADDR_SMALL_LENGTH - 1]), off == 0,
+                                 off/ADDRESSES_PER_SECTOR, indirect);
+            if (err) {
+                // le nouveau secteur indirect n'est lié nulle part
+                bm_clear(u -> fbm, indirect);
+            }
+        }
         return err;
     }
 
-    // écrire l'inode
-    err = inode_write(u, address_file.i_number, &address_file.i_node);
-    if (err < 0) {
+    err = sector_read(u -> dev, inode -> i_addr[ADDR_SMALL_LENGTH - 1], dbl);
+    if (err) {
         return err;
     }
+    indirect = dbl[off/ADDRESSES_PER_SECTOR];
+    return write_indirect(u, &indirect, 0, off%ADDRESSES_PER_SECTOR, sector);
+}
+
+/**
+ * @brief the number of multiples of ADDRESSES_PER_SECTOR in [a, b)
+ */
+static uint32_t nb_multiples(uint32_t a, uint32_t b)
+{
+    if (b <= a) {
+        return 0;
+    }
+    return (b + ADDRESSES_PER_SECTOR - 1) / ADDRESSES_PER_SECTOR - (a + ADDRESSES_PER_SECTOR - 1) / ADDRESSES_PER_SECTOR;
+}
+
+/**
+ * @brief the number of indirect sectors (and double-indirect sector) that
+ *        write_big_addr() allocates for the file sectors [off, off + nb)
+ */
+static uint32_t nb_indirects(uint32_t off, uint32_t nb)
+{
+    const uint32_t end = off + nb;
+    uint32_t count = nb_multiples(off, end < INODE_DOUBLE_OFF ? end : INODE_DOUBLE_OFF);
 
-    // ouvrir le fichier correctement
-    err = filev6_open(u, address_file.i_number, &address_file);
+    if (end > INODE_DOUBLE_OFF) {
+        const uint32_t lo = off > INODE_DOUBLE_OFF ? off - INODE_DOUBLE_OFF : 0;
+        count += nb_multiples(lo, end - INODE_DOUBLE_OFF) + (lo == 0);
+    }
+    return count;
+}
+
+/**
+ * @brief allocate a run of contiguous data sectors for the next len bytes of
+ *        a file, as long as possible (up to all of them) and starting at
+ *        goal if it can, and write the bytes there
+ * @param u the filesystem (IN)
+ * @param fv6 the filev6 (IN)
+ * @param data the data we want to write (IN)
+ * @param len the length of the bytes we want to write (>0)
+ * @param goal the sector where the run should start (the one after the
+ *        last sector of the file), 0 if any
+ * @param first the first sector of the run (OUT)
+ * @param count the number of sectors of the run (OUT)
+ * @return number of bytes written on success; <0 on errror
+ */
+static int write_run(struct unix_filesystem *u, struct filev6 *fv6, const uint8_t *data, int len,
+                     uint32_t goal, uint32_t *first, uint32_t *count)
+{
+    uint8_t last[SECTOR_SIZE];
+    uint32_t nb = (uint32_t) (len + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    int err = 0;
+
+    err = bm_find_run(u -> fbm, nb, goal);
+    while (err == ERR_NO_PLACE && nb > 1) {
+        // pas de suite assez longue: on en cherche une deux fois plus courte
+        nb /= 2;
+        err = bm_find_run(u -> fbm, nb, goal);
+    }
     if (err < 0) {
         return err;
     }
+    *first = (uint32_t) err;
+    *count = nb;
+
+    const int nb_bytes = len < (int) (nb * SECTOR_SIZE) ? len : (int) (nb * SECTOR_SIZE);
+    const uint32_t full = (uint32_t) nb_bytes / SECTOR_SIZE;
+    enum sector_class cls = filev6_class(fv6, u -> dev);
+
+    err = 0;
+    if (full > 0) {
+        err = sector_write_range(u -> dev, *first, full, data);
+    }
+    if (!err && full < nb) {
+        // le dernier secteur est complété par des zéros
+        memset(last, 0, SECTOR_SIZE);
+        memcpy(last, data + full * SECTOR_SIZE, (size_t) nb_bytes % SECTOR_SIZE);
+        err = sector_write(u -> dev, *first + full, last);
+    }
+    sector_set_class(u -> dev, cls);
+    if (err) {
+        bm_clear_range(u -> fbm, *first, nb);
+        return err;
+    }
+    return nb_bytes;
+}
+
+/**
+ * @brief write the len bytes of the given buffer on disk to the given filev6 for big files.
+ *        The new data sectors are allocated in runs of contiguous sectors, as
+ *        long as the data, after the last sector of the file if possible.
+ * @param u the filesystem (IN)
+ * @param fv6 the filev6 (IN)
+ * @param buf the data we want to write (IN)
+ * @param len the length of the bytes we want to write
+ * @return 0 on success; <0 on errror
+ */
+int write_big_file(struct unix_filesystem *u, struct filev6 *fv6, const void *buf, int len)
+{
+    M_REQUIRE_NON_NULL(fv6);
+    M_REQUIRE_NON_NULL(u);
+    M_REQUIRE_NON_NULL(buf);
+
+    const uint8_t* ptr = buf;
+    int32_t taille_data = inode_getsize(&(fv6 -> i_node));
+    int32_t nb_sector_used = (taille_data + SECTOR_SIZE - 1)/SECTOR_SIZE;
+    uint32_t data_sector_number = 0;
+    uint32_t goal = 0;
+    enum sector_class cls = SECTOR_CLASS_OTHER;
+    int err = 0;
+
+    if (taille_data + (int64_t) len > INODE_MAX_SIZE) {
+        return ERR_FILE_TOO_LARGE;
+    }
 
-    // lire le dernier secteur d'adresses
-    if (taille_data % SECTOR_SIZE > 0) {
-        err = filev6_lseek(&address_file, 2*(taille_addr-1));
+    if (nb_sector_used > 0) {
+        err = inode_findsector(u, &(fv6 -> i_node), nb_sector_used - 1);
         if (err < 0) {
             return err;
         }
+        data_sector_number = (uint32_t) err;
+        goal = data_sector_number + 1;
+    }
+    if (data_sector_number >= u -> s.s_fsize) return ERR_NOT_ENOUGH_BLOCS;
 
-        err = filev6_readblock(&address_file, address_sector);
+    // le dernier secteur n'est pas plein: on le complète d'abord
+    if (taille_data % SECTOR_SIZE > 0 && len > 0) {
+        err = filev6_writesector(u, fv6, ptr, len, &data_sector_number);
         if (err < 0) {
             return err;
         }
+        ptr += err;
+        len -= err;
+        taille_data += err;
 
-        // lire le dernier secteur d'addresses
-        k = (2*(taille_addr - 1) % SECTOR_SIZE);
-        data_sector_number = (address_sector[k+1] << 8) + address_sector[k];
-        err = 0;
-    }
-    if (data_sector_number >= u -> s.s_fsize) return ERR_NOT_ENOUGH_BLOCS;
-    while (err == 0 && len > 0) {
-        if (taille_data > 7*ADDRESSES_PER_SECTOR*SECTOR_SIZE) {
-            err = ERR_BAD_PARAMETER;
+        err = inode_setsize(&(fv6 -> i_node), (int) taille_data);
+        if (err < 0) {
             return err;
         }
+        err = inode_write(u, fv6 -> i_number, &(fv6 -> i_node));
+        if (err < 0) {
+            return err;
+        }
+    }
 
-        // write_sector à ce secteur avec les data
-        err = filev6_writesector(u, fv6, ptr, len, &data_sector_number);
-
-        if (err > 0) {
-
-            ptr += err;
-            len -= err;
-            taille_data += err;
-
-            if (data_sector_number != 0) {
-                // si on a écrit les data dans un nouveau secteur
-                // il faut écrire son numéro dans le secteur d'adresses
-                err = write_small_file(u, &address_file, (uint16_t*) &data_sector_number, sizeof(uint16_t));
-                if (err < 0) {
-                    return err;
-                }
-                // il faut aller relire l'inode écrit par la fonction write_small_file
-                err = inode_read(u, address_file.i_number, &(address_file.i_node));
-                if (err < 0) {
-                    return err;
-                }
-            }
-            // car de toute façon on en a pas besoin de data_sector_number
-            data_sector_number = 0;
+    while (len > 0) {
+        const uint64_t nb_free = u -> fbm -> max - u -> fbm -> min + 1 - bm_count(u -> fbm);
+        uint32_t nb = (uint32_t) (len + SECTOR_SIZE - 1) / SECTOR_SIZE;
+        uint32_t first = 0;
+        uint32_t count = 0;
+        uint32_t linked = 0;
+        int nb_bytes = 0;
+
+        // les secteurs indirects de la suite doivent encore trouver de la place
+        while (nb > 0 && nb + nb_indirects((uint32_t) nb_sector_used, nb) > nb_free) {
+            --nb;
+        }
+        if (nb == 0) {
+            return ERR_NO_PLACE;
+        }
 
-            // écrire la nouvelle taille des datas
-            err = inode_setsize(&(fv6 -> i_node), (int) taille_data);
-            if (err < 0) {
-                return err;
-            }
+        nb_bytes = write_run(u, fv6, ptr, len < (int) (nb * SECTOR_SIZE) ? len : (int) (nb * SECTOR_SIZE),
+                             goal, &first, &count);
+        if (nb_bytes < 0) {
+            return nb_bytes;
+        }
+        goal = first + count;
 
-            err = inode_write(u, fv6 -> i_number, &(fv6 -> i_node));
-            if (err < 0) {
-                return err;
+        // les numéros des nouveaux secteurs dans les secteurs d'adresses
+        cls = sector_set_class(u -> dev, SECTOR_CLASS_INDIRECT);
+        for (err = 0; linked < count && err >= 0; ++linked) {
+            err = write_big_addr(u, &(fv6 -> i_node), nb_sector_used + (int32_t) linked, (uint16_t) (first + linked));
+        }
+        sector_set_class(u -> dev, cls);
+        if (err < 0) {
+            // la fin de la suite n'est liée à rien: rendue à la fbm; le fichier
+            // garde les secteurs déjà liés
+            --linked;
+            bm_clear_range(u -> fbm, first + linked, count - linked);
+            nb_bytes = (int) (linked * SECTOR_SIZE) < nb_bytes ? (int) (linked * SECTOR_SIZE) : nb_bytes;
+        }
+        ptr += nb_bytes;
+        len -= nb_bytes;
+        taille_data += nb_bytes;
+        nb_sector_used += (int32_t) linked;
+        if (err < 0) {
+            if (inode_setsize(&(fv6 -> i_node), (int) taille_data) == 0) {
+                (void) inode_write(u, fv6 -> i_number, &(fv6 -> i_node));
             }
+            return err;
         }
-    }
 
-    // mettre à jour les addresse dans le bon fv6
-    for (int i = 0; i<ADDR_SMALL_LENGTH; ++i) {
-        fv6 -> i_node.i_addr[i] = address_file.i_node.i_addr[i];
-    }
+        // écrire la nouvelle taille des datas
+        err = inode_setsize(&(fv6 -> i_node), (int) taille_data);
+        if (err < 0) {
+            return err;
+        }
 
-    err = inode_write(u, fv6 -> i_number, &(fv6 -> i_node));
-    if (err < 0) {
-        return err;
+        err = inode_write(u, fv6 -> i_number, &(fv6 -> i_node));
+        if (err < 0) {
+            return err;
+        }
     }
 
-    //supprimer l'inode fake
-    address_file.i_node.i_mode = 0;
-    err = inode_write(u, address_file.i_number, &(address_file.i_node));
-    bm_clear(u ->ibm, address_file.i_number);
-
-    return err;
+    return 0;
 }
 
 
@@ -392,7 +816,9 @@ int write_change(struct unix_filesystem *u, struct filev6 *fv6)
 
     // écrire les adresses dans le nouveau secteur
     uint32_t sector_number = 0;
+    enum sector_class cls = sector_set_class(u -> dev, SECTOR_CLASS_INDIRECT);
     err = filev6_writesector(u, fv6, data_addr, 2*nb_addr_used, &sector_number);
+    sector_set_class(u -> dev, cls);
     if (err<0) {
         return err;
     }
@@ -488,10 +914,11 @@ int filev6_writesector(struct unix_filesystem *u, struct filev6 *fv6, const void
     int nb_bytes = 0;
     uint8_t sector[SECTOR_SIZE];
     uint8_t read[SECTOR_SIZE];
+    enum sector_class cls = SECTOR_CLASS_OTHER;
 
     // mesure de la taille du fichier actuel
     int32_t taille_actu = inode_getsize(&fv6 -> i_node);
-    if (taille_actu >  7 * ADDRESSES_PER_SECTOR * SECTOR_SIZE) {
+    if (taille_actu > INODE_MAX_SIZE) {
         return ERR_FILE_TOO_LARGE;
     }
 
@@ -506,14 +933,16 @@ int filev6_writesector(struct unix_filesystem *u, struct filev6 *fv6, const void
         }
         memset(sector, 0, SECTOR_SIZE);
 
-        err = sector_read(u -> f, *sector_number, read);
+        cls = filev6_class(fv6, u -> dev);
+        err = sector_read(u -> dev, *sector_number, read);
 
         // rajouter à la fin la suite
         memcpy(sector, read, taille_last_sector);
         memcpy(sector + taille_last_sector, data, nb_bytes);
 
         // Ecrire le nouveau secteur et mettre à jour l'offset
-        err =  sector_write(u -> f, *sector_number, sector);
+        err =  sector_write(u -> dev, *sector_number, sector);
+        sector_set_class(u -> dev, cls);
         if (err) {
             return err;
         }
@@ -540,7 +969,9 @@ int filev6_writesector(struct unix_filesystem *u, struct filev6 *fv6, const void
         *sector_number = (uint32_t) err;
 
         // ecrire dans le secteur
-        err =  sector_write(u -> f, *sector_number, sector);
+        cls = filev6_class(fv6, u -> dev);
+        err =  sector_write(u -> dev, *sector_number, sector);
+        sector_set_class(u -> dev, cls);
         if (err) {
             return err;
         }
@@ -15,11 +15,27 @@
 extern "C" {
 #endif
 
+/* bounds of the readahead window of filev6_readblock(), in sectors */
+#define FILEV6_RA_MIN 4
+#define FILEV6_RA_MAX 32
+
+/* flags for filev6_open_with() */
+#define FILEV6_PREFETCH 0x1   /* load the first sectors of a regular file in the sector cache */
+
+/* with FILEV6_PREFETCH, a file of at most FILEV6_PREFETCH_ALL sectors is
+ * loaded whole, a larger one up to the end of its first FILEV6_PREFETCH_RUNS
+ * runs of contiguous sectors (FILEV6_PREFETCH_ALL sectors at most) */
+#define FILEV6_PREFETCH_ALL 128
+#define FILEV6_PREFETCH_RUNS 4
+
 struct filev6 {
     const struct unix_filesystem *u;     // the filesystem
     uint16_t i_number;                   // the inode number (on disk)
     struct inode i_node;                 // the content of the inode
     int32_t offset;                      // the current cursor within the file (in bytes)
+    int32_t ra_next;                     // offset of the next read if the access is sequential
+    int32_t ra_end;                      // end of the part of the file already prefetched (in bytes)
+    uint32_t ra_window;                  // sectors prefetched at a time; 0 after a random access
 };
 
 /**
@@ -31,6 +47,20 @@ struct filev6 {
  */
 int filev6_open(const struct unix_filesystem *u, uint16_t inr, struct filev6 *fv6);
 
+/**
+ * @brief open the file corresponding to a given inode with the given
+ *        options; set offset to zero
+ * @param u the filesystem (IN)
+ * @param inr the inode number (IN)
+ * @param fv6 the complete filve6 data structure (OUT)
+ * @param flags FILEV6_PREFETCH: queue the reads of the first sectors of a
+ *        regular file in the sector cache (asynchronous when the backend
+ *        supports it, see sector_prefetch()), so that the reads that follow
+ *        find them there
+ * @return 0 on success; the appropriate error code (<0) on error
+ */
+int filev6_open_with(const struct unix_filesystem *u, uint16_t inr, struct filev6 *fv6, int flags);
+
 /**
  * @brief change the current offset of the given file to the one specified
  * @param fv6 the filev6 (IN-OUT; offset will be changed)
@@ -40,7 +70,10 @@ int filev6_open(const struct unix_filesystem *u, uint16_t inr, struct filev6 *fv
 int filev6_lseek(struct filev6 *fv6, int32_t offset);
 
 /**
- * @brief read at most SECTOR_SIZE from the file at the current cursor
+ * @brief read at most SECTOR_SIZE from the file at the current cursor.
+ *        When the file is read sequentially, the next sectors are
+ *        prefetched in the sector cache (see sector_prefetch()); the
+ *        window doubles from FILEV6_RA_MIN up to FILEV6_RA_MAX sectors.
  * @param fv6 the filev6 (IN-OUT; offset will be changed)
  * @param buf points to SECTOR_SIZE bytes of available memory (OUT)
  * @return >0: the number of bytes of the file read; 0: end of file;
@@ -48,6 +81,31 @@ int filev6_lseek(struct filev6 *fv6, int32_t offset);
  */
 int filev6_readblock(struct filev6 *fv6, void *buf);
 
+/**
+ * @brief read at most SECTOR_SIZE from the file at the current cursor,
+ *        without copying the data when the disk is mapped in memory
+ *        (see sector_read_ref())
+ * @param fv6 the filev6 (IN-OUT; offset will be changed)
+ * @param buf points to SECTOR_SIZE bytes of available memory, used only
+ *        if the sector cannot be referenced directly
+ * @param data set to the address of the data read (OUT)
+ * @return >0: the number of bytes of the file read; 0: end of file;
+ *             the appropriate error code (<0) on error
+ */
+int filev6_readblock_ref(struct filev6 *fv6, void *buf, const void **data);
+
+/**
+ * @brief read at most len bytes from the file at the current cursor.
+ *        The sectors of the file that are contiguous on disk are read
+ *        with a single I/O (see sector_readv()).
+ * @param fv6 the filev6 (IN-OUT; offset will be changed)
+ * @param buf points to len bytes of available memory (OUT)
+ * @param len the maximum number of bytes to read
+ * @return >=0: the number of bytes of the file read (0: end of file);
+ *             the appropriate error code (<0) on error
+ */
+int filev6_readbytes(struct filev6 *fv6, void *buf, int len);
+
 /**
  * @brief create a new filev6
  * @param u the filesystem (IN)
@@ -19,13 +19,49 @@
 #include "direntv6.h"
 #include "error.h"
 #include "inode.h"
+#include "histo.h"
 
 struct unix_filesystem fs;
 
-static int fs_getattr(const char *path, struct stat *stbuf)
+/* flags given to filev6_open_with() at the first read of a file */
+static int open_flags = 0;
+
+// nombre d'entrées dont readdir lit les inodes ensemble
+#define FS_READDIR_BATCH 64
+
+/**
+ * @brief the attributes of a file, from its inode
+ * @param inr the inode number
+ * @param inode the inode (IN)
+ * @param stbuf the attributes (OUT)
+ */
+static void fs_fill_stat(uint16_t inr, const struct inode *inode, struct stat *stbuf)
+{
+    memset(stbuf, 0, sizeof(struct stat));
+
+    stbuf -> st_dev = 0;
+    stbuf -> st_ino = inr;
+    stbuf -> st_mode = (inode -> i_mode & IFDIR) ? S_IFDIR : S_IFREG;
+    stbuf -> st_mode = stbuf -> st_mode | S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH;
+    stbuf -> st_nlink = inode -> i_nlink;
+    stbuf -> st_uid = inode -> i_uid;
+    stbuf -> st_gid = inode -> i_gid;
+    stbuf -> st_rdev = 0;
+    stbuf -> st_size = inode_getsize(inode);
+    stbuf -> st_blksize = SECTOR_SIZE;
+    stbuf -> st_blocks = (stbuf -> st_size)/SECTOR_SIZE;
+    stbuf -> st_atim.tv_sec = inode -> atime[0];
+    stbuf -> st_atim.tv_nsec = inode -> atime[1];
+    stbuf -> st_mtim.tv_sec = inode -> mtime[0];
+    stbuf -> st_mtim.tv_nsec = inode -> mtime[1];
+    stbuf -> st_ctim.tv_sec = inode -> mtime[0];
+    stbuf -> st_ctim.tv_nsec = inode -> mtime[1];
+}
+
+static int fs_getattr_impl(const char *path, struct stat *stbuf)
 {
     int err = 0;
-    if (fs.f == NULL) {
+    if (fs.dev == NULL) {
         exit(1);
     }
 
@@ -41,31 +77,13 @@ static int fs_getattr(const char *path, struct stat *stbuf)
         return err;
     }
 
-    memset(stbuf, 0, sizeof(struct stat));
-
-    stbuf -> st_dev = 0;
-    stbuf -> st_ino = inode_nb;
-    stbuf -> st_mode = (file.i_node.i_mode & IFDIR) ? S_IFDIR : S_IFREG;
-    stbuf -> st_mode = stbuf -> st_mode | S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH;
-    stbuf -> st_nlink = file.i_node.i_nlink;
-    stbuf -> st_uid = file.i_node.i_uid;
-    stbuf -> st_gid = file.i_node.i_gid;
-    stbuf -> st_rdev = 0;
-    stbuf -> st_size = inode_getsize(&file.i_node);
-    stbuf -> st_blksize = SECTOR_SIZE;
-    stbuf -> st_blocks = (stbuf -> st_size)/SECTOR_SIZE;
-    stbuf -> st_atim.tv_sec = file.i_node.atime[0];
-    stbuf -> st_atim.tv_nsec = file.i_node.atime[1];
-    stbuf -> st_mtim.tv_sec = file.i_node.mtime[0];
-    stbuf -> st_mtim.tv_nsec = file.i_node.mtime[1];
-    stbuf -> st_ctim.tv_sec = file.i_node.mtime[0];
-    stbuf -> st_ctim.tv_nsec = file.i_node.mtime[1];
+    fs_fill_stat((uint16_t) inode_nb, &file.i_node, stbuf);
 
     return 0;
 }
 
-static int fs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
-                      off_t offset, struct fuse_file_info *fi)
+static int fs_readdir_impl(const char *path, void *buf, fuse_fill_dir_t filler,
+                           off_t offset, struct fuse_file_info *fi)
 {
     (void) offset;
     (void) fi;
@@ -84,25 +102,43 @@ static int fs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
 
     if (err < 0) return err;
 
-    char name[DIRENT_MAXLEN+1] = "";
-    err = direntv6_readdir(&d, name, &inode_nb);
-
-    while (err == 1) {
-        filler(buf, name, NULL, 0);
-        err = direntv6_readdir(&d, name, &inode_nb);
-    };
+    // readdir-plus: les attributs des entrées avec leurs noms, les inodes
+    // d'un paquet d'entrées étant lus ensemble
+    char names[FS_READDIR_BATCH][DIRENT_MAXLEN+1];
+    uint16_t inrs[FS_READDIR_BATCH];
+    struct inode inodes[FS_READDIR_BATCH];
+    struct stat st;
+    size_t nb = 0;
+
+    do {
+        err = direntv6_readdir(&d, names[nb], &inrs[nb]);
+        if (err == 1) {
+            ++nb;
+        }
+        if (nb == FS_READDIR_BATCH || (err != 1 && nb > 0)) {
+            // un inode illisible (ou tout le paquet, faute de mémoire) reste à 0:
+            // l'entrée est donnée sans attributs
+            memset(inodes, 0, nb * sizeof(struct inode));
+            const int read_err = inode_read_many(&fs, inrs, nb, inodes);
+            for (size_t k = 0; k < nb; ++k) {
+                const struct stat *entry = NULL;
+                if (!read_err || (inodes[k].i_mode & IALLOC)) {
+                    fs_fill_stat(inrs[k], &inodes[k], &st);
+                    entry = &st;
+                }
+                filler(buf, names[k], entry, 0);
+            }
+            nb = 0;
+        }
+    } while (err == 1);
 
     return 0;
 }
 
-static int fs_read(const char *path, char *buf, size_t size, off_t offset,
-                   struct fuse_file_info *fi)
+static int fs_read_impl(const char *path, char *buf, size_t size, off_t offset,
+                        struct fuse_file_info *fi)
 {
     (void) fi;
-    char *ptr = buf;
-    char buf2[SECTOR_SIZE];
-    memset(buf2, 0, SECTOR_SIZE);
-
     struct filev6 file;
 
     // ouvrir le fichier
@@ -112,7 +148,8 @@ static int fs_read(const char *path, char *buf, size_t size, off_t offset,
         return 0;
     }
 
-    err = filev6_open(&fs, (uint16_t) err, &file);
+    // la première lecture d'un fichier charge son début (--prefetch)
+    err = filev6_open_with(&fs, (uint16_t) err, &file, offset == 0 ? open_flags : 0);
     if (err != 0) {
         puts(ERR_MESSAGES[err - ERR_FIRST]);
         return 0;
@@ -124,47 +161,43 @@ static int fs_read(const char *path, char *buf, size_t size, off_t offset,
         return 0;
     }
 
-    size_t k = 0;
-    //lire les secteurs nécessaires pour avoir 64 ko au max
-    int nb_lu = 0;
-    if (size < SECTOR_SIZE) {
-
-        // utilisation de memcpy
-        k = file.offset % SECTOR_SIZE;
-        err = filev6_readblock(&file, buf2);
-        if (err < 0) {
-            return 0;
-        } else {
-            size_t bytesRead = (size_t) err;
-            if (size > bytesRead) {
-                size = bytesRead;
-            }
-            if (k + size > SECTOR_SIZE) {
-                size = (size_t) (SECTOR_SIZE - k);
-            }
-            memcpy(buf, buf2+k, size);
-            nb_lu = size;
-        }
+    // lire les secteurs nécessaires (64 ko au max), une lecture par suite de secteurs contigus
+    err = filev6_readbytes(&file, buf, (int) size);
+    if (err < 0) {
+        return 0;
+    }
 
-    } else {
-        do {
-            err = filev6_readblock(&file, ptr);
-            if (err == SECTOR_SIZE) {
-                ptr += SECTOR_SIZE;
-                ++k;
-            } else if (err > 0 && err < SECTOR_SIZE) {
-                err = 0;
-            }
-        } while (err > 0 && k*SECTOR_SIZE < size);
+    return err;
+}
 
-        if (err < 0) {
-            nb_lu = 0;
-        } else {
-            nb_lu = file.offset - offset;
-        }
-    }
+/* the callbacks given to FUSE measure the latency of each call */
+static int fs_getattr(const char *path, struct stat *stbuf)
+{
+    uint64_t start = histo_now();
+    int ret = fs_getattr_impl(path, stbuf);
+
+    histo_record(HISTO_FS_GETATTR, start);
+    return ret;
+}
+
+static int fs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
+                      off_t offset, struct fuse_file_info *fi)
+{
+    uint64_t start = histo_now();
+    int ret = fs_readdir_impl(path, buf, filler, offset, fi);
+
+    histo_record(HISTO_FS_READDIR, start);
+    return ret;
+}
+
+static int fs_read(const char *path, char *buf, size_t size, off_t offset,
+                   struct fuse_file_info *fi)
+{
+    uint64_t start = histo_now();
+    int ret = fs_read_impl(path, buf, size, offset, fi);
 
-    return nb_lu;
+    histo_record(HISTO_FS_READ, start);
+    return ret;
 }
 
 static struct fuse_operations available_ops = {
@@ -173,6 +206,27 @@ static struct fuse_operations available_ops = {
     .read	= fs_read,
 };
 
+/* our own options, given before the name of the FS */
+enum fs_opt_keys {
+    KEY_MMAP,   /* --mmap: map the whole disk in memory (zero-copy reads) */
+    KEY_URING,  /* --uring: asynchronous I/O with io_uring */
+    KEY_STATS,  /* --stats: print the I/O statistics and latencies at unmount */
+    KEY_PREFETCH /* --prefetch: load the first sectors of a file at its first read */
+};
+
+static struct fuse_opt fs_opts[] = {
+    FUSE_OPT_KEY("--mmap", KEY_MMAP),
+    FUSE_OPT_KEY("--uring", KEY_URING),
+    FUSE_OPT_KEY("--stats", KEY_STATS),
+    FUSE_OPT_KEY("--prefetch", KEY_PREFETCH),
+    FUSE_OPT_END
+};
+
+static const char *disk_name = NULL;
+// aucune opération n'écrit: pas de bitmaps à construire au montage
+static int mount_flags = MOUNTV6_RDONLY;
+static int print_stats = 0;
+
 /* From https://github.com/libfuse/libfuse/wiki/Option-Parsing.
  * This will look up into the args to search for the name of the FS.
  */
@@ -181,12 +235,24 @@ static int arg_parse(void *data, const char *filename, int key, struct fuse_args
     (void) data;
     (void) outargs;
 
-    if (key == FUSE_OPT_KEY_NONOPT && fs.f == NULL && filename != NULL) {
-        int err = mountv6(filename, &fs);
-        if (err != 0) {
-            puts(ERR_MESSAGES[err - ERR_FIRST]);
-            exit(1);
-        }
+    if (key == KEY_MMAP) {
+        mount_flags |= MOUNTV6_MMAP;
+        return 0;
+    }
+    if (key == KEY_URING) {
+        mount_flags |= MOUNTV6_URING;
+        return 0;
+    }
+    if (key == KEY_STATS) {
+        print_stats = 1;
+        return 0;
+    }
+    if (key == KEY_PREFETCH) {
+        open_flags |= FILEV6_PREFETCH;
+        return 0;
+    }
+    if (key == FUSE_OPT_KEY_NONOPT && disk_name == NULL && filename != NULL) {
+        disk_name = filename;
         return 0;
     }
     return 1;
@@ -195,9 +261,25 @@ static int arg_parse(void *data, const char *filename, int key, struct fuse_args
 int main(int argc, char *argv[])
 {
     struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
-    int ret = fuse_opt_parse(&args, NULL, NULL, arg_parse);
+    int ret = fuse_opt_parse(&args, NULL, fs_opts, arg_parse);
+    if (ret == 0 && disk_name != NULL) {
+        int err = mountv6_with(disk_name, &fs, mount_flags);
+        if (err != 0) {
+            puts(ERR_MESSAGES[err - ERR_FIRST]);
+            exit(1);
+        }
+    }
+    // le cache de secteurs, la table d'inodes et la classe d'I/O du disque
+    // ne sont pas protégés: les callbacks sont appelés par un seul thread
     if (ret == 0) {
-        ret = fuse_main(args.argc, args.argv, &available_ops, NULL);
+        ret = fuse_opt_add_arg(&args, "-s");
+        if (ret == 0) {
+            ret = fuse_main(args.argc, args.argv, &available_ops, NULL);
+        }
+        if (print_stats && fs.dev != NULL) {
+            sector_stats_print(stderr, fs.dev);
+            histo_print(stderr);
+        }
         (void)umountv6(&fs);
     }
     return ret;
@@ -0,0 +1,197 @@
+/**
+ * @file histo.c
+ * @brief latency histograms of the filesystem operations.
+ *
+ * @author José Ferro Pinto
+ * @author Marc Favrod-Coune
+ * @date march 2017
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include "histo.h"
+
+static struct histo histos[HISTO_NB_OPS];
+
+static const char * const histo_names[HISTO_NB_OPS] = {
+    "mountv6", "inode_read", "inode_read_many", "inode_findsector", "inode_findrange",
+    "filev6_readblock", "filev6_writebytes", "direntv6_dirlookup", "direntv6_create",
+    "fs_getattr", "fs_readdir", "fs_read"
+};
+
+/**
+ * @brief the bucket of a value
+ */
+static size_t bucket_of(uint64_t value)
+{
+    int e = 0;
+
+    if (value < 2 * HISTO_SUB_BUCKETS) {
+        return (size_t) value;
+    }
+    e = 63 - __builtin_clzll(value);   // bit de poids fort, >= HISTO_SUB_BITS + 1
+    return 2 * HISTO_SUB_BUCKETS + (size_t) (e - HISTO_SUB_BITS - 1) * HISTO_SUB_BUCKETS
+           + (size_t) ((value >> (e - HISTO_SUB_BITS)) - HISTO_SUB_BUCKETS);
+}
+
+/**
+ * @brief the largest value of a bucket
+ */
+static uint64_t bucket_high(size_t bucket)
+{
+    size_t k = 0;
+    int shift = 0;
+
+    if (bucket < 2 * HISTO_SUB_BUCKETS) {
+        return (uint64_t) bucket;
+    }
+    k = bucket - 2 * HISTO_SUB_BUCKETS;
+    shift = (int) (k / HISTO_SUB_BUCKETS) + 1;
+    return ((uint64_t) (HISTO_SUB_BUCKETS + k % HISTO_SUB_BUCKETS) << shift)
+           + (((uint64_t) 1 << shift) - 1);
+}
+
+/**
+ * @brief the current time, for histo_record()
+ * @return a monotonic time in nanoseconds
+ */
+uint64_t histo_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+/**
+ * @brief record the duration of an operation that started at start
+ * @param op the operation
+ * @param start the value of histo_now() when the operation started
+ */
+void histo_record(enum histo_op op, uint64_t start)
+{
+    if (op >= HISTO_NB_OPS) {
+        return;
+    }
+    histo_add(&histos[op], histo_now() - start);
+}
+
+/**
+ * @brief record a value in a histogram
+ * @param h the histogram
+ * @param value the value
+ */
+void histo_add(struct histo *h, uint64_t value)
+{
+    uint64_t max = 0;
+
+    if (h == NULL) {
+        return;
+    }
+
+    // le thread de construction des bitmaps (MOUNTV6_LAZY) mesure aussi ses lectures
+    __atomic_fetch_add(&(h -> buckets[bucket_of(value)]), 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&(h -> count), 1, __ATOMIC_RELAXED);
+    max = __atomic_load_n(&(h -> max), __ATOMIC_RELAXED);
+    while (value > max && !__atomic_compare_exchange_n(&(h -> max), &max, value, 0,
+            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        // max a été relu par l'échec de l'échange
+    }
+}
+
+/**
+ * @brief the value below which the given fraction of the recorded values are
+ * @param h the histogram
+ * @param q the fraction, in [0, 1] (0.99 for p99)
+ * @return the upper bound of the bucket holding that value (at most the
+ *         max), 0 if nothing was recorded
+ */
+uint64_t histo_percentile(const struct histo *h, double q)
+{
+    uint64_t rank = 0;
+    uint64_t seen = 0;
+
+    if (h == NULL || h -> count == 0) {
+        return 0;
+    }
+    if (q < 0) {
+        q = 0;
+    }
+    if (q > 1) {
+        q = 1;
+    }
+
+    // rang (à partir de 1) de la valeur cherchée
+    rank = (uint64_t) (q * (double) h -> count);
+    if ((double) rank < q * (double) h -> count || rank == 0) {
+        ++rank;
+    }
+
+    for (size_t b = 0; b < HISTO_NB_BUCKETS; ++b) {
+        seen += h -> buckets[b];
+        if (seen >= rank) {
+            uint64_t high = bucket_high(b);
+            return high < h -> max ? high : h -> max;
+        }
+    }
+    return h -> max;
+}
+
+/**
+ * @brief the histogram of an operation
+ * @param op the operation
+ * @return the histogram, NULL if op is invalid
+ */
+const struct histo *histo_get(enum histo_op op)
+{
+    if (op >= HISTO_NB_OPS) {
+        return NULL;
+    }
+    return &histos[op];
+}
+
+/**
+ * @brief the name of an operation, as printed by histo_print()
+ * @param op the operation
+ * @return a constant string
+ */
+const char *histo_name(enum histo_op op)
+{
+    if (op >= HISTO_NB_OPS) {
+        return "?";
+    }
+    return histo_names[op];
+}
+
+/**
+ * @brief forget all the values recorded
+ */
+void histo_reset(void)
+{
+    memset(histos, 0, sizeof(histos));
+}
+
+/**
+ * @brief print count, p50, p99, p999 and max of each operation (in ns)
+ * @param output the stream to print to
+ */
+void histo_print(FILE *output)
+{
+    if (output == NULL) {
+        return;
+    }
+
+    fprintf(output, "%-20s %10s %12s %12s %12s %12s\n", "operation (ns)", "count",
+            "p50", "p99", "p999", "max");
+    for (int op = 0; op < HISTO_NB_OPS; ++op) {
+        const struct histo *h = &histos[op];
+        fprintf(output, "%-20s %10" PRIu64 " %12" PRIu64 " %12" PRIu64 " %12" PRIu64 " %12" PRIu64 "\n",
+                histo_names[op], h -> count, histo_percentile(h, 0.5), histo_percentile(h, 0.99),
+                histo_percentile(h, 0.999), h -> max);
+    }
+}
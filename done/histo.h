@@ -0,0 +1,117 @@
+#pragma once
+
+/**
+ * @file histo.h
+ * @brief latency histograms of the filesystem operations.
+ *
+ * Each instrumented operation records its duration (in nanoseconds) in a
+ * log-bucketed histogram: values are grouped by power of two, and each
+ * power of two is split into HISTO_SUB_BUCKETS linear sub-buckets, so that
+ * a percentile is known within 1/HISTO_SUB_BUCKETS of its value whatever
+ * its magnitude (as in HDR histograms). Recording is a few relaxed atomic
+ * increments, so the histograms are always on.
+ *
+ * @author José Ferro Pinto
+ * @author Marc Favrod-Coune
+ * @date march 2017
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* sub-buckets per power of two (precision of 12.5%) */
+#define HISTO_SUB_BITS 3
+#define HISTO_SUB_BUCKETS (1 << HISTO_SUB_BITS)
+/* values below 2*HISTO_SUB_BUCKETS have one bucket each, then
+ * HISTO_SUB_BUCKETS buckets for each power of two up to 2^63 */
+#define HISTO_NB_BUCKETS (2 * HISTO_SUB_BUCKETS + (63 - HISTO_SUB_BITS) * HISTO_SUB_BUCKETS)
+
+/**
+ * @brief the instrumented operations
+ */
+enum histo_op {
+    HISTO_MOUNTV6 = 0,
+    HISTO_INODE_READ,
+    HISTO_INODE_READ_MANY,
+    HISTO_INODE_FINDSECTOR,
+    HISTO_INODE_FINDRANGE,
+    HISTO_FILEV6_READBLOCK,
+    HISTO_FILEV6_WRITEBYTES,
+    HISTO_DIRENTV6_DIRLOOKUP,
+    HISTO_DIRENTV6_CREATE,
+    HISTO_FS_GETATTR,
+    HISTO_FS_READDIR,
+    HISTO_FS_READ,
+    HISTO_NB_OPS
+};
+
+/**
+ * @brief the histogram of one operation
+ */
+struct histo {
+    uint64_t count;                       /* number of values recorded */
+    uint64_t max;                         /* largest value recorded */
+    uint64_t buckets[HISTO_NB_BUCKETS];
+};
+
+/**
+ * @brief the current time, for histo_record()
+ * @return a monotonic time in nanoseconds
+ */
+uint64_t histo_now(void);
+
+/**
+ * @brief record the duration of an operation that started at start
+ * @param op the operation
+ * @param start the value of histo_now() when the operation started
+ */
+void histo_record(enum histo_op op, uint64_t start);
+
+/**
+ * @brief record a value in a histogram
+ * @param h the histogram
+ * @param value the value
+ */
+void histo_add(struct histo *h, uint64_t value);
+
+/**
+ * @brief the value below which the given fraction of the recorded values are
+ * @param h the histogram
+ * @param q the fraction, in [0, 1] (0.99 for p99)
+ * @return the upper bound of the bucket holding that value (at most the
+ *         max), 0 if nothing was recorded
+ */
+uint64_t histo_percentile(const struct histo *h, double q);
+
+/**
+ * @brief the histogram of an operation
+ * @param op the operation
+ * @return the histogram, NULL if op is invalid
+ */
+const struct histo *histo_get(enum histo_op op);
+
+/**
+ * @brief the name of an operation, as printed by histo_print()
+ * @param op the operation
+ * @return a constant string
+ */
+const char *histo_name(enum histo_op op);
+
+/**
+ * @brief forget all the values recorded
+ */
+void histo_reset(void);
+
+/**
+ * @brief print count, p50, p99, p999 and max of each operation (in ns)
+ * @param output the stream to print to
+ */
+void histo_print(FILE *output);
+
+#ifdef __cplusplus
+}
+#endif
@@ -7,6 +7,7 @@
  * @date mars 2017
  */
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
 #include "inode.h"
@@ -15,6 +16,35 @@
 #include "error.h"
 #include "bmblock.h"
 #include "sector.h"
+#include "histo.h"
+#include "inode_cache.h"
+#include "inode_pool.h"
+
+/**
+ * @brief print one line of inode_scan_print()
+ * @param arg the number of inodes printed so far (IN-OUT)
+ */
+static int inode_scan_print_one(const struct unix_filesystem *u, uint16_t inr,
+                                const struct inode *inode, void *arg)
+{
+    int *count = arg;
+    FILE *output = stdout;
+
+    (void) u;
+    (void) inr;
+    if (inode == NULL) {
+        return ERR_IO;
+    }
+    ++(*count);
+    fprintf(output, "Inode %3d (", *count);
+    if (inode -> i_mode & IFDIR) {
+        fprintf(output, "%s", SHORT_DIR_NAME);
+    } else {
+        fprintf(output, "%s", SHORT_FIL_NAME);
+    }
+    fprintf(output, ") len %6d\n", inode_getsize(inode));
+    return 0;
+}
 
 /**
  * @brief read all inodes from disk and print out their content to
@@ -24,31 +54,12 @@
  */
 int inode_scan_print(const struct unix_filesystem *u)
 {
-    int err = 0;
-    FILE * output = stdout;
+    M_REQUIRE_NON_NULL(u);
+
     int count = 0;
-    struct inode inode_data[INODES_PER_SECTOR];
-    for (uint32_t i = 0; i < u -> s.s_isize; ++i) {
-        err = sector_read(u -> f, u -> s.s_inode_start + i, inode_data);
-        if (!err) {
-            for (uint16_t k = 0; k < INODES_PER_SECTOR; ++k) {
-                if (inode_data[k].i_mode & IALLOC) {
-                    ++count;
-                    fprintf(output, "Inode %3d (", count);
-                    if (inode_data[k].i_mode & IFDIR) {
-                        fprintf(output, "%s", SHORT_DIR_NAME);
-                    } else {
-                        fprintf(output, "%s", SHORT_FIL_NAME);
-                    }
-                    fprintf(output, ") len %6d\n", inode_getsize(inode_data + k));
-                }
-            }
-        } else {
-            fprintf(output,"\n");
-            return err;
-        }
-    }
-    fprintf(output,"\n");
+    int err = inode_scan(u, inode_scan_print_one, &count);
+
+    fprintf(stdout,"\n");
     return err;
 }
 
@@ -77,54 +88,123 @@ void inode_print(const struct inode* inode)
 }
 
 /**
- * @brief read the content of an inode from disk
- * @param u the filesystem (IN)
- * @param inr the inode number of the inode to read (IN)
- * @param inode the inode structure, read from disk (OUT)
- * @return 0 on success; <0 on error
+ * @brief inode_read() without the latency measure
  */
-int inode_read(const struct unix_filesystem *u, uint16_t inr, struct inode *inode)
+static int inode_read_impl(const struct unix_filesystem *u, uint16_t inr, struct inode *inode)
 {
     int err = 0;
-    struct inode data[INODES_PER_SECTOR];
+    struct inode buf[INODES_PER_SECTOR];
+    const struct inode *data = NULL;
+    const void *ref = NULL;
+    struct inode *cached = NULL;
     size_t nbrInodeSec = 0;
-
-    memset(data, 0, INODES_PER_SECTOR);
+    enum sector_class cls = SECTOR_CLASS_OTHER;
 
     // regarde de ou à ou commencent les inodes
     if ((u -> s.s_isize)*INODES_PER_SECTOR < inr || inr < ROOT_INUMBER) {
         err = ERR_INODE_OUTOF_RANGE;
         return err;
     }
-    // Lire le secteur
-    err = sector_read(u -> f, (uint32_t) (u -> s.s_inode_start + inr / INODES_PER_SECTOR), data);
-    if (!err) {
-        nbrInodeSec = inr%INODES_PER_SECTOR;
-        *inode = data[nbrInodeSec];
-        if (!(inode -> i_mode & IALLOC)) {
-            inode = NULL;
-            return ERR_UNALLOCATED_INODE;
+    if (u -> icache != NULL) {
+        // copie de l'inode en mémoire, lue sur le disque au premier accès
+        err = inode_cache_get(u, inr, &cached);
+        if (err) {
+            return err;
         }
+        *inode = *cached;
+        inode_cache_put(u, cached);
     } else {
+        // Lire le secteur
+        cls = sector_set_class(u -> dev, SECTOR_CLASS_INODE);
+        err = sector_read_ref(u -> dev, (uint32_t) (u -> s.s_inode_start + inr / INODES_PER_SECTOR), buf, &ref);
+        sector_set_class(u -> dev, cls);
+        if (err) {
+            return err;
+        }
+        data = ref;
+        nbrInodeSec = inr%INODES_PER_SECTOR;
+        *inode = data[nbrInodeSec];
+    }
+    if (!(inode -> i_mode & IALLOC)) {
+        return ERR_UNALLOCATED_INODE;
+    }
+    return 0;
+}
+
+/**
+ * @brief read the content of an inode from disk
+ * @param u the filesystem (IN)
+ * @param inr the inode number of the inode to read (IN)
+ * @param inode the inode structure, read from disk (OUT)
+ * @return 0 on success; <0 on error
+ */
+int inode_read(const struct unix_filesystem *u, uint16_t inr, struct inode *inode)
+{
+    uint64_t start = histo_now();
+    int ret = inode_read_impl(u, inr, inode);
+
+    histo_record(HISTO_INODE_READ, start);
+    return ret;
+}
+
+/**
+ * @brief hold the in-core copy of an allocated inode, without copying it
+ * @param u the filesystem (IN)
+ * @param inr the inode number of the inode (IN)
+ * @param inode set to the in-core inode, valid until inode_put() (OUT)
+ * @return 0 on success; <0 on error
+ */
+int inode_get(const struct unix_filesystem *u, uint16_t inr, const struct inode **inode)
+{
+    M_REQUIRE_NON_NULL(u);
+    M_REQUIRE_NON_NULL(inode);
+
+    struct inode *cached = NULL;
+    int err = 0;
+
+    if (u -> icache == NULL) {
+        return ERR_BAD_PARAMETER;
+    }
+    if ((u -> s.s_isize)*INODES_PER_SECTOR < inr || inr < ROOT_INUMBER) {
+        return ERR_INODE_OUTOF_RANGE;
+    }
+    err = inode_cache_get(u, inr, &cached);
+    if (err) {
         return err;
     }
+    if (!(cached -> i_mode & IALLOC)) {
+        inode_cache_put(u, cached);
+        return ERR_UNALLOCATED_INODE;
+    }
+    *inode = cached;
     return 0;
 }
 
 /**
- * @brief identify the sector that corresponds to a given portion of a file
+ * @brief release an inode held with inode_get()
  * @param u the filesystem (IN)
- * @param inode the inode (IN)
- * @param file_sec_off the offset within the file (in sector-size units)
- * @return >0: the sector on disk; <0 error
+ * @param inode the in-core inode given by inode_get() (IN)
  */
-int inode_findsector(const struct unix_filesystem *u, const struct inode *i, int32_t file_sec_off)
+void inode_put(const struct unix_filesystem *u, const struct inode *inode)
+{
+    if (u != NULL && u -> icache != NULL && inode != NULL) {
+        inode_cache_put(u, inode);
+    }
+}
+
+/**
+ * @brief inode_findsector() without the latency measure
+ */
+static int inode_findsector_impl(const struct unix_filesystem *u, const struct inode *i, int32_t file_sec_off)
 {
     int nbSector = 0;
     int32_t size = 0;
     int err = 0;
     int adNbSector = 0;
-    uint16_t data[SECTOR_SIZE];
+    uint16_t buf[ADDRESSES_PER_SECTOR];
+    const uint16_t *data = NULL;
+    const void *ref = NULL;
+    enum sector_class cls = SECTOR_CLASS_OTHER;
 
     if (i -> i_mode & IALLOC) {
         size = inode_getsize(i);
@@ -135,27 +215,139 @@ int inode_findsector(const struct unix_filesystem *u, const struct inode *i, int
             } else {
                 return (i -> i_addr[nbSector]);
             }
-        } else if (size <= (ADDR_SMALL_LENGTH - 1) * ADDRESSES_PER_SECTOR * SECTOR_SIZE ) {
+        } else if (file_sec_off < 0) {
+            return ERR_OFFSET_OUT_OF_RANGE;
+        } else if (file_sec_off < INODE_DOUBLE_OFF) {
             adNbSector =  file_sec_off/ADDRESSES_PER_SECTOR;
             nbSector = file_sec_off%ADDRESSES_PER_SECTOR;
-            if (adNbSector > (ADDR_SMALL_LENGTH - 1)) {
-                return ERR_OFFSET_OUT_OF_RANGE;
+            cls = sector_set_class(u -> dev, SECTOR_CLASS_INDIRECT);
+            err = sector_read_ref(u -> dev, i->i_addr[adNbSector], buf, &ref);
+            sector_set_class(u -> dev, cls);
+            data = ref;
+            if (!err) {
+                return data[nbSector];
             } else {
-                err = sector_read(u->f, i->i_addr[adNbSector], data);
-                if (!err) {
-                    return data[nbSector];
-                } else {
-                    return err;
-                }
+                return err;
             }
         } else {
-            return ERR_FILE_TOO_LARGE;
+            // au-delà: le secteur doublement indirect i_addr[7] donne le secteur indirect
+            adNbSector = (file_sec_off - INODE_DOUBLE_OFF)/ADDRESSES_PER_SECTOR;
+            nbSector = (file_sec_off - INODE_DOUBLE_OFF)%ADDRESSES_PER_SECTOR;
+            if (size <= INODE_DOUBLE_OFF * SECTOR_SIZE || adNbSector >= ADDRESSES_PER_SECTOR) {
+                return ERR_OFFSET_OUT_OF_RANGE;
+            }
+            cls = sector_set_class(u -> dev, SECTOR_CLASS_INDIRECT);
+            err = sector_read_ref(u -> dev, i->i_addr[ADDR_SMALL_LENGTH - 1], buf, &ref);
+            if (!err) {
+                data = ref;
+                err = sector_read_ref(u -> dev, data[adNbSector], buf, &ref);
+            }
+            sector_set_class(u -> dev, cls);
+            data = ref;
+            if (!err) {
+                return data[nbSector];
+            } else {
+                return err;
+            }
         }
     } else {
         return ERR_UNALLOCATED_INODE;
     }
 }
 
+/**
+ * @brief identify the sector that corresponds to a given portion of a file
+ * @param u the filesystem (IN)
+ * @param inode the inode (IN)
+ * @param file_sec_off the offset within the file (in sector-size units)
+ * @return >0: the sector on disk; <0 error
+ */
+int inode_findsector(const struct unix_filesystem *u, const struct inode *i, int32_t file_sec_off)
+{
+    uint64_t start = histo_now();
+    int ret = inode_findsector_impl(u, i, file_sec_off);
+
+    histo_record(HISTO_INODE_FINDSECTOR, start);
+    return ret;
+}
+
+/**
+ * @brief inode_bmap() without the latency measure
+ */
+static int inode_bmap_impl(const struct unix_filesystem *u, uint16_t inr, const struct inode *i,
+                           int32_t file_sec_off)
+{
+    int ret = 0;
+
+    if (u -> icache != NULL && (i -> i_mode & IALLOC)
+        && inr >= ROOT_INUMBER && inr <= (u -> s.s_isize)*INODES_PER_SECTOR) {
+        ret = inode_cache_bmap(u, inr, i, file_sec_off);
+    }
+    // pas de table décodée pour ce fichier: lecture des adresses
+    if (ret == 0) {
+        ret = inode_findsector_impl(u, i, file_sec_off);
+    }
+    return ret;
+}
+
+/**
+ * @brief identify the sector that corresponds to a given portion of the
+ *        file of inode inr, with the decoded block map of its in-core inode
+ * @param u the filesystem (IN)
+ * @param inr the inode number of i (IN)
+ * @param i the caller's copy of the inode (IN)
+ * @param file_sec_off the offset within the file (in sector-size units)
+ * @return >0: the sector on disk; <0 error
+ */
+int inode_bmap(const struct unix_filesystem *u, uint16_t inr, const struct inode *i, int32_t file_sec_off)
+{
+    M_REQUIRE_NON_NULL(u);
+    M_REQUIRE_NON_NULL(i);
+
+    uint64_t start = histo_now();
+    int ret = inode_bmap_impl(u, inr, i, file_sec_off);
+
+    histo_record(HISTO_INODE_FINDSECTOR, start);
+    return ret;
+}
+
+/**
+ * @brief identify the run of contiguous sectors on disk that holds a
+ *        given portion of the file of inode inr and the portions after it
+ * @param u the filesystem (IN)
+ * @param inr the inode number of i (IN)
+ * @param i the caller's copy of the inode (IN)
+ * @param file_sec_off the offset within the file (in sector-size units)
+ * @param max the maximum length of the run (in sectors)
+ * @param count the length of the run, between 1 and max; the run stops at
+ *        the end of the file (OUT)
+ * @return >0: the first sector of the run on disk; <0 error
+ */
+int inode_findrange(const struct unix_filesystem *u, uint16_t inr, const struct inode *i,
+                    int32_t file_sec_off, uint32_t max, uint32_t *count)
+{
+    M_REQUIRE_NON_NULL(u);
+    M_REQUIRE_NON_NULL(i);
+    M_REQUIRE_NON_NULL(count);
+
+    uint64_t start = histo_now();
+    const int32_t nb_sect = (inode_getsize(i) + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    int first = inode_bmap_impl(u, inr, i, file_sec_off);
+    uint32_t n = 1;
+
+    if (first >= 0) {
+        // la suite s'arrête au premier secteur qui n'est pas le suivant sur le disque
+        while (n < max && file_sec_off + (int32_t) n < nb_sect
+               && inode_bmap_impl(u, inr, i, file_sec_off + (int32_t) n) == first + (int) n) {
+            ++n;
+        }
+        *count = n;
+    }
+
+    histo_record(HISTO_INODE_FINDRANGE, start);
+    return first;
+}
+
 /**
  * @brief write the content of an inode to disk
  * @param u the filesystem (IN)
@@ -172,21 +364,196 @@ int inode_write(struct unix_filesystem *u, uint16_t inr, const struct inode *ino
     int err = 0;
     struct inode data[INODES_PER_SECTOR];
     size_t nbrInodeSec = 0;
+    enum sector_class cls = SECTOR_CLASS_OTHER;
 
 
     if ((u -> s.s_isize)*INODES_PER_SECTOR < inr || inr < ROOT_INUMBER) {
         return ERR_INODE_OUTOF_RANGE;
     }
+    // écrit dans son secteur à l'éviction ou par mountv6_sync()
+    if (u -> icache != NULL) {
+        return inode_cache_write(u, inr, inode);
+    }
+    cls = sector_set_class(u -> dev, SECTOR_CLASS_INODE);
     // Lire le secteur
-    err = sector_read(u -> f, (uint32_t) (u -> s.s_inode_start + inr / INODES_PER_SECTOR), data);
+    err = sector_read(u -> dev, (uint32_t) (u -> s.s_inode_start + inr / INODES_PER_SECTOR), data);
     nbrInodeSec = inr%INODES_PER_SECTOR;
 
     if (!err) {
         data[nbrInodeSec] = *inode;
-        return sector_write(u -> f, (uint32_t) (u -> s.s_inode_start + inr / INODES_PER_SECTOR), data);
-    } else {
+        err = sector_write(u -> dev, (uint32_t) (u -> s.s_inode_start + inr / INODES_PER_SECTOR), data);
+    }
+    sector_set_class(u -> dev, cls);
+    return err;
+}
+
+/* une demande de inode_read_many() ou inode_write_many(): l'inode et sa
+ * place dans les tableaux de l'appelant */
+struct inode_req {
+    uint16_t inr;
+    size_t pos;
+};
+
+/**
+ * @brief order of the requests: by inode number, thus by inode sector,
+ *        then by place in the arrays of the caller
+ */
+static int inode_req_cmp(const void *a, const void *b)
+{
+    const struct inode_req *x = a;
+    const struct inode_req *y = b;
+    if (x -> inr != y -> inr) {
+        return (x -> inr > y -> inr) - (x -> inr < y -> inr);
+    }
+    return (x -> pos > y -> pos) - (x -> pos < y -> pos);
+}
+
+/**
+ * @brief the requests for the inodes inrs, sorted by inode sector
+ * @return the requests (to free) or NULL if out of memory
+ */
+static struct inode_req *inode_reqs_sorted(const uint16_t *inrs, size_t count)
+{
+    struct inode_req *reqs = malloc((count > 0 ? count : 1) * sizeof(struct inode_req));
+
+    if (reqs != NULL) {
+        for (size_t k = 0; k < count; ++k) {
+            reqs[k].inr = inrs[k];
+            reqs[k].pos = k;
+        }
+        qsort(reqs, count, sizeof(struct inode_req), inode_req_cmp);
+    }
+    return reqs;
+}
+
+/**
+ * @brief read the content of several inodes, with one read per distinct
+ *        inode sector (the inodes held by the in-core inode table are
+ *        copied from it)
+ * @param u the filesystem (IN)
+ * @param inrs the inode numbers (IN)
+ * @param count the number of inodes
+ * @param inodes the inodes, in the order of inrs; an inode out of range or
+ *        in a sector that cannot be read is set to 0 (OUT)
+ * @return 0 on success; the first error inode_read() would give otherwise
+ *         (the other inodes are read anyway)
+ */
+int inode_read_many(const struct unix_filesystem *u, const uint16_t *inrs, size_t count, struct inode *inodes)
+{
+    M_REQUIRE_NON_NULL(u);
+    M_REQUIRE_NON_NULL(inrs);
+    M_REQUIRE_NON_NULL(inodes);
+
+    uint64_t start = histo_now();
+    struct inode buf[INODES_PER_SECTOR];
+    const struct inode *data = NULL;
+    const void *ref = NULL;
+    struct inode_req *reqs = inode_reqs_sorted(inrs, count);
+    uint32_t sector = 0;
+    size_t ret_pos = 0;
+    enum sector_class cls = SECTOR_CLASS_OTHER;
+    int err = 0;
+    int ret = 0;
+
+    if (reqs == NULL) {
+        return ERR_NOMEM;
+    }
+
+    cls = sector_set_class(u -> dev, SECTOR_CLASS_INODE);
+    for (size_t k = 0; k < count; ++k) {
+        struct inode *inode = &inodes[reqs[k].pos];
+
+        if ((u -> s.s_isize)*INODES_PER_SECTOR < reqs[k].inr || reqs[k].inr < ROOT_INUMBER) {
+            memset(inode, 0, sizeof(struct inode));
+            err = ERR_INODE_OUTOF_RANGE;
+        } else if (u -> icache != NULL && inode_cache_peek(u, reqs[k].inr, inode)) {
+            err = 0;
+        } else {
+            // le secteur n'est lu qu'à son premier inode
+            if (data == NULL || sector != u -> s.s_inode_start + reqs[k].inr / INODES_PER_SECTOR) {
+                sector = (uint32_t) (u -> s.s_inode_start + reqs[k].inr / INODES_PER_SECTOR);
+                err = sector_read_ref(u -> dev, sector, buf, &ref);
+                if (err) {
+                    memset(buf, 0, sizeof(buf));
+                    ref = buf;
+                }
+                data = ref;
+            }
+            *inode = data[reqs[k].inr % INODES_PER_SECTOR];
+        }
+        if (!err && !(inode -> i_mode & IALLOC)) {
+            err = ERR_UNALLOCATED_INODE;
+        }
+        // la première erreur dans l'ordre de l'appelant
+        if (err && (ret == 0 || reqs[k].pos < ret_pos)) {
+            ret = err;
+            ret_pos = reqs[k].pos;
+        }
+    }
+    sector_set_class(u -> dev, cls);
+
+    free(reqs);
+    histo_record(HISTO_INODE_READ_MANY, start);
+    return ret;
+}
+
+/**
+ * @brief write the content of several inodes, with one read and one write
+ *        per distinct inode sector (into the in-core inode table if any,
+ *        which writes them back grouped by sector)
+ * @param u the filesystem (IN)
+ * @param inrs the inode numbers; when an inode number is repeated, its last
+ *        inode is written (IN)
+ * @param count the number of inodes
+ * @param inodes the inodes, in the order of inrs (IN)
+ * @return 0 on success; <0 on error (nothing is written if an inode
+ *         number is out of range)
+ */
+int inode_write_many(struct unix_filesystem *u, const uint16_t *inrs, size_t count, const struct inode *inodes)
+{
+    M_REQUIRE_NON_NULL(u);
+    M_REQUIRE_NON_NULL(inrs);
+    M_REQUIRE_NON_NULL(inodes);
+
+    struct inode data[INODES_PER_SECTOR];
+    struct inode_req *reqs = NULL;
+    enum sector_class cls = SECTOR_CLASS_OTHER;
+    int err = 0;
+
+    for (size_t k = 0; k < count; ++k) {
+        if ((u -> s.s_isize)*INODES_PER_SECTOR < inrs[k] || inrs[k] < ROOT_INUMBER) {
+            return ERR_INODE_OUTOF_RANGE;
+        }
+    }
+    if (u -> icache != NULL) {
+        for (size_t k = 0; k < count && !err; ++k) {
+            err = inode_cache_write(u, inrs[k], &inodes[k]);
+        }
         return err;
     }
+
+    reqs = inode_reqs_sorted(inrs, count);
+    if (reqs == NULL) {
+        return ERR_NOMEM;
+    }
+
+    cls = sector_set_class(u -> dev, SECTOR_CLASS_INODE);
+    for (size_t k = 0; k < count && !err; ) {
+        const uint32_t sector = (uint32_t) (u -> s.s_inode_start + reqs[k].inr / INODES_PER_SECTOR);
+
+        // tous les inodes du même secteur en une lecture et une écriture
+        err = sector_read(u -> dev, sector, data);
+        for (; !err && k < count && u -> s.s_inode_start + reqs[k].inr / INODES_PER_SECTOR == sector; ++k) {
+            data[reqs[k].inr % INODES_PER_SECTOR] = inodes[reqs[k].pos];
+        }
+        if (!err) {
+            err = sector_write(u -> dev, sector, data);
+        }
+    }
+    sector_set_class(u -> dev, cls);
+
+    free(reqs);
+    return err;
 }
 
 /**
@@ -198,7 +565,18 @@ int inode_alloc(struct unix_filesystem *u)
 {
     M_REQUIRE_NON_NULL(u);
 
-    int err = bm_find_next(u -> ibm);
+    // les bitmaps peuvent être encore en construction (MOUNTV6_LAZY)
+    int err = mountv6_wait_bitmaps(u);
+    if (err) {
+        return err;
+    }
+
+    // la pile d'inodes libres évite de parcourir l'ibm bit à bit
+    if (u -> ipool != NULL) {
+        return inode_pool_get(u);
+    }
+
+    err = bm_find_next(u -> ibm);
     if (err < 0) {
         return ERR_NOMEM;
     }
@@ -208,6 +586,88 @@ int inode_alloc(struct unix_filesystem *u)
     return err;
 }
 
+/**
+ * @brief alloc a new inode, preferably in the inode sector of goal or in a
+ *        sector next to it (returns its inr if possible)
+ * @param u the filesystem (IN)
+ * @param goal the inode to allocate close to, e.g. the parent directory (IN)
+ * @return the inode number of the new inode or error code on error
+ */
+int inode_alloc_near(struct unix_filesystem *u, uint16_t goal)
+{
+    M_REQUIRE_NON_NULL(u);
+
+    int err = mountv6_wait_bitmaps(u);
+    if (err) {
+        return err;
+    }
+
+    if (u -> ipool != NULL) {
+        return inode_pool_get_near(u, goal);
+    }
+    return inode_alloc(u);
+}
+
+/**
+ * @brief alloc the inode of a new directory at the start of a free group of
+ *        inode sectors, which the inodes of its entries will then fill
+ *        (returns its inr if possible)
+ * @param u the filesystem (IN)
+ * @param parent the parent directory (IN)
+ * @return the inode number of the new inode or error code on error
+ */
+int inode_alloc_dir(struct unix_filesystem *u, uint16_t parent)
+{
+    M_REQUIRE_NON_NULL(u);
+
+    int err = mountv6_wait_bitmaps(u);
+    if (err) {
+        return err;
+    }
+
+    if (u -> ipool != NULL) {
+        return inode_pool_get_group(u, parent);
+    }
+    return inode_alloc(u);
+}
+
+/**
+ * @brief free an inode: it is cleared on disk and can be allocated again;
+ *        its sectors are not freed
+ * @param u the filesystem (IN)
+ * @param inr the inode number of the inode to free (IN)
+ * @return 0 on success; <0 on error
+ */
+int inode_free(struct unix_filesystem *u, uint16_t inr)
+{
+    M_REQUIRE_NON_NULL(u);
+
+    struct inode inode;
+    int err = mountv6_wait_bitmaps(u);
+
+    if (err) {
+        return err;
+    }
+    M_REQUIRE_NON_NULL(u -> ibm);
+
+    if (inr <= ROOT_INUMBER || inr > u -> ibm -> max) {
+        return ERR_INODE_OUTOF_RANGE;
+    }
+
+    memset(&inode, 0, sizeof(inode));
+    err = inode_write(u, inr, &inode);
+    if (err) {
+        return err;
+    }
+
+    if (u -> ipool != NULL) {
+        inode_pool_put(u, inr);
+    } else {
+        bm_clear(u -> ibm, inr);
+    }
+    return 0;
+}
+
 /**
  * @brief set the size of a given inode to the given size
  * @param inode the inode
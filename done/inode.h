@@ -8,6 +8,7 @@
  * @date summer 2016
  */
 
+#include <stddef.h>
 #include "unixv6fs.h"
 #include "mount.h"
 
@@ -15,6 +16,13 @@
 extern "C" {
 #endif
 
+/* the first sector of a large file whose address is reached through the
+ * double-indirect sector i_addr[ADDR_SMALL_LENGTH - 1] */
+#define INODE_DOUBLE_OFF ((ADDR_SMALL_LENGTH - 1) * ADDRESSES_PER_SECTOR)
+
+/* the size of the largest file: i_size0 and i_size1 hold 24 bits */
+#define INODE_MAX_SIZE ((1 << 24) - 1)
+
 /**
  * @brief Return the size of a file associated to a given inode.
  *
@@ -73,6 +81,30 @@ void inode_print(const struct inode *inode);
  */
 int inode_scan_print(const struct unix_filesystem *u);
 
+/**
+ * @brief function called by inode_scan() for an allocated inode
+ * @param u the filesystem
+ * @param inr the inode number
+ * @param inode the inode; NULL if its inode sector could not be read
+ * @param arg the argument given to inode_scan()
+ * @return 0 to go on; non-zero to stop the scan (inode_scan() returns it)
+ */
+typedef int (*inode_scan_fn)(const struct unix_filesystem *u, uint16_t inr,
+                             const struct inode *inode, void *arg);
+
+/**
+ * @brief call fn for each allocated inode of the table, in increasing
+ *        inode number order. The inode sectors are read many at a time and
+ *        the allocated inodes are found with SIMD instructions when the CPU
+ *        has them (SSE2/AVX2, chosen at run time).
+ * @param u the filesystem (IN)
+ * @param fn the function to call; it is also called, with a NULL inode,
+ *        for each inode of a sector that could not be read
+ * @param arg passed to fn
+ * @return 0 on success; the first non-zero value returned by fn
+ */
+int inode_scan(const struct unix_filesystem *u, inode_scan_fn fn, void *arg);
+
 /**
  * @brief read the content of an inode from disk
  * @param u the filesystem (IN)
@@ -82,6 +114,37 @@ int inode_scan_print(const struct unix_filesystem *u);
  */
 int inode_read(const struct unix_filesystem *u, uint16_t inr, struct inode *inode);
 
+/**
+ * @brief read the content of several inodes, with one read per distinct
+ *        inode sector (the inodes held by the in-core inode table are
+ *        copied from it)
+ * @param u the filesystem (IN)
+ * @param inrs the inode numbers (IN)
+ * @param count the number of inodes
+ * @param inodes the inodes, in the order of inrs; an inode out of range or
+ *        in a sector that cannot be read is set to 0 (OUT)
+ * @return 0 on success; the first error inode_read() would give otherwise
+ *         (the other inodes are read anyway)
+ */
+int inode_read_many(const struct unix_filesystem *u, const uint16_t *inrs, size_t count, struct inode *inodes);
+
+/**
+ * @brief hold the in-core copy of an allocated inode, without copying it.
+ *        Held inodes stay in memory; release them with inode_put().
+ * @param u the filesystem (IN)
+ * @param inr the inode number of the inode (IN)
+ * @param inode set to the in-core inode, valid until inode_put() (OUT)
+ * @return 0 on success; <0 on error
+ */
+int inode_get(const struct unix_filesystem *u, uint16_t inr, const struct inode **inode);
+
+/**
+ * @brief release an inode held with inode_get()
+ * @param u the filesystem (IN)
+ * @param inode the in-core inode given by inode_get() (IN)
+ */
+void inode_put(const struct unix_filesystem *u, const struct inode *inode);
+
 /**
  * @brief identify the sector that corresponds to a given portion of a file
  * @param u the filesystem (IN)
@@ -91,6 +154,36 @@ int inode_read(const struct unix_filesystem *u, uint16_t inr, struct inode *inod
  */
 int inode_findsector(const struct unix_filesystem *u, const struct inode *i, int32_t file_sec_off);
 
+/**
+ * @brief inode_findsector() for the file of inode inr: the addresses held
+ *        by the indirect sectors of its in-core inode are decoded once (block
+ *        map), then each lookup is done in memory. The block map is used
+ *        only while i is identical to the in-core inode (see inode_write()).
+ * @param u the filesystem (IN)
+ * @param inr the inode number of i (IN)
+ * @param i the caller's copy of the inode (IN)
+ * @param file_sec_off the offset within the file (in sector-size units)
+ * @return >0: the sector on disk; <0 error
+ */
+int inode_bmap(const struct unix_filesystem *u, uint16_t inr, const struct inode *i, int32_t file_sec_off);
+
+/**
+ * @brief identify the run of contiguous sectors on disk that holds a
+ *        given portion of the file of inode inr and the portions after it,
+ *        so that the run can be read with a single I/O
+ *        (see sector_read_range() and sector_readv())
+ * @param u the filesystem (IN)
+ * @param inr the inode number of i (IN)
+ * @param i the caller's copy of the inode (IN)
+ * @param file_sec_off the offset within the file (in sector-size units)
+ * @param max the maximum length of the run (in sectors)
+ * @param count the length of the run, between 1 and max; the run stops at
+ *        the end of the file (OUT)
+ * @return >0: the first sector of the run on disk; <0 error
+ */
+int inode_findrange(const struct unix_filesystem *u, uint16_t inr, const struct inode *i,
+                    int32_t file_sec_off, uint32_t max, uint32_t *count);
+
 /**
  * @brief alloc a new inode (returns its inr if possible)
  * @param u the filesystem (IN)
@@ -98,6 +191,34 @@ int inode_findsector(const struct unix_filesystem *u, const struct inode *i, int
  */
 int inode_alloc(struct unix_filesystem *u);
 
+/**
+ * @brief alloc a new inode, preferably in the inode sector of goal or in a
+ *        sector next to it (returns its inr if possible)
+ * @param u the filesystem (IN)
+ * @param goal the inode to allocate close to, e.g. the parent directory (IN)
+ * @return the inode number of the new inode or error code on error
+ */
+int inode_alloc_near(struct unix_filesystem *u, uint16_t goal);
+
+/**
+ * @brief alloc the inode of a new directory at the start of a free group of
+ *        inode sectors, which the inodes of its entries will then fill
+ *        (returns its inr if possible)
+ * @param u the filesystem (IN)
+ * @param parent the parent directory (IN)
+ * @return the inode number of the new inode or error code on error
+ */
+int inode_alloc_dir(struct unix_filesystem *u, uint16_t parent);
+
+/**
+ * @brief free an inode: it is cleared on disk and can be allocated again;
+ *        its sectors are not freed
+ * @param u the filesystem (IN)
+ * @param inr the inode number of the inode to free (IN)
+ * @return 0 on success; <0 on error
+ */
+int inode_free(struct unix_filesystem *u, uint16_t inr);
+
 /**
  * @brief write the content of an inode to disk
  * @param u the filesystem (IN)
@@ -107,6 +228,20 @@ int inode_alloc(struct unix_filesystem *u);
  */
 int inode_write(struct unix_filesystem *u, uint16_t inr, const struct inode *inode);
 
+/**
+ * @brief write the content of several inodes, with one read and one write
+ *        per distinct inode sector (into the in-core inode table if any,
+ *        which writes them back grouped by sector)
+ * @param u the filesystem (IN)
+ * @param inrs the inode numbers; when an inode number is repeated, its last
+ *        inode is written (IN)
+ * @param count the number of inodes
+ * @param inodes the inodes, in the order of inrs (IN)
+ * @return 0 on success; <0 on error (nothing is written if an inode
+ *         number is out of range)
+ */
+int inode_write_many(struct unix_filesystem *u, const uint16_t *inrs, size_t count, const struct inode *inodes);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,498 @@
+/**
+ * @file  inode_cache.c
+ * @brief in-core inode table of a mounted filesystem.
+ *
+ * The cached inodes are found through a hash table (chaining) keyed by the
+ * inode number and are kept in a doubly-linked LRU list: the most recently
+ * used inode is at the head, the victim is the least recently used inode
+ * that nobody holds.
+ *
+ * Writing back a dirty inode writes back all the dirty cached inodes of
+ * the same inode sector, with one read and one write of that sector.
+ *
+ * The block map of a large file (the addresses held by its indirect
+ * sectors) is decoded once, at the first lookup, and kept with its
+ * inode until the inode is written or evicted.
+ *
+ * @author José Ferro Pinto
+ * @author Marc Favrod-Coune
+ * @date march 2017
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "error.h"
+#include "unixv6fs.h"
+#include "mount.h"
+#include "sector.h"
+#include "inode.h"
+#include "inode_cache.h"
+
+struct icache_entry {
+    uint16_t inr;
+    int valid;                   // contient une copie de l'inode
+    int dirty;                   // modifié depuis la dernière écriture dans son secteur
+    unsigned int refs;           // nombre de inode_cache_get() sans inode_cache_put()
+    uint16_t *bmap;              // secteurs de données décodés, NULL tant qu'inutile
+    int32_t bmap_len;            // nombre de secteurs dans bmap
+    struct icache_entry *hnext;  // chaînage dans la table de hachage
+    struct icache_entry *prev;   // liste LRU
+    struct icache_entry *next;
+    struct inode inode;
+};
+
+struct inode_cache {
+    size_t size;                   // nombre d'entrées
+    uint32_t mask;                 // nombre de seaux - 1 (puissance de 2)
+    struct icache_entry **buckets;
+    struct icache_entry *entries;
+    struct icache_entry lru;       // sentinelle: lru.next le plus récent, lru.prev le plus ancien
+};
+
+/**
+ * @brief remove e from the LRU list
+ */
+static void lru_unlink(struct icache_entry *e)
+{
+    e -> prev -> next = e -> next;
+    e -> next -> prev = e -> prev;
+}
+
+/**
+ * @brief insert e at the head (most recently used) of the LRU list
+ */
+static void lru_push_front(struct inode_cache *c, struct icache_entry *e)
+{
+    e -> prev = &(c -> lru);
+    e -> next = c -> lru.next;
+    c -> lru.next -> prev = e;
+    c -> lru.next = e;
+}
+
+/**
+ * @brief the cached copy of inode inr, NULL if it is not in the cache
+ */
+static struct icache_entry *icache_find(const struct inode_cache *c, uint16_t inr)
+{
+    struct icache_entry *e = c -> buckets[inr & c -> mask];
+    while (e != NULL && e -> inr != inr) {
+        e = e -> hnext;
+    }
+    return e;
+}
+
+/**
+ * @brief remove e from the hash table
+ */
+static void hash_remove(struct inode_cache *c, struct icache_entry *e)
+{
+    struct icache_entry **p = &(c -> buckets[e -> inr & c -> mask]);
+    while (*p != e) {
+        p = &((*p) -> hnext);
+    }
+    *p = e -> hnext;
+    e -> hnext = NULL;
+}
+
+/**
+ * @brief forget the decoded block map of e
+ */
+static void bmap_forget(struct icache_entry *e)
+{
+    free(e -> bmap);
+    e -> bmap = NULL;
+    e -> bmap_len = 0;
+}
+
+/**
+ * @brief forget an entry whose inode could not be read; it becomes the next victim
+ */
+static void icache_drop(struct inode_cache *c, struct icache_entry *e)
+{
+    hash_remove(c, e);
+    bmap_forget(e);
+    e -> valid = 0;
+    e -> dirty = 0;
+    e -> refs = 0;
+    lru_unlink(e);
+    e -> prev = c -> lru.prev;
+    e -> next = &(c -> lru);
+    c -> lru.prev -> next = e;
+    c -> lru.prev = e;
+}
+
+/**
+ * @brief write the dirty cached inodes of the sector of e (e included) to the disk
+ * @param u the filesystem
+ * @param e a dirty entry
+ * @return 0 on success; <0 on error
+ */
+static int icache_writeback(const struct unix_filesystem *u, struct icache_entry *e)
+{
+    struct inode data[INODES_PER_SECTOR];
+    const uint16_t first = (uint16_t) (e -> inr - e -> inr % INODES_PER_SECTOR);
+    const uint32_t sector = (uint32_t) (u -> s.s_inode_start + e -> inr / INODES_PER_SECTOR);
+    struct icache_entry *same[INODES_PER_SECTOR];
+    enum sector_class cls = SECTOR_CLASS_OTHER;
+    int err = 0;
+
+    cls = sector_set_class(u -> dev, SECTOR_CLASS_INODE);
+    err = sector_read(u -> dev, sector, data);
+    if (!err) {
+        // tous les inodes modifiés du même secteur partent avec e
+        for (uint16_t k = 0; k < INODES_PER_SECTOR; ++k) {
+            same[k] = icache_find(u -> icache, (uint16_t) (first + k));
+            if (same[k] != NULL && same[k] -> valid && same[k] -> dirty) {
+                data[k] = same[k] -> inode;
+            } else {
+                same[k] = NULL;
+            }
+        }
+        err = sector_write(u -> dev, sector, data);
+    }
+    sector_set_class(u -> dev, cls);
+
+    for (uint16_t k = 0; k < INODES_PER_SECTOR && !err; ++k) {
+        if (same[k] != NULL) {
+            same[k] -> dirty = 0;
+        }
+    }
+    return err;
+}
+
+/**
+ * @brief take the least recently used entry nobody holds and give it to inr;
+ *        a dirty victim is written back first
+ * @param u the filesystem
+ * @param inr the inode the entry is for
+ * @param entry the entry, at the head of the LRU list (OUT)
+ * @return 0 on success; <0 on error
+ */
+static int icache_alloc_entry(const struct unix_filesystem *u, uint16_t inr, struct icache_entry **entry)
+{
+    struct inode_cache *c = u -> icache;
+    struct icache_entry *e = c -> lru.prev;
+
+    while (e != &(c -> lru) && e -> refs > 0) {
+        e = e -> prev;
+    }
+    if (e == &(c -> lru)) {
+        return ERR_NOMEM;
+    }
+
+    if (e -> valid) {
+        if (e -> dirty) {
+            int err = icache_writeback(u, e);
+            if (err) {
+                return err;
+            }
+        }
+        hash_remove(c, e);
+        bmap_forget(e);
+    }
+
+    e -> inr = inr;
+    e -> valid = 0;
+    e -> dirty = 0;
+    e -> refs = 0;
+    e -> hnext = c -> buckets[inr & c -> mask];
+    c -> buckets[inr & c -> mask] = e;
+    lru_unlink(e);
+    lru_push_front(c, e);
+
+    *entry = e;
+    return 0;
+}
+
+/**
+ * @brief allocate a cache of nb_inodes inodes
+ * @param nb_inodes the number of inodes the cache can hold (>0)
+ * @return the new cache or NULL on failure
+ */
+struct inode_cache *inode_cache_alloc(size_t nb_inodes)
+{
+    struct inode_cache *c = NULL;
+    size_t nb_buckets = 1;
+
+    if (nb_inodes == 0 || nb_inodes > UINT16_MAX + 1) {
+        return NULL;
+    }
+    while (nb_buckets < nb_inodes) {
+        nb_buckets <<= 1;
+    }
+
+    c = calloc(1, sizeof(struct inode_cache));
+    if (c == NULL) {
+        return NULL;
+    }
+    c -> buckets = calloc(nb_buckets, sizeof(struct icache_entry *));
+    c -> entries = calloc(nb_inodes, sizeof(struct icache_entry));
+    if (c -> buckets == NULL || c -> entries == NULL) {
+        inode_cache_free(c);
+        return NULL;
+    }
+    c -> size = nb_inodes;
+    c -> mask = (uint32_t) (nb_buckets - 1);
+
+    c -> lru.prev = &(c -> lru);
+    c -> lru.next = &(c -> lru);
+    for (size_t i = 0; i < nb_inodes; ++i) {
+        lru_push_front(c, &(c -> entries[i]));
+    }
+    return c;
+}
+
+/**
+ * @brief free a cache; dirty inodes are lost (see inode_cache_flush())
+ * @param cache the cache to free (may be NULL)
+ */
+void inode_cache_free(struct inode_cache *cache)
+{
+    if (cache == NULL) {
+        return;
+    }
+    for (size_t i = 0; cache -> entries != NULL && i < cache -> size; ++i) {
+        free(cache -> entries[i].bmap);
+    }
+    free(cache -> buckets);
+    free(cache -> entries);
+    free(cache);
+}
+
+/**
+ * @brief hold the cached copy of an inode, reading it from the disk if needed
+ * @param u the filesystem (u->icache != NULL); inr must be in range
+ * @param inr the inode number
+ * @param inode set to the cached copy, valid until inode_cache_put() (OUT)
+ * @return 0 on success; <0 on error
+ */
+int inode_cache_get(const struct unix_filesystem *u, uint16_t inr, struct inode **inode)
+{
+    struct inode_cache *c = u -> icache;
+    struct icache_entry *e = icache_find(c, inr);
+    int err = 0;
+
+    if (e != NULL) {
+        lru_unlink(e);
+        lru_push_front(c, e);
+    } else {
+        struct inode buf[INODES_PER_SECTOR];
+        const struct inode *data = NULL;
+        const void *ref = NULL;
+        enum sector_class cls = SECTOR_CLASS_OTHER;
+
+        err = icache_alloc_entry(u, inr, &e);
+        if (err) {
+            return err;
+        }
+        cls = sector_set_class(u -> dev, SECTOR_CLASS_INODE);
+        err = sector_read_ref(u -> dev, (uint32_t) (u -> s.s_inode_start + inr / INODES_PER_SECTOR), buf, &ref);
+        sector_set_class(u -> dev, cls);
+        if (err) {
+            icache_drop(c, e);
+            return err;
+        }
+        data = ref;
+        e -> inode = data[inr % INODES_PER_SECTOR];
+        e -> valid = 1;
+    }
+
+    ++(e -> refs);
+    *inode = &(e -> inode);
+    return 0;
+}
+
+/**
+ * @brief release an inode held with inode_cache_get()
+ * @param u the filesystem (u->icache != NULL)
+ * @param inode the cached copy given by inode_cache_get()
+ */
+void inode_cache_put(const struct unix_filesystem *u, const struct inode *inode)
+{
+    struct inode_cache *c = u -> icache;
+    const char *p = (const char *) inode;
+    struct icache_entry *e = NULL;
+
+    // l'entrée qui contient inode
+    if (p < (const char *) c -> entries || p >= (const char *) (c -> entries + c -> size)) {
+        return;
+    }
+    e = &(c -> entries[(size_t) (p - (const char *) c -> entries) / sizeof(struct icache_entry)]);
+    if (e -> refs > 0) {
+        --(e -> refs);
+    }
+}
+
+/**
+ * @brief copy the cached copy of an inode, if there is one, without
+ *        reading the disk nor changing the LRU order
+ * @param u the filesystem (u->icache != NULL)
+ * @param inr the inode number
+ * @param inode the copy (OUT)
+ * @return 1 if the inode is cached; 0 otherwise
+ */
+int inode_cache_peek(const struct unix_filesystem *u, uint16_t inr, struct inode *inode)
+{
+    const struct icache_entry *e = icache_find(u -> icache, inr);
+
+    if (e == NULL || !(e -> valid)) {
+        return 0;
+    }
+    *inode = e -> inode;
+    return 1;
+}
+
+/**
+ * @brief replace the cached copy of an inode; it becomes dirty
+ * @param u the filesystem (u->icache != NULL); inr must be in range
+ * @param inr the inode number
+ * @param inode the new content of the inode (IN)
+ * @return 0 on success; <0 on error
+ */
+int inode_cache_write(const struct unix_filesystem *u, uint16_t inr, const struct inode *inode)
+{
+    struct inode_cache *c = u -> icache;
+    struct icache_entry *e = icache_find(c, inr);
+
+    if (e != NULL) {
+        lru_unlink(e);
+        lru_push_front(c, e);
+    } else {
+        // l'inode est écrit en entier: inutile de le lire avant
+        int err = icache_alloc_entry(u, inr, &e);
+        if (err) {
+            return err;
+        }
+    }
+
+    // les adresses ont pu changer
+    bmap_forget(e);
+    e -> inode = *inode;
+    e -> valid = 1;
+    e -> dirty = 1;
+    return 0;
+}
+
+/**
+ * @brief decode the block map of a large file: the addresses of all its
+ *        sectors, read from its indirect sectors with one sector_readv() per
+ *        level (the indirect sectors i_addr[0..6], then the double-indirect
+ *        sector i_addr[7] and the indirect sectors it lists)
+ * @param u the filesystem
+ * @param e the entry of the inode (indirect layout)
+ * @return 0 on success; <0 on error
+ */
+static int bmap_build(const struct unix_filesystem *u, struct icache_entry *e)
+{
+    uint32_t indirect[ADDRESSES_PER_SECTOR];
+    uint16_t dbl[ADDRESSES_PER_SECTOR];
+    uint16_t *addr = NULL;
+    const int32_t size = inode_getsize(&(e -> inode));
+    const int32_t nb_sect = (size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    const int32_t nb_single = nb_sect < INODE_DOUBLE_OFF ? nb_sect : INODE_DOUBLE_OFF;
+    const size_t nb_ind = (size_t) (nb_single + ADDRESSES_PER_SECTOR - 1) / ADDRESSES_PER_SECTOR;
+    const size_t nb_dbl = (size_t) (nb_sect - nb_single + ADDRESSES_PER_SECTOR - 1) / ADDRESSES_PER_SECTOR;
+    enum sector_class cls = SECTOR_CLASS_OTHER;
+    int err = 0;
+
+    if (nb_dbl > ADDRESSES_PER_SECTOR) {
+        return ERR_FILE_TOO_LARGE;
+    }
+    addr = malloc((nb_ind + nb_dbl) * SECTOR_SIZE);
+    if (addr == NULL) {
+        return ERR_NOMEM;
+    }
+
+    for (size_t k = 0; k < nb_ind; ++k) {
+        indirect[k] = e -> inode.i_addr[k];
+    }
+    cls = sector_set_class(u -> dev, SECTOR_CLASS_INDIRECT);
+    err = sector_readv(u -> dev, indirect, nb_ind, addr);
+    if (!err && nb_dbl > 0) {
+        err = sector_read(u -> dev, e -> inode.i_addr[ADDR_SMALL_LENGTH - 1], dbl);
+        for (size_t k = 0; !err && k < nb_dbl; ++k) {
+            indirect[k] = dbl[k];
+        }
+        if (!err) {
+            err = sector_readv(u -> dev, indirect, nb_dbl, addr + nb_ind * ADDRESSES_PER_SECTOR);
+        }
+    }
+    sector_set_class(u -> dev, cls);
+    if (err) {
+        free(addr);
+        return err;
+    }
+
+    e -> bmap = addr;
+    e -> bmap_len = nb_sect;
+    return 0;
+}
+
+/**
+ * @brief the sector holding a portion of a large file, from the decoded
+ *        block map of its in-core inode
+ * @param u the filesystem (u->icache != NULL); inr must be in range
+ * @param inr the inode number
+ * @param inode the caller's copy of the inode (IN)
+ * @param file_sec_off the offset within the file (in sector-size units)
+ * @return >0: the sector on disk; 0: the block map cannot be used (the
+ *         file does not use indirect sectors, or the caller's copy differs
+ *         from the in-core inode); <0 on error
+ */
+int inode_cache_bmap(const struct unix_filesystem *u, uint16_t inr, const struct inode *inode,
+                     int32_t file_sec_off)
+{
+    struct inode *cached = NULL;
+    struct icache_entry *e = NULL;
+    const int32_t size = inode_getsize(inode);
+    int ret = 0;
+
+    if (size <= ADDR_SMALL_LENGTH * SECTOR_SIZE) {
+        return 0;
+    }
+    ret = inode_cache_get(u, inr, &cached);
+    if (ret) {
+        return ret;
+    }
+    e = icache_find(u -> icache, inr);
+
+    // une copie modifiée mais pas encore écrite: la table ne lui correspond pas
+    if (memcmp(cached, inode, sizeof(struct inode)) != 0) {
+        inode_cache_put(u, cached);
+        return 0;
+    }
+    if (e -> bmap == NULL) {
+        ret = bmap_build(u, e);
+    }
+    if (!ret) {
+        if (file_sec_off < 0 || file_sec_off >= e -> bmap_len) {
+            ret = ERR_OFFSET_OUT_OF_RANGE;
+        } else {
+            ret = e -> bmap[file_sec_off];
+        }
+    }
+
+    inode_cache_put(u, cached);
+    return ret;
+}
+
+/**
+ * @brief write all the dirty cached inodes to their inode sectors
+ * @param u the filesystem (u->icache != NULL)
+ * @return 0 on success; <0 on error
+ */
+int inode_cache_flush(const struct unix_filesystem *u)
+{
+    struct inode_cache *c = u -> icache;
+    int err = 0;
+
+    for (size_t i = 0; i < c -> size && !err; ++i) {
+        struct icache_entry *e = &(c -> entries[i]);
+        if (e -> valid && e -> dirty) {
+            err = icache_writeback(u, e);
+        }
+    }
+    return err;
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+/**
+ * @file  inode_cache.h
+ * @brief in-core inode table of a mounted filesystem.
+ *
+ * The inodes read from the disk are kept in memory, found through a hash
+ * table keyed by the inode number (LRU replacement). A cached inode can be
+ * held with inode_cache_get() until inode_cache_put(); a held inode is
+ * never evicted. Writes only update the cached copy and mark it dirty:
+ * dirty inodes reach the inode sectors when they are evicted and when the
+ * cache is flushed (sync, umount).
+ *
+ * Only inode.c and mount.c use these functions; see inode_get(),
+ * inode_read() and inode_write() in inode.h.
+ *
+ * @author José Ferro Pinto
+ * @author Marc Favrod-Coune
+ * @date march 2017
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "unixv6fs.h"
+#include "mount.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief allocate a cache of nb_inodes inodes
+ * @param nb_inodes the number of inodes the cache can hold (>0)
+ * @return the new cache or NULL on failure
+ */
+struct inode_cache *inode_cache_alloc(size_t nb_inodes);
+
+/**
+ * @brief free a cache; dirty inodes are lost (see inode_cache_flush())
+ * @param cache the cache to free (may be NULL)
+ */
+void inode_cache_free(struct inode_cache *cache);
+
+/**
+ * @brief hold the cached copy of an inode, reading it from the disk if needed
+ * @param u the filesystem (u->icache != NULL); inr must be in range
+ * @param inr the inode number
+ * @param inode set to the cached copy, valid until inode_cache_put() (OUT)
+ * @return 0 on success; <0 on error (ERR_NOMEM if all the inodes are held)
+ */
+int inode_cache_get(const struct unix_filesystem *u, uint16_t inr, struct inode **inode);
+
+/**
+ * @brief release an inode held with inode_cache_get()
+ * @param u the filesystem (u->icache != NULL)
+ * @param inode the cached copy given by inode_cache_get()
+ */
+void inode_cache_put(const struct unix_filesystem *u, const struct inode *inode);
+
+/**
+ * @brief copy the cached copy of an inode, if there is one, without
+ *        reading the disk nor changing the LRU order
+ * @param u the filesystem (u->icache != NULL)
+ * @param inr the inode number
+ * @param inode the copy (OUT)
+ * @return 1 if the inode is cached; 0 otherwise
+ */
+int inode_cache_peek(const struct unix_filesystem *u, uint16_t inr, struct inode *inode);
+
+/**
+ * @brief replace the cached copy of an inode; it becomes dirty
+ * @param u the filesystem (u->icache != NULL); inr must be in range
+ * @param inr the inode number
+ * @param inode the new content of the inode (IN)
+ * @return 0 on success; <0 on error
+ */
+int inode_cache_write(const struct unix_filesystem *u, uint16_t inr, const struct inode *inode);
+
+/**
+ * @brief the sector holding a portion of a large file, from the block map
+ *        of its in-core inode (decoded at the first lookup)
+ * @param u the filesystem (u->icache != NULL); inr must be in range
+ * @param inr the inode number
+ * @param inode the caller's copy of the inode (IN)
+ * @param file_sec_off the offset within the file (in sector-size units)
+ * @return >0: the sector on disk; 0: the block map cannot be used (the
+ *         file does not use indirect sectors, or the caller's copy differs
+ *         from the in-core inode); <0 on error
+ */
+int inode_cache_bmap(const struct unix_filesystem *u, uint16_t inr, const struct inode *inode,
+                     int32_t file_sec_off);
+
+/**
+ * @brief write all the dirty cached inodes to their inode sectors
+ * @param u the filesystem (u->icache != NULL)
+ * @return 0 on success; <0 on error
+ */
+int inode_cache_flush(const struct unix_filesystem *u);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,270 @@
+/**
+ * @file  inode_pool.c
+ * @brief free-inode pool of a mounted filesystem.
+ *
+ * The stack holds inodes that are free in the ibm, the lowest number on
+ * top. A refill takes the free bits of whole 64-bit words of the ibm
+ * (complement, then __builtin_ctzll for each bit) from the word where the
+ * previous refill stopped, wrapping around the end of the ibm once.
+ *
+ * An allocation near a goal looks at the ibm around the goal directly: an
+ * inode taken there may still be in the stack, it is skipped (stale) when
+ * popped. New directories start free groups of inode sectors, so that the
+ * entries of a directory, allocated near it, share a few inode sectors
+ * even when several directories grow at the same time.
+ *
+ * @author José Ferro Pinto
+ * @author Marc Favrod-Coune
+ * @date march 2017
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include "error.h"
+#include "unixv6fs.h"
+#include "mount.h"
+#include "bmblock.h"
+#include "inode_pool.h"
+
+struct inode_pool {
+    uint16_t free[INODE_POOL_SIZE];  // pile: free[top - 1] est le prochain inode donné
+    size_t top;
+    size_t cursor;                   // mot de l'ibm où commence le prochain remplissage
+    struct inode_pool_stats stats;
+};
+
+/**
+ * @brief allocate an empty pool
+ * @return the new pool or NULL on failure
+ */
+struct inode_pool *inode_pool_alloc(void)
+{
+    return calloc(1, sizeof(struct inode_pool));
+}
+
+/**
+ * @brief free a pool
+ * @param pool the pool to free (may be NULL)
+ */
+void inode_pool_free(struct inode_pool *pool)
+{
+    free(pool);
+}
+
+/**
+ * @brief the free inodes of word i of the ibm, one bit per inode
+ */
+static uint64_t free_bits(const struct bmblock_array *ibm, size_t i)
+{
+    const uint64_t nb_bits = ibm -> max - ibm -> min + 1;
+    uint64_t bits = ~(ibm -> bm[i]);
+
+    // le dernier mot n'est pas forcément entier
+    if (i == ibm -> length - 1 && nb_bits % BITS_PER_VECTOR != 0) {
+        bits &= (UINT64_C(1) << (nb_bits % BITS_PER_VECTOR)) - 1;
+    }
+    return bits;
+}
+
+/**
+ * @brief refill the empty stack with the next free inodes of the ibm
+ * @return the number of inodes in the stack
+ */
+static size_t pool_refill(struct unix_filesystem *u)
+{
+    struct inode_pool *pool = u -> ipool;
+    const struct bmblock_array *ibm = u -> ibm;
+    uint16_t found[INODE_POOL_SIZE];
+    size_t nb = 0;
+    size_t i = pool -> cursor;
+
+    ++(pool -> stats.refills);
+    for (size_t n = 0; n < ibm -> length && nb < INODE_POOL_SIZE; ++n) {
+        uint64_t bits = free_bits(ibm, i);
+
+        ++(pool -> stats.words);
+        while (bits != 0 && nb < INODE_POOL_SIZE) {
+            found[nb++] = (uint16_t) (ibm -> min + i * BITS_PER_VECTOR + (uint64_t) __builtin_ctzll(bits));
+            bits &= bits - 1;
+        }
+        // un mot pas épuisé sera repris au prochain remplissage
+        if (bits == 0) {
+            i = (i + 1) % ibm -> length;
+        }
+    }
+    pool -> cursor = i;
+
+    // le plus petit numéro au sommet
+    for (size_t k = 0; k < nb; ++k) {
+        pool -> free[k] = found[nb - 1 - k];
+    }
+    pool -> top = nb;
+    return nb;
+}
+
+/**
+ * @brief take a free inode and mark it used in the ibm
+ * @param u the filesystem (u->ipool != NULL)
+ * @return the inode number; ERR_NOMEM if there is no free inode
+ */
+int inode_pool_get(struct unix_filesystem *u)
+{
+    M_REQUIRE_NON_NULL(u);
+    M_REQUIRE_NON_NULL(u -> ipool);
+    M_REQUIRE_NON_NULL(u -> ibm);
+
+    struct inode_pool *pool = u -> ipool;
+
+    while (pool -> top > 0 || pool_refill(u) > 0) {
+        const uint16_t inr = pool -> free[--(pool -> top)];
+        if (bm_get(u -> ibm, inr) == 0) {
+            bm_set(u -> ibm, inr);
+            ++(pool -> stats.allocs);
+            return inr;
+        }
+        // marqué utilisé sans passer par la pile
+        ++(pool -> stats.stale);
+    }
+    return ERR_NOMEM;
+}
+
+/**
+ * @brief take a free inode close to a goal inode and mark it used in the
+ *        ibm: the first free inode in the inode sector of the goal, then in
+ *        the sectors after and before it (up to INODE_POOL_NEAR_SECTORS
+ *        away), else the one inode_pool_get() gives
+ * @param u the filesystem (u->ipool != NULL)
+ * @param goal an inode whose neighbours are preferred (a parent directory,
+ *        a sibling)
+ * @return the inode number; ERR_NOMEM if there is no free inode
+ */
+int inode_pool_get_near(struct unix_filesystem *u, uint16_t goal)
+{
+    M_REQUIRE_NON_NULL(u);
+    M_REQUIRE_NON_NULL(u -> ipool);
+    M_REQUIRE_NON_NULL(u -> ibm);
+
+    const int64_t sector = goal / INODES_PER_SECTOR;
+
+    // secteurs dans l'ordre: celui du but, +1, -1, +2, -2...
+    for (int d = 0; d <= 2 * INODE_POOL_NEAR_SECTORS; ++d) {
+        const int64_t s = d % 2 ? sector + (d + 1) / 2 : sector - d / 2;
+        if (s < 0 || s >= u -> s.s_isize) {
+            continue;
+        }
+        for (uint64_t inr = (uint64_t) s * INODES_PER_SECTOR; inr < (uint64_t) (s + 1) * INODES_PER_SECTOR; ++inr) {
+            if (bm_get(u -> ibm, inr) == 0) {
+                bm_set(u -> ibm, inr);
+                ++(u -> ipool -> stats.allocs);
+                ++(u -> ipool -> stats.near);
+                return (int) inr;
+            }
+        }
+    }
+    return inode_pool_get(u);
+}
+
+/**
+ * @brief whether all the inodes of group g are free in the ibm
+ */
+static int group_free(const struct unix_filesystem *u, uint64_t g)
+{
+    const uint64_t first = g * INODE_POOL_GROUP_SECTORS * INODES_PER_SECTOR;
+
+    for (uint64_t inr = first; inr < first + INODE_POOL_GROUP_SECTORS * INODES_PER_SECTOR; ++inr) {
+        // hors de l'ibm (inodes 0 et 1, fin de table): comme occupé
+        if (bm_get(u -> ibm, inr) != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief take the first inode of the first group of INODE_POOL_GROUP_SECTORS
+ *        inode sectors that is entirely free, from the group of goal on
+ *        (wrapping around), and mark it used in the ibm; else the one
+ *        inode_pool_get_near() gives
+ * @param u the filesystem (u->ipool != NULL)
+ * @param goal the parent directory of the new directory
+ * @return the inode number; ERR_NOMEM if there is no free inode
+ */
+int inode_pool_get_group(struct unix_filesystem *u, uint16_t goal)
+{
+    M_REQUIRE_NON_NULL(u);
+    M_REQUIRE_NON_NULL(u -> ipool);
+    M_REQUIRE_NON_NULL(u -> ibm);
+
+    const uint64_t nb_groups = ((uint64_t) u -> s.s_isize + INODE_POOL_GROUP_SECTORS - 1) / INODE_POOL_GROUP_SECTORS;
+    const uint64_t start = goal / (INODE_POOL_GROUP_SECTORS * INODES_PER_SECTOR);
+
+    for (uint64_t n = 0; n < nb_groups; ++n) {
+        const uint64_t g = (start + n) % nb_groups;
+        if (group_free(u, g)) {
+            const uint64_t inr = g * INODE_POOL_GROUP_SECTORS * INODES_PER_SECTOR;
+            bm_set(u -> ibm, inr);
+            ++(u -> ipool -> stats.allocs);
+            ++(u -> ipool -> stats.groups);
+            return (int) inr;
+        }
+    }
+    return inode_pool_get_near(u, goal);
+}
+
+/**
+ * @brief mark an inode free in the ibm and keep it for the next allocation
+ * @param u the filesystem (u->ipool != NULL)
+ * @param inr the inode number
+ */
+void inode_pool_put(struct unix_filesystem *u, uint16_t inr)
+{
+    struct inode_pool *pool = NULL;
+
+    if (u == NULL || u -> ipool == NULL || u -> ibm == NULL || bm_get(u -> ibm, inr) != 1) {
+        return;
+    }
+    pool = u -> ipool;
+
+    bm_clear(u -> ibm, inr);
+    ++(pool -> stats.frees);
+    // pile pleine: un prochain remplissage le retrouvera dans l'ibm
+    if (pool -> top < INODE_POOL_SIZE) {
+        pool -> free[(pool -> top)++] = inr;
+    }
+}
+
+/**
+ * @brief the statistics of a pool since mount
+ * @param u the filesystem (u->ipool != NULL)
+ * @param stats the statistics (OUT)
+ */
+void inode_pool_stats(const struct unix_filesystem *u, struct inode_pool_stats *stats)
+{
+    if (u != NULL && u -> ipool != NULL && stats != NULL) {
+        *stats = u -> ipool -> stats;
+    }
+}
+
+/**
+ * @brief print the statistics of a pool and the number of inodes in its stack
+ * @param output the stream to print to
+ * @param u the filesystem (u->ipool != NULL)
+ */
+void inode_pool_print(FILE *output, const struct unix_filesystem *u)
+{
+    if (output == NULL || u == NULL || u -> ipool == NULL) {
+        return;
+    }
+    const struct inode_pool *pool = u -> ipool;
+
+    fprintf(output, "pooled  : %zu/%d\n", pool -> top, INODE_POOL_SIZE);
+    fprintf(output, "allocs  : %" PRIu64 "\n", pool -> stats.allocs);
+    fprintf(output, "frees   : %" PRIu64 "\n", pool -> stats.frees);
+    fprintf(output, "refills : %" PRIu64 " (%" PRIu64 " words scanned)\n",
+            pool -> stats.refills, pool -> stats.words);
+    fprintf(output, "stale   : %" PRIu64 "\n", pool -> stats.stale);
+    fprintf(output, "near    : %" PRIu64 "\n", pool -> stats.near);
+    fprintf(output, "groups  : %" PRIu64 "\n", pool -> stats.groups);
+}
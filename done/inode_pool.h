@@ -0,0 +1,114 @@
+#pragma once
+
+/**
+ * @file  inode_pool.h
+ * @brief free-inode pool of a mounted filesystem.
+ *
+ * A small stack of inode numbers known to be free in the ibm. Allocating
+ * pops the stack and freeing pushes on it; when the stack is empty, it is
+ * refilled with a batch of free inodes found 64 at a time in the words of
+ * the ibm, starting where the last refill stopped.
+ *
+ * Only inode.c, mount.c and the shell use these functions; see
+ * inode_alloc() and inode_free() in inode.h.
+ *
+ * @author José Ferro Pinto
+ * @author Marc Favrod-Coune
+ * @date march 2017
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include "mount.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* number of free inodes kept in the stack */
+#define INODE_POOL_SIZE 64
+
+/* inode_pool_get_near() looks this many inode sectors before and after
+ * the sector of its goal */
+#define INODE_POOL_NEAR_SECTORS 3
+
+/* inode sectors in a group: inode_pool_get_group() gives a new directory
+ * a group of its own, which its entries then fill */
+#define INODE_POOL_GROUP_SECTORS 4
+
+struct inode_pool_stats {
+    uint64_t allocs;    /* inodes given by inode_pool_get() */
+    uint64_t frees;     /* inodes given back by inode_pool_put() */
+    uint64_t refills;   /* scans of the ibm to refill the stack */
+    uint64_t words;     /* 64-bit words of the ibm examined by the scans */
+    uint64_t stale;     /* inodes of the stack found already used in the ibm */
+    uint64_t near;      /* inodes given by inode_pool_get_near() close to their goal */
+    uint64_t groups;    /* inodes given by inode_pool_get_group() in a free group */
+};
+
+/**
+ * @brief allocate an empty pool
+ * @return the new pool or NULL on failure
+ */
+struct inode_pool *inode_pool_alloc(void);
+
+/**
+ * @brief free a pool
+ * @param pool the pool to free (may be NULL)
+ */
+void inode_pool_free(struct inode_pool *pool);
+
+/**
+ * @brief take a free inode and mark it used in the ibm
+ * @param u the filesystem (u->ipool != NULL)
+ * @return the inode number; ERR_NOMEM if there is no free inode
+ */
+int inode_pool_get(struct unix_filesystem *u);
+
+/**
+ * @brief take a free inode close to a goal inode and mark it used in the
+ *        ibm: the first free inode in the inode sector of the goal, then in
+ *        the sectors after and before it (up to INODE_POOL_NEAR_SECTORS
+ *        away), else the one inode_pool_get() gives
+ * @param u the filesystem (u->ipool != NULL)
+ * @param goal an inode whose neighbours are preferred (a parent directory,
+ *        a sibling)
+ * @return the inode number; ERR_NOMEM if there is no free inode
+ */
+int inode_pool_get_near(struct unix_filesystem *u, uint16_t goal);
+
+/**
+ * @brief take the first inode of the first group of INODE_POOL_GROUP_SECTORS
+ *        inode sectors that is entirely free, from the group of goal on
+ *        (wrapping around), and mark it used in the ibm; else the one
+ *        inode_pool_get_near() gives
+ * @param u the filesystem (u->ipool != NULL)
+ * @param goal the parent directory of the new directory
+ * @return the inode number; ERR_NOMEM if there is no free inode
+ */
+int inode_pool_get_group(struct unix_filesystem *u, uint16_t goal);
+
+/**
+ * @brief mark an inode free in the ibm and keep it for the next allocation
+ * @param u the filesystem (u->ipool != NULL)
+ * @param inr the inode number
+ */
+void inode_pool_put(struct unix_filesystem *u, uint16_t inr);
+
+/**
+ * @brief the statistics of a pool since mount
+ * @param u the filesystem (u->ipool != NULL)
+ * @param stats the statistics (OUT)
+ */
+void inode_pool_stats(const struct unix_filesystem *u, struct inode_pool_stats *stats);
+
+/**
+ * @brief print the statistics of a pool and the number of inodes in its stack
+ * @param output the stream to print to
+ * @param u the filesystem (u->ipool != NULL)
+ */
+void inode_pool_print(FILE *output, const struct unix_filesystem *u);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,191 @@
+/**
+ * @file  inode_scan.c
+ * @brief scan of the whole inode table.
+ *
+ * The inode sectors are read INODE_SCAN_CHUNK at a time with
+ * sector_read_range(), and the IALLOC bits of each chunk are gathered into
+ * one 16-bit mask per sector (bit k: inode k of the sector is allocated).
+ * The masks are computed with AVX2 (gather of the 32-bit words holding
+ * i_mode, at a stride of 32 bytes) or SSE2 when the CPU has them (checked
+ * once at run time), otherwise with a scalar loop.
+ *
+ * @author José Ferro Pinto
+ * @author Marc Favrod-Coune
+ * @date march 2017
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "error.h"
+#include "unixv6fs.h"
+#include "mount.h"
+#include "sector.h"
+#include "inode.h"
+#include "inode_cache.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define INODE_SCAN_X86 1
+#endif
+
+// nombre de secteurs d'inodes lus en une fois
+#define INODE_SCAN_CHUNK 32
+
+typedef void (*alloc_masks_fn)(const struct inode *inodes, size_t nb_sectors, uint16_t *masks);
+
+/**
+ * @brief the allocation masks of nb_sectors inode sectors, one inode at a time
+ */
+static void alloc_masks_scalar(const struct inode *inodes, size_t nb_sectors, uint16_t *masks)
+{
+    for (size_t s = 0; s < nb_sectors; ++s) {
+        uint16_t mask = 0;
+        for (int k = 0; k < INODES_PER_SECTOR; ++k) {
+            if (inodes[s * INODES_PER_SECTOR + (size_t) k].i_mode & IALLOC) {
+                mask |= (uint16_t) (1u << k);
+            }
+        }
+        masks[s] = mask;
+    }
+}
+
+#ifdef INODE_SCAN_X86
+/**
+ * @brief the allocation masks of nb_sectors inode sectors, 4 inodes at a time:
+ *        the words holding i_mode are interleaved, then IALLOC is shifted
+ *        into the sign bit that movemask collects
+ */
+__attribute__((target("sse2")))
+static void alloc_masks_sse2(const struct inode *inodes, size_t nb_sectors, uint16_t *masks)
+{
+    const uint8_t *p = (const uint8_t *) inodes;
+
+    for (size_t s = 0; s < nb_sectors; ++s) {
+        uint16_t mask = 0;
+        for (int k = 0; k < INODES_PER_SECTOR; k += 4) {
+            const uint8_t *q = p + (s * INODES_PER_SECTOR + (size_t) k) * sizeof(struct inode);
+            __m128i a = _mm_loadu_si128((const __m128i *) q);
+            __m128i b = _mm_loadu_si128((const __m128i *) (q + sizeof(struct inode)));
+            __m128i c = _mm_loadu_si128((const __m128i *) (q + 2 * sizeof(struct inode)));
+            __m128i d = _mm_loadu_si128((const __m128i *) (q + 3 * sizeof(struct inode)));
+            __m128i modes = _mm_unpacklo_epi64(_mm_unpacklo_epi32(a, b), _mm_unpacklo_epi32(c, d));
+            modes = _mm_slli_epi32(modes, 16);
+            mask |= (uint16_t) (_mm_movemask_ps(_mm_castsi128_ps(modes)) << k);
+        }
+        masks[s] = mask;
+    }
+}
+
+/**
+ * @brief the allocation masks of nb_sectors inode sectors, 8 inodes at a time
+ *        with a gather at a stride of one inode
+ */
+__attribute__((target("avx2")))
+static void alloc_masks_avx2(const struct inode *inodes, size_t nb_sectors, uint16_t *masks)
+{
+    const int stride = (int) (sizeof(struct inode) / sizeof(int));
+    const __m256i index = _mm256_setr_epi32(0, stride, 2 * stride, 3 * stride,
+                                            4 * stride, 5 * stride, 6 * stride, 7 * stride);
+    const int *p = (const int *) inodes;
+
+    for (size_t s = 0; s < nb_sectors; ++s) {
+        const int *q = p + s * INODES_PER_SECTOR * (size_t) stride;
+        __m256i lo = _mm256_i32gather_epi32(q, index, 4);
+        __m256i hi = _mm256_i32gather_epi32(q + 8 * stride, index, 4);
+        lo = _mm256_slli_epi32(lo, 16);
+        hi = _mm256_slli_epi32(hi, 16);
+        masks[s] = (uint16_t) (_mm256_movemask_ps(_mm256_castsi256_ps(lo))
+                               | (_mm256_movemask_ps(_mm256_castsi256_ps(hi)) << 8));
+    }
+}
+#endif
+
+/**
+ * @brief the best kernel for this CPU, chosen at the first call
+ */
+static alloc_masks_fn alloc_masks_kernel(void)
+{
+    static alloc_masks_fn kernel = NULL;
+
+    if (kernel == NULL) {
+        alloc_masks_fn chosen = alloc_masks_scalar;
+#ifdef INODE_SCAN_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            chosen = alloc_masks_avx2;
+        } else if (__builtin_cpu_supports("sse2")) {
+            chosen = alloc_masks_sse2;
+        }
+#endif
+        kernel = chosen;
+    }
+    return kernel;
+}
+
+/**
+ * @brief call fn for each allocated inode of the table, in increasing
+ *        inode number order
+ * @param u the filesystem (IN)
+ * @param fn the function to call; inode is NULL for the inodes of a sector
+ *        that could not be read
+ * @param arg passed to fn
+ * @return 0 on success; the first non-zero value returned by fn
+ */
+int inode_scan(const struct unix_filesystem *u, inode_scan_fn fn, void *arg)
+{
+    M_REQUIRE_NON_NULL(u);
+    M_REQUIRE_NON_NULL(fn);
+
+    struct inode chunk[INODE_SCAN_CHUNK * INODES_PER_SECTOR];
+    uint16_t masks[INODE_SCAN_CHUNK];
+    int unread[INODE_SCAN_CHUNK];
+    const alloc_masks_fn kernel = alloc_masks_kernel();
+    enum sector_class cls = SECTOR_CLASS_OTHER;
+    int err = 0;
+
+    // la table est lue directement: les inodes modifiés doivent y être
+    if (u -> icache != NULL) {
+        err = inode_cache_flush(u);
+        if (err) {
+            return err;
+        }
+    }
+
+    for (uint32_t first = 0; first < u -> s.s_isize; first += INODE_SCAN_CHUNK) {
+        uint32_t nb = u -> s.s_isize - first < INODE_SCAN_CHUNK ? u -> s.s_isize - first : INODE_SCAN_CHUNK;
+
+        memset(unread, 0, sizeof(unread));
+        cls = sector_set_class(u -> dev, SECTOR_CLASS_INODE);
+        err = sector_read_range(u -> dev, u -> s.s_inode_start + first, nb, chunk);
+        for (uint32_t s = 0; s < nb && err; ++s) {
+            // un secteur illisible: on relit le paquet secteur par secteur
+            unread[s] = sector_read(u -> dev, u -> s.s_inode_start + first + s, chunk + s * INODES_PER_SECTOR);
+            if (unread[s]) {
+                memset(chunk + s * INODES_PER_SECTOR, 0, SECTOR_SIZE);
+            }
+        }
+        sector_set_class(u -> dev, cls);
+
+        kernel(chunk, nb, masks);
+        for (uint32_t s = 0; s < nb; ++s) {
+            uint32_t mask = masks[s];
+            for (uint32_t k = 0; unread[s] && k < INODES_PER_SECTOR; ++k) {
+                int ret = fn(u, (uint16_t) ((first + s) * INODES_PER_SECTOR + k), NULL, arg);
+                if (ret) {
+                    return ret;
+                }
+            }
+            while (mask != 0) {
+                const uint32_t k = (uint32_t) __builtin_ctz(mask);
+                const uint32_t i = s * INODES_PER_SECTOR + k;
+                int ret = fn(u, (uint16_t) (first * INODES_PER_SECTOR + i), &chunk[i], arg);
+                if (ret) {
+                    return ret;
+                }
+                mask &= mask - 1;
+            }
+        }
+    }
+    return 0;
+}
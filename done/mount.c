@@ -7,6 +7,8 @@
  * @date mars 2017
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
@@ -17,43 +19,327 @@
 #include "inode.h"
 #include "mount.h"
 #include "bmblock.h"
+#include "histo.h"
+#include "inode_cache.h"
+#include "inode_pool.h"
 #include <stdlib.h>
 #include <inttypes.h>
+#include <unistd.h>
+#include <pthread.h>
+
+// nombre maximal de secteurs indirects lus en vol par fill_fbm
+#define FBM_MAX_REQS 64
+
+// nombre d'inodes lus ensemble par fill_fbm
+#define FBM_BATCH_INODES 128
+
+// nombre maximal de threads de fill_fbm, et d'inodes alloués par thread au minimum
+#define FBM_MAX_THREADS 8
+#define FBM_THREAD_INODES 1024
+
+// secteurs d'inodes pris d'un coup par un thread de fill_fbm
+#define FBM_CHUNK_SECTORS 8
 
 
+/**
+ * @brief mark an inode as used in the ibm (an inode that could not be
+ *        read is considered used)
+ */
+static int fill_ibm_one(const struct unix_filesystem *u, uint16_t inr,
+                        const struct inode *inode, void *arg)
+{
+    (void) inode;
+    (void) arg;
+    if (inr >= u -> ibm -> min && inr <= u -> ibm -> max) {
+        bm_set(u -> ibm, inr);
+    }
+    return 0;
+}
+
 /**
  * @brief  fill the vector bitmap of the inodes
  * u - the mounted filesystem
  */
 void fill_ibm(struct unix_filesystem * u)
 {
-    struct inode sect_inode[INODES_PER_SECTOR];
-    uint64_t actu = 0;
-    uint64_t sector_number = 0;
+    // tout effacer
+    bm_clear_range(u -> ibm, u -> ibm -> min, u -> ibm -> max - u -> ibm -> min + 1);
+
+    // toute la table en quelques lectures; seuls les inodes alloués sont vus
+    (void) inode_scan(u, fill_ibm_one, NULL);
+}
+
+/* les lectures de secteurs indirects en vol pendant fill_fbm */
+struct fbm_io {
+    struct sector_device *dev;     // le disque où sont lus les secteurs indirects
+    struct bmblock_array *fbm;     // la fbm remplie
+    struct sector_req reqs[FBM_MAX_REQS];
+    int nb_addr[FBM_MAX_REQS];     // nombre d'adresses à prendre dans chaque secteur
+    uint16_t indirect[FBM_MAX_REQS][ADDRESSES_PER_SECTOR];
+    size_t nb_reqs;
+};
+
+/**
+ * @brief mark in the fbm the data sectors listed in the indirect sectors
+ *        read by the requests in flight (completed), then forget the requests
+ * @param io the requests in flight (IN-OUT)
+ */
+static void fill_fbm_indirect(struct fbm_io *io)
+{
+    for (size_t r = 0; r < io -> nb_reqs; ++r) {
+        const uint16_t *addr = io -> reqs[r].data;
+        if (io -> reqs[r].result) {
+            printf("ERROR unable to read indirect sector %u\n", io -> reqs[r].sector);
+            puts(ERR_MESSAGES[io -> reqs[r].result - ERR_FIRST]);
+        } else {
+            for (int k = 0; k < io -> nb_addr[r]; ++k) {
+                bm_set(io -> fbm, addr[k]);
+            }
+        }
+    }
+    io -> nb_reqs = 0;
+}
 
+/**
+ * @brief mark an indirect sector in the fbm and submit its read; the
+ *        requests in flight are completed and applied when there are
+ *        FBM_MAX_REQS of them
+ * @param sector the indirect sector
+ * @param nb the number of addresses to take in it
+ * @param io the requests in flight (IN-OUT)
+ */
+static void fill_fbm_submit(uint16_t sector, int nb, struct fbm_io *io)
+{
+    struct sector_req *req = &(io -> reqs[io -> nb_reqs]);
+    enum sector_class cls = SECTOR_CLASS_OTHER;
+
+    bm_set(io -> fbm, sector);
+
+    req -> sector = sector;
+    req -> count = 1;
+    req -> data = io -> indirect[io -> nb_reqs];
+    req -> write = 0;
+    io -> nb_addr[io -> nb_reqs] = nb < ADDRESSES_PER_SECTOR ? nb : ADDRESSES_PER_SECTOR;
+    cls = sector_set_class(io -> dev, SECTOR_CLASS_INDIRECT);
+    (void) sector_submit(io -> dev, req);
+    sector_set_class(io -> dev, cls);
+    ++(io -> nb_reqs);
+
+    if (io -> nb_reqs == FBM_MAX_REQS) {
+        (void) sector_complete(io -> dev);
+        fill_fbm_indirect(io);
+    }
+}
+
+/**
+ * @brief mark in the fbm the sectors of one file
+ * @param inode the inode of the file
+ * @param io the requests in flight (IN-OUT)
+ */
+static void fill_fbm_inode(const struct inode *inode, struct fbm_io *io)
+{
+    uint16_t dbl[ADDRESSES_PER_SECTOR];
+    int32_t taille = inode_getsize(inode);
+    int nb_sect = (taille + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    enum sector_class cls = SECTOR_CLASS_OTHER;
+    int err = 0;
+
+    if (taille <= ADDR_SMALL_LENGTH * SECTOR_SIZE) {
+        for (int k = 0; k < nb_sect; ++k) {
+            bm_set(io -> fbm, inode -> i_addr[k]);
+        }
+    } else {
+        // les secteurs indirects sont lus de manière asynchrone
+        const int nb_single = nb_sect < INODE_DOUBLE_OFF ? nb_sect : INODE_DOUBLE_OFF;
+        for (int k = 0; k * ADDRESSES_PER_SECTOR < nb_single; ++k) {
+            fill_fbm_submit(inode -> i_addr[k], nb_single - k * ADDRESSES_PER_SECTOR, io);
+        }
+        // le secteur doublement indirect donne les secteurs indirects suivants
+        if (nb_sect > INODE_DOUBLE_OFF) {
+            bm_set(io -> fbm, inode -> i_addr[ADDR_SMALL_LENGTH - 1]);
+            cls = sector_set_class(io -> dev, SECTOR_CLASS_INDIRECT);
+            err = sector_read(io -> dev, inode -> i_addr[ADDR_SMALL_LENGTH - 1], dbl);
+            sector_set_class(io -> dev, cls);
+            if (err) {
+                printf("ERROR unable to read indirect sector %u\n", inode -> i_addr[ADDR_SMALL_LENGTH - 1]);
+                puts(ERR_MESSAGES[err - ERR_FIRST]);
+            }
+            for (int k = 0; !err && k < ADDRESSES_PER_SECTOR
+                 && INODE_DOUBLE_OFF + k * ADDRESSES_PER_SECTOR < nb_sect; ++k) {
+                fill_fbm_submit(dbl[k], nb_sect - INODE_DOUBLE_OFF - k * ADDRESSES_PER_SECTOR, io);
+            }
+        }
+    }
+}
 
-    for (uint64_t j = u -> ibm -> min; j < u -> ibm -> max; ++j) { // tout effacer
-        bm_clear(u -> ibm, j);
+/**
+ * @brief mark in the fbm the sectors of the files of a batch of inodes,
+ *        read together with inode_read_many()
+ * @param u the mounted filesystem
+ * @param inrs the inode numbers
+ * @param nb the number of inodes
+ * @param io the requests in flight (IN-OUT)
+ */
+static void fill_fbm_batch(struct unix_filesystem * u, const uint16_t *inrs, size_t nb, struct fbm_io *io)
+{
+    struct inode inodes[FBM_BATCH_INODES];
+    int err = inode_read_many(u, inrs, nb, inodes);
+
+    for (size_t k = 0; k < nb; ++k) {
+        if (inodes[k].i_mode & IALLOC) {
+            fill_fbm_inode(&inodes[k], io);
+        } else {
+            printf("ERROR unable to read inode %u\n", inrs[k]);
+            puts(ERR_MESSAGES[(err ? err : ERR_UNALLOCATED_INODE) - ERR_FIRST]);
+        }
     }
+}
+
+/* un thread de fill_fbm: son disque et sa fbm à lui */
+struct fbm_worker {
+    const struct unix_filesystem *u;
+    size_t *next;                  // prochain paquet de secteurs d'inodes, partagé
+    pthread_t thread;
+    struct fbm_io io;
+};
+
+/**
+ * @brief whether inode inr is one of those fill_fbm() looks at: the root
+ *        and the inodes of the ibm
+ */
+static int fill_fbm_wanted(const struct unix_filesystem *u, uint64_t inr)
+{
+    return inr == ROOT_INUMBER || bm_get(u -> ibm, inr) == 1;
+}
+
+/**
+ * @brief a thread of fill_fbm(): take FBM_CHUNK_SECTORS inode sectors at a
+ *        time until there are none left, read them in one request and mark
+ *        the sectors of their allocated inodes in the fbm of the worker
+ * @param arg the worker (struct fbm_worker *)
+ * @return NULL
+ */
+static void *fill_fbm_worker(void *arg)
+{
+    struct fbm_worker *w = arg;
+    const struct unix_filesystem *u = w -> u;
+    struct inode inodes[FBM_CHUNK_SECTORS * INODES_PER_SECTOR];
+    size_t chunk = 0;
+
+    while ((chunk = __atomic_fetch_add(w -> next, 1, __ATOMIC_RELAXED)) * FBM_CHUNK_SECTORS < u -> s.s_isize) {
+        const size_t first = chunk * FBM_CHUNK_SECTORS;
+        const size_t nb = u -> s.s_isize - first < FBM_CHUNK_SECTORS ? u -> s.s_isize - first : FBM_CHUNK_SECTORS;
+        uint64_t inr = first * INODES_PER_SECTOR;
+
+        // un paquet sans inode alloué n'est pas lu
+        while (inr < (first + nb) * INODES_PER_SECTOR && !fill_fbm_wanted(u, inr)) {
+            ++inr;
+        }
+        if (inr == (first + nb) * INODES_PER_SECTOR) {
+            continue;
+        }
 
-    while (actu < u -> ibm -> max) { // pour chaque secteur
-        int err = sector_read(u -> f, u -> s.s_inode_start + sector_number, sect_inode);
-        for (uint16_t k = 0; k < INODES_PER_SECTOR; ++k) { // pour chaque inode
-            if (!err) { // si pas d'erreur de lecture
-                if ((actu >= u -> ibm -> min) && (actu <= u -> ibm -> max)) {
-                    if (sect_inode[k].i_mode & IALLOC) {
-                        bm_set(u -> ibm, actu);
-                    } else {
-                        bm_clear(u -> ibm, actu);
-                    }
+        enum sector_class cls = sector_set_class(w -> io.dev, SECTOR_CLASS_INODE);
+        int err = sector_read_range(w -> io.dev, (uint32_t) (u -> s.s_inode_start + first), (uint32_t) nb, inodes);
+        sector_set_class(w -> io.dev, cls);
+        if (err) {
+            printf("ERROR unable to read inode sectors %zu to %zu\n", first, first + nb - 1);
+            puts(ERR_MESSAGES[err - ERR_FIRST]);
+            continue;
+        }
+
+        for (size_t k = 0; k < nb * INODES_PER_SECTOR; ++k) {
+            inr = first * INODES_PER_SECTOR + k;
+            if (fill_fbm_wanted(u, inr)) {
+                if (inodes[k].i_mode & IALLOC) {
+                    fill_fbm_inode(&inodes[k], &(w -> io));
+                } else {
+                    printf("ERROR unable to read inode %" PRIu64 "\n", inr);
+                    puts(ERR_MESSAGES[ERR_UNALLOCATED_INODE - ERR_FIRST]);
                 }
-            } else { // si une erreur de lecture
-                bm_set(u -> ibm, actu);
             }
-            ++actu;
         }
-        ++sector_number;
     }
+
+    (void) sector_complete(w -> io.dev);
+    fill_fbm_indirect(&(w -> io));
+    return NULL;
+}
+
+/**
+ * @brief the number of threads fill_fbm() uses: one per online CPU, at most
+ *        FBM_MAX_THREADS and one per FBM_THREAD_INODES allocated inodes
+ */
+static size_t fill_fbm_nb_threads(const struct unix_filesystem * u)
+{
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t nb = (size_t) (bm_count(u -> ibm) / FBM_THREAD_INODES);
+
+    if (cpus > 0 && nb > (size_t) cpus) {
+        nb = (size_t) cpus;
+    }
+    return nb < FBM_MAX_THREADS ? nb : FBM_MAX_THREADS;
+}
+
+/**
+ * @brief fill the fbm with several threads, each with its own read-only
+ *        device and its own fbm, ORed into u->fbm at the end
+ * @param u the mounted filesystem (its fbm is cleared)
+ * @param nb_threads the number of threads, at least 2
+ * @return 0 on success; <0 if the threads could not be set up (nothing
+ *         was done then)
+ */
+static int fill_fbm_parallel(struct unix_filesystem * u, size_t nb_threads)
+{
+    struct fbm_worker workers[FBM_MAX_THREADS];
+    int running[FBM_MAX_THREADS] = { 0 };
+    size_t next = 0;
+    size_t nb = 0;
+    int err = 0;
+
+    // les threads lisent le disque sans passer par le cache
+    err = sector_flush(u -> dev);
+    for (nb = 0; !err && nb < nb_threads; ++nb) {
+        struct fbm_worker *w = &workers[nb];
+        w -> u = u;
+        w -> next = &next;
+        w -> io.nb_reqs = 0;
+        w -> io.fbm = bm_alloc(u -> fbm -> min, u -> fbm -> max);
+        if (w -> io.fbm == NULL) {
+            err = ERR_NOMEM;
+            break;
+        }
+        err = sector_reopen(u -> dev, SECTOR_OPEN_RDONLY, &(w -> io.dev));
+        if (err) {
+            free(w -> io.fbm);
+            break;
+        }
+    }
+
+    if (!err) {
+        // le premier est le thread appelant; un thread qui ne démarre pas
+        // laisse simplement plus de paquets aux autres
+        for (size_t k = 1; k < nb; ++k) {
+            running[k] = pthread_create(&workers[k].thread, NULL, fill_fbm_worker, &workers[k]) == 0;
+        }
+        fill_fbm_worker(&workers[0]);
+        for (size_t k = 1; k < nb; ++k) {
+            if (running[k]) {
+                pthread_join(workers[k].thread, NULL);
+            }
+        }
+    }
+
+    for (size_t k = 0; k < nb; ++k) {
+        if (!err) {
+            bm_combine(u -> fbm, workers[k].io.fbm, BM_OR);
+        }
+        // les lectures des threads comptent pour le disque monté
+        sector_stats_add(u -> dev, workers[k].io.dev);
+        sector_close(workers[k].io.dev);
+        free(workers[k].io.fbm);
+    }
+    return err;
 }
 
 /**
@@ -62,47 +348,273 @@ void fill_ibm(struct unix_filesystem * u)
  */
 void fill_fbm(struct unix_filesystem * u)
 {
-    int taille = 0;
-    int taille_grand = 0;
-    struct inode inode;
+    // secteurs indirects lus en vol en même temps
+    struct fbm_io io;
+    uint16_t inrs[FBM_BATCH_INODES];
+    size_t nb = fill_fbm_nb_threads(u);
+
+    io.dev = u -> dev;
+    io.fbm = u -> fbm;
+    io.nb_reqs = 0;
 
     // mettre tous les secteurs à libre
-    for (uint64_t i = u -> fbm -> min; i < u -> fbm -> max; ++i) {
-        bm_clear(u->fbm, i);
+    bm_clear_range(u -> fbm, u -> fbm -> min, u -> fbm -> max - u -> fbm -> min + 1);
+
+    // beaucoup d'inodes: plusieurs threads, sinon (ou s'ils échouent) ici
+    if (nb > 1 && fill_fbm_parallel(u, nb) == 0) {
+        return;
     }
+    nb = 0;
 
-    // pour chaque inode: appeler inode find sector
+    // pour chaque inode: marquer ses secteurs; les inodes sont lus par paquets
     for (uint64_t i = u -> ibm -> min - 1; i < u -> ibm -> max; ++i) {
-        int32_t offset = 0;
-        int err = bm_get(u -> ibm, i);
-
-        if (err == 1 || i == u -> ibm -> min - 1) {
-            err = inode_read(u, i, &inode);
-            if (!err) {
-                taille = inode_getsize(&inode)/SECTOR_SIZE;
-                if (taille < 7*ADDRESSES_PER_SECTOR && taille > 7) {
-                    taille_grand = taille/ADDRESSES_PER_SECTOR;
-                    for (int k = 0; k <= taille_grand; ++k) {
-                        bm_set(u -> fbm, inode.i_addr[k]);
-                    }
-                }
-
-                err =  inode_findsector(u, &inode, offset);
-                while (offset <= taille && err > 0) {
-                    bm_set(u -> fbm, (uint64_t)err);
-                    ++offset;
-                    err =  inode_findsector(u, &inode, offset);
-                }
-                if (err < 0) {
-                    printf("ERROR in inode_findsector\n");
-                    puts(ERR_MESSAGES[err - ERR_FIRST]);
-                }
-            } else {
-                printf("ERROR unable to read inode %lu\n", i);
-                puts(ERR_MESSAGES[err - ERR_FIRST]);
+        if (bm_get(u -> ibm, i) == 1 || i == u -> ibm -> min - 1) {
+            inrs[nb++] = (uint16_t) i;
+            if (nb == FBM_BATCH_INODES) {
+                fill_fbm_batch(u, inrs, nb, &io);
+                nb = 0;
             }
         }
     }
+    fill_fbm_batch(u, inrs, nb, &io);
+
+    (void) sector_complete(u -> dev);
+    fill_fbm_indirect(&io);
+}
+
+/**
+ * @brief the number of sectors of a region holding the bitmap of the values
+ *        [min, max], as bm_export() writes it
+ */
+static uint16_t bitmap_sectors(uint64_t min, uint64_t max)
+{
+    const uint64_t bytes = ((max - min) / BITS_PER_VECTOR + 1) * sizeof(uint64_t);
+    return (uint16_t) ((bytes + SECTOR_SIZE - 1) / SECTOR_SIZE);
+}
+
+/**
+ * @brief whether the bitmaps of u are kept on the disk: s_fmod is one of
+ *        ours and the regions of the superblock are large enough
+ */
+static int bitmaps_on_disk(const struct unix_filesystem *u)
+{
+    return (u -> s.s_fmod == MOUNTV6_FMOD_CLEAN || u -> s.s_fmod == MOUNTV6_FMOD_DIRTY)
+           && u -> s.s_fbm_start > SUPERBLOCK_SECTOR && u -> s.s_ibm_start > SUPERBLOCK_SECTOR
+           && (size_t) u -> s.s_fbmsize * SECTOR_SIZE >= bm_size(u -> fbm)
+           && (size_t) u -> s.s_ibmsize * SECTOR_SIZE >= bm_size(u -> ibm);
+}
+
+/**
+ * @brief read a bitmap from its region of the disk, in one request
+ * @param u the filesystem
+ * @param bm the bitmap (OUT)
+ * @param start the first sector of its region
+ * @return 0 on success; <0 on error
+ */
+static int bitmap_load(struct unix_filesystem *u, struct bmblock_array *bm, uint16_t start)
+{
+    const uint32_t nb = (uint32_t) ((bm_size(bm) + SECTOR_SIZE - 1) / SECTOR_SIZE);
+    uint8_t *data = calloc(nb, SECTOR_SIZE);
+    if (data == NULL) {
+        return ERR_NOMEM;
+    }
+
+    enum sector_class cls = sector_set_class(u -> dev, SECTOR_CLASS_BITMAP);
+    int err = sector_read_range(u -> dev, start, nb, data);
+    sector_set_class(u -> dev, cls);
+    if (!err) {
+        bm_import(bm, data);
+    }
+    free(data);
+    return err;
+}
+
+/**
+ * @brief write a bitmap to its region of the disk through the buffer cache;
+ *        only the sectors that changed are written
+ * @param u the filesystem
+ * @param bm the bitmap (IN)
+ * @param start the first sector of its region
+ * @return 0 on success; <0 on error
+ */
+static int bitmap_store(struct unix_filesystem *u, const struct bmblock_array *bm, uint16_t start)
+{
+    const uint32_t nb = (uint32_t) ((bm_size(bm) + SECTOR_SIZE - 1) / SECTOR_SIZE);
+    uint8_t old[SECTOR_SIZE];
+    uint8_t *data = calloc(nb, SECTOR_SIZE);
+    int err = 0;
+
+    if (data == NULL) {
+        return ERR_NOMEM;
+    }
+    bm_export(bm, data);
+
+    enum sector_class cls = sector_set_class(u -> dev, SECTOR_CLASS_BITMAP);
+    for (uint32_t k = 0; k < nb && !err; ++k) {
+        err = sector_read(u -> dev, start + k, old);
+        if (!err && memcmp(old, data + k * SECTOR_SIZE, SECTOR_SIZE) != 0) {
+            err = sector_write(u -> dev, start + k, data + k * SECTOR_SIZE);
+        }
+    }
+    sector_set_class(u -> dev, cls);
+    free(data);
+    return err;
+}
+
+/**
+ * @brief write the superblock with the given s_fmod, after everything
+ *        written before it has reached the disk
+ * @param u the filesystem
+ * @param fmod MOUNTV6_FMOD_DIRTY or MOUNTV6_FMOD_CLEAN
+ * @return 0 on success; <0 on error
+ */
+static int superblock_mark(struct unix_filesystem *u, uint8_t fmod)
+{
+    // les bitmaps doivent être sur le disque avant la marque propre
+    int err = sector_flush(u -> dev);
+    if (err) {
+        return err;
+    }
+
+    u -> s.s_fmod = fmod;
+    enum sector_class cls = sector_set_class(u -> dev, SECTOR_CLASS_SUPERBLOCK);
+    err = sector_write(u -> dev, SUPERBLOCK_SECTOR, &(u -> s));
+    sector_set_class(u -> dev, cls);
+    if (err) {
+        return err;
+    }
+    // et la marque sale avant toute autre écriture
+    return sector_flush(u -> dev);
+}
+
+/**
+ * @brief load the bitmaps from the disk if it was unmounted cleanly, else
+ *        rebuild them from the inodes
+ * @param u the mounted filesystem
+ */
+static void bitmaps_fill(struct unix_filesystem *u)
+{
+    int loaded = 0;
+
+    if (bitmaps_on_disk(u) && u -> s.s_fmod == MOUNTV6_FMOD_CLEAN) {
+        loaded = bitmap_load(u, u -> ibm, u -> s.s_ibm_start) == 0
+                 && bitmap_load(u, u -> fbm, u -> s.s_fbm_start) == 0;
+    }
+    if (!loaded) {
+        fill_ibm(u);
+        fill_fbm(u);
+    }
+}
+
+/* construction des bitmaps en arrière-plan (MOUNTV6_LAZY) */
+struct bm_builder {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int done;                      // les bitmaps sont prêtes
+    struct unix_filesystem view;   // ce que voit le thread: son disque, pas de cache d'inodes
+};
+
+/**
+ * @brief the background thread: fill the bitmaps through its own view of
+ *        the filesystem, then wake up the waiters
+ * @param arg the builder (struct bm_builder *)
+ * @return NULL
+ */
+static void *bitmaps_build(void *arg)
+{
+    struct bm_builder *b = arg;
+
+    bitmaps_fill(&(b -> view));
+
+    pthread_mutex_lock(&(b -> lock));
+    __atomic_store_n(&(b -> done), 1, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&(b -> cond));
+    pthread_mutex_unlock(&(b -> lock));
+    return NULL;
+}
+
+/**
+ * @brief start building the bitmaps of u on a background thread, which
+ *        reads the disk through its own read-only device
+ * @param u the mounted filesystem (its bitmaps are allocated)
+ * @return 0 on success; <0 on error (nothing was started then)
+ */
+static int bitmaps_start(struct unix_filesystem *u)
+{
+    struct bm_builder *b = calloc(1, sizeof(struct bm_builder));
+    if (b == NULL) {
+        return ERR_NOMEM;
+    }
+
+    // le thread lit le disque tel qu'il est: rien n'est modifié avant la fin
+    b -> view = *u;
+    b -> view.icache = NULL;
+    b -> view.ipool = NULL;
+    int err = sector_reopen(u -> dev, SECTOR_OPEN_RDONLY, &(b -> view.dev));
+    if (err) {
+        free(b);
+        return err;
+    }
+
+    pthread_mutex_init(&(b -> lock), NULL);
+    pthread_cond_init(&(b -> cond), NULL);
+    if (pthread_create(&(b -> thread), NULL, bitmaps_build, b) != 0) {
+        pthread_cond_destroy(&(b -> cond));
+        pthread_mutex_destroy(&(b -> lock));
+        sector_close(b -> view.dev);
+        free(b);
+        return ERR_NOMEM;
+    }
+    u -> builder = b;
+    return 0;
+}
+
+/**
+ * @brief wait for the background thread and free it
+ * @param u the mounted filesystem (u->builder != NULL)
+ */
+static void bitmaps_join(struct unix_filesystem *u)
+{
+    struct bm_builder *b = u -> builder;
+
+    pthread_join(b -> thread, NULL);
+    // ses lectures comptent pour le disque monté
+    sector_stats_add(u -> dev, b -> view.dev);
+    sector_close(b -> view.dev);
+    pthread_cond_destroy(&(b -> cond));
+    pthread_mutex_destroy(&(b -> lock));
+    free(b);
+    u -> builder = NULL;
+}
+
+/**
+ * @brief wait until the bitmaps of u can be used: with MOUNTV6_LAZY, until
+ *        the background thread has built them; at once otherwise. Every
+ *        function that reads or changes u->fbm or u->ibm calls it first.
+ * @param u - the mounted filesytem
+ * @return 0 on success; ERR_IO if u is mounted MOUNTV6_RDONLY (it has no
+ *         bitmaps)
+ */
+int mountv6_wait_bitmaps(struct unix_filesystem *u)
+{
+    M_REQUIRE_NON_NULL(u);
+
+    struct bm_builder *b = u -> builder;
+
+    if (u -> flags & MOUNTV6_RDONLY) {
+        return ERR_IO;
+    }
+    // déjà prêtes: pas de verrou
+    if (b == NULL || __atomic_load_n(&(b -> done), __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    pthread_mutex_lock(&(b -> lock));
+    while (!b -> done) {
+        pthread_cond_wait(&(b -> cond), &(b -> lock));
+    }
+    pthread_mutex_unlock(&(b -> lock));
+    return 0;
 }
 
 /**
@@ -112,53 +624,147 @@ void fill_fbm(struct unix_filesystem * u)
  * @return 0 on success; <0 on error
  */
 int mountv6(const char *filename, struct unix_filesystem *u)
+{
+    return mountv6_with(filename, u, 0);
+}
+
+/**
+ * @brief undo a mount that failed after the disk was opened: the background
+ *        thread is waited for, everything is freed and the disk is closed
+ * @param u the filesystem being mounted (u->dev != NULL)
+ * @param err the error the mount failed with
+ * @return err
+ */
+static int mountv6_abort(struct unix_filesystem *u, int err)
+{
+    if (u -> builder != NULL) {
+        bitmaps_join(u);
+    }
+    free(u -> ibm);
+    free(u -> fbm);
+    inode_pool_free(u -> ipool);
+    inode_cache_free(u -> icache);
+    u -> ibm = NULL;
+    u -> fbm = NULL;
+    u -> ipool = NULL;
+    u -> icache = NULL;
+    u -> bm_on_disk = 0;
+
+    sector_close(u -> dev);
+    u -> dev = NULL;
+    return err;
+}
+
+/**
+ * @brief mountv6_with() without the latency measure
+ */
+static int mountv6_with_impl(const char *filename, struct unix_filesystem *u, int flags)
 {
     M_REQUIRE_NON_NULL(filename);
     M_REQUIRE_NON_NULL(u);
     memset(u, 0, sizeof(*u));
     u -> fbm = NULL;
     u -> ibm = NULL;
-    u -> f = fopen(filename, "r+b");
-    if (u -> f == NULL) {
-        return ERR_IO;
+    u -> flags = flags;
+
+    const struct sector_ops *backend = &sector_fd_ops;
+    if (flags & MOUNTV6_MMAP) {
+        backend = &sector_mmap_ops;
+    } else if (flags & MOUNTV6_URING) {
+        backend = &sector_uring_ops;
+    }
+    const int open_flags = (flags & MOUNTV6_RDONLY) ? SECTOR_OPEN_RDONLY : 0;
+    int err = sector_open(backend, filename, open_flags, &(u -> dev));
+    if (err && backend == &sector_uring_ops) {
+        // pas d'io_uring dans ce noyau: repli sur les I/O synchrones
+        err = sector_open(&sector_fd_ops, filename, open_flags, &(u -> dev));
+    }
+    if (err) {
+        return err;
+    }
+    err = sector_cache_setup(u -> dev, MOUNTV6_CACHE_SECTORS);
+    if (err) {
+        return mountv6_abort(u, err);
     }
 
     uint8_t data[SECTOR_SIZE];
     int returnSecRead = ERR_IO;
-    returnSecRead = sector_read(u -> f, BOOTBLOCK_SECTOR, data);
+    enum sector_class cls = sector_set_class(u -> dev, SECTOR_CLASS_SUPERBLOCK);
+    returnSecRead = sector_read(u -> dev, BOOTBLOCK_SECTOR, data);
+    sector_set_class(u -> dev, cls);
 
     if (returnSecRead != 0) {
-        return returnSecRead;
+        return mountv6_abort(u, returnSecRead);
     }
 
     uint8_t toCheck = data[BOOTBLOCK_MAGIC_NUM_OFFSET];
 
     if (toCheck !=BOOTBLOCK_MAGIC_NUM) {
-        return ERR_BADBOOTSECTOR;
+        return mountv6_abort(u, ERR_BADBOOTSECTOR);
     }
     struct superblock superbck;
-    returnSecRead = sector_read(u -> f, SUPERBLOCK_SECTOR, &superbck);
+    cls = sector_set_class(u -> dev, SECTOR_CLASS_SUPERBLOCK);
+    returnSecRead = sector_read(u -> dev, SUPERBLOCK_SECTOR, &superbck);
+    sector_set_class(u -> dev, cls);
     if (returnSecRead != 0) {
-        return returnSecRead;
+        return mountv6_abort(u, returnSecRead);
     }
 
     u -> s = superbck;
 
+    u -> icache = inode_cache_alloc(MOUNTV6_CACHE_INODES);
+    if (u -> icache == NULL) {
+        return mountv6_abort(u, ERR_NOMEM);
+    }
+    // en lecture seule, rien n'est alloué: pas de bitmaps
+    if (flags & MOUNTV6_RDONLY) {
+        return 0;
+    }
+
     u -> fbm = NULL;
     u -> ibm = NULL;
     u -> fbm = bm_alloc((uint64_t) (u -> s.s_block_start + 1), (uint64_t) u -> s.s_fsize-1);
     u -> ibm = bm_alloc((uint64_t) (ROOT_INUMBER + 1), (uint64_t) (u -> s.s_isize)*INODES_PER_SECTOR-1);
+    u -> ipool = inode_pool_alloc();
 
-    if (u -> ibm == NULL ||u -> fbm == NULL ) {
-        return ERR_NOMEM;
+    if (u -> ibm == NULL ||u -> fbm == NULL || u -> ipool == NULL) {
+        return mountv6_abort(u, ERR_NOMEM);
     }
 
-    fill_ibm(u);
-    fill_fbm(u);
+    // démonté proprement: les bitmaps du disque sont à jour, sinon on les reconstruit
+    // (en arrière-plan avec MOUNTV6_LAZY, ou ici si le thread ne démarre pas)
+    if (!(flags & MOUNTV6_LAZY) || bitmaps_start(u) != 0) {
+        bitmaps_fill(u);
+    }
+
+    // jusqu'au démontage, les bitmaps du disque ne sont plus sûres
+    if (bitmaps_on_disk(u)) {
+        u -> bm_on_disk = 1;
+        err = superblock_mark(u, MOUNTV6_FMOD_DIRTY);
+        if (err) {
+            return mountv6_abort(u, err);
+        }
+    }
 
     return 0;
 }
 
+/**
+ * @brief  mount a unix v6 filesystem with the given options
+ * @param filename name of the unixv6 filesystem on the underlying disk (IN)
+ * @param u the filesystem (OUT)
+ * @param flags MOUNTV6_* flags
+ * @return 0 on success; <0 on error
+ */
+int mountv6_with(const char *filename, struct unix_filesystem *u, int flags)
+{
+    uint64_t start = histo_now();
+    int ret = mountv6_with_impl(filename, u, flags);
+
+    histo_record(HISTO_MOUNTV6, start);
+    return ret;
+}
+
 /**
  * @brief print to stdout the content of the superblock
  * @param u - the mounted filesytem
@@ -185,6 +791,76 @@ void mountv6_print_superblock(const struct unix_filesystem *u)
 
 }
 
+/**
+ * @brief write the modified inodes, then all the modified sectors of the
+ *        buffer cache, to the disk
+ * @param u - the mounted filesystem
+ * @return 0 on success; <0 on error
+ */
+int mountv6_sync(struct unix_filesystem *u)
+{
+    M_REQUIRE_NON_NULL(u);
+    M_REQUIRE_NON_NULL(u -> dev);
+
+    if (u -> icache != NULL) {
+        int err = inode_cache_flush(u);
+        if (err) {
+            return err;
+        }
+    }
+    if (u -> bm_on_disk) {
+        int err = mountv6_wait_bitmaps(u);
+        if (!err) {
+            err = bitmap_store(u, u -> ibm, u -> s.s_ibm_start);
+        }
+        if (!err) {
+            err = bitmap_store(u, u -> fbm, u -> s.s_fbm_start);
+        }
+        if (err) {
+            return err;
+        }
+    }
+    return sector_flush(u -> dev);
+}
+
+/**
+ * @brief give the free data sectors (according to the fbm) back to the
+ *        underlying filesystem, by punching holes in the virtual disk
+ * @param u - the mounted filesystem
+ * @return >=0: the number of sectors discarded; <0 on error
+ */
+int mountv6_trim(struct unix_filesystem *u)
+{
+    M_REQUIRE_NON_NULL(u);
+    M_REQUIRE_NON_NULL(u -> dev);
+
+    int discarded = 0;
+    int free_sector = mountv6_wait_bitmaps(u);
+    if (free_sector) {
+        return free_sector;
+    }
+    M_REQUIRE_NON_NULL(u -> fbm);
+
+    free_sector = bm_find_zero(u -> fbm, u -> fbm -> min);
+
+    while (free_sector >= 0) {
+        // une suite de secteurs libres devient un seul trou
+        const uint64_t x = (uint64_t) free_sector;
+        uint64_t end = x;
+        while (end <= u -> fbm -> max && bm_get(u -> fbm, end) == 0) {
+            ++end;
+        }
+        int err = sector_discard(u -> dev, (uint32_t) x, (uint32_t) (end - x));
+        if (err) {
+            return err;
+        }
+        discarded += (int) (end - x);
+        // les secteurs utilisés sont sautés par mots entiers
+        free_sector = bm_find_zero(u -> fbm, end + 1);
+    }
+    return discarded;
+}
+
 /**
  * @brief umount the given filesystem
  * @param u - the mounted filesystem
@@ -194,15 +870,46 @@ int umountv6(struct unix_filesystem *u)
 {
     M_REQUIRE_NON_NULL(u);
 
+    int err = 0;
+
+    // le thread de construction lit encore les bitmaps et le disque
+    if (u -> builder != NULL) {
+        bitmaps_join(u);
+    }
+
+    // les inodes et les bitmaps sont écrits, puis le superbloc est marqué propre
+    if (u -> dev != NULL && u -> bm_on_disk) {
+        err = mountv6_sync(u);
+        if (!err) {
+            err = superblock_mark(u, MOUNTV6_FMOD_CLEAN);
+        }
+        u -> bm_on_disk = 0;
+    }
+
     free(u -> ibm);
     free(u -> fbm);
+    inode_pool_free(u -> ipool);
+    u -> ibm = NULL;
+    u -> fbm = NULL;
+    u -> ipool = NULL;
 
-    if(fclose(u -> f) != 0) {
-        return ERR_IO;
+    if (u -> dev == NULL) {
+        inode_cache_free(u -> icache);
+        u -> icache = NULL;
+        return err;
     }
 
-    u -> f = NULL;
-    return 0;
+    // les inodes modifiés passent par le cache de secteurs avant sa fermeture
+    if (u -> icache != NULL) {
+        int err_flush = inode_cache_flush(u);
+        err = err ? err : err_flush;
+        inode_cache_free(u -> icache);
+        u -> icache = NULL;
+    }
+
+    int err_close = sector_close(u -> dev);
+    u -> dev = NULL;
+    return err ? err : err_close;
 }
 
 
@@ -222,43 +929,51 @@ int mountv6_mkfs(const char *filename, uint16_t num_blocks, uint16_t num_inodes)
     uint16_t s_fsize = num_blocks;	    /* size in sectors of entire volume */
     uint16_t s_isize = num_inodes/INODES_PER_SECTOR;    	/* size in sectors of the inodes */
 
-    if (num_blocks <= 2 + s_isize + num_inodes + 1) {
-        return ERR_NOT_ENOUGH_BLOCS;
-    }
-
-    //créer superblock
+    //créer superblock: les bitmaps, puis les inodes, puis les data
     struct superblock s;
     memset(&s, 0, SECTOR_SIZE);
     s.s_isize = s_isize;
     s.s_fsize = s_fsize;
-    s.s_inode_start = SUPERBLOCK_SECTOR + 1;
+    s.s_fbm_start = SUPERBLOCK_SECTOR + 1;
+    // borne supérieure: la fbm commence après les inodes
+    s.s_fbmsize = bitmap_sectors(0, s_fsize);
+    s.s_ibm_start = s.s_fbm_start + s.s_fbmsize;
+    s.s_ibmsize = (uint64_t) s_isize * INODES_PER_SECTOR > ROOT_INUMBER + 1
+                  ? bitmap_sectors(ROOT_INUMBER + 1, (uint64_t) s_isize * INODES_PER_SECTOR - 1) : 1;
+    s.s_inode_start = s.s_ibm_start + s.s_ibmsize;
     s.s_block_start = s.s_inode_start + s_isize + 1;
+    // les bitmaps vides sont déjà sur le disque (secteurs à zéro)
+    s.s_fmod = MOUNTV6_FMOD_CLEAN;
 
-    // créer un fichier binaire du bon nom et le remplr de zeros juqu'à la bonne taille
-    FILE* fichier = NULL;
-    fichier = fopen(filename, "wb");
-    if (fichier == NULL) {
-        return ERR_IO;
+    if ((uint32_t) num_blocks <= (uint32_t) s.s_block_start + num_inodes) {
+        return ERR_NOT_ENOUGH_BLOCS;
     }
 
-    // écrire le bootsector et le superblock
-    int err = fseek(fichier, 0, SEEK_SET);
+    // créer un fichier binaire du bon nom et le remplr de zeros juqu'à la bonne taille
+    struct sector_device* fichier = NULL;
+    int err = sector_open(&sector_fd_ops, filename, SECTOR_OPEN_CREATE, &fichier);
+    if (err) {
+        return err;
+    }
+    // fichier creux: les secteurs jamais écrits ne prennent pas de place
+    err = sector_resize(fichier, (uint32_t) s_fsize + 1);
     if (err) {
-        fclose(fichier);
+        sector_close(fichier);
         return err;
     }
 
+    // écrire le bootsector et le superblock
     uint8_t sector[SECTOR_SIZE];
     memset(sector, 0, SECTOR_SIZE);
     sector[BOOTBLOCK_MAGIC_NUM_OFFSET] = BOOTBLOCK_MAGIC_NUM;
     err = sector_write(fichier, 0, sector);
     if (err) {
-        fclose(fichier);
+        sector_close(fichier);
         return err;
     }
     err = sector_write(fichier, 1, &s);
     if (err) {
-        fclose(fichier);
+        sector_close(fichier);
         return err;
     }
 
@@ -276,30 +991,9 @@ int mountv6_mkfs(const char *filename, uint16_t num_blocks, uint16_t num_inodes)
 
     err = sector_write(fichier, s.s_inode_start, sect_inode);
     if (err) {
-        fclose(fichier);
+        sector_close(fichier);
         return err;
     }
 
-    memset(sector,0,SECTOR_SIZE);
-    // faire une boucle sur tous les secteurs des inodes
-    for (uint16_t i = s.s_inode_start+1; i < s.s_block_start; ++i) {
-        err = sector_write(fichier, i, sector);
-        if (err) {
-            fclose(fichier);
-            return err;
-        }
-    }
-
-    // faire une boucle sur tous les secteurs des data
-    for (uint16_t i = s.s_block_start; i <= s_fsize; ++i) {
-        err = sector_write(fichier, i, sector);
-        if (err) {
-            fclose(fichier);
-            return err;
-        }
-    }
-
-    fclose(fichier);
-
-    return 0;
+    return sector_close(fichier);
 }
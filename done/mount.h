@@ -11,16 +11,45 @@
 #include <stdio.h>
 #include "unixv6fs.h"
 #include "bmblock.h"
+#include "sector.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/* flags for mountv6_with() */
+#define MOUNTV6_MMAP 0x1   /* map the whole disk in memory: zero-copy reads */
+#define MOUNTV6_URING 0x2  /* asynchronous I/O with io_uring (synchronous if unavailable) */
+#define MOUNTV6_RDONLY 0x4 /* read-only: nothing is written and the bitmaps are not built */
+#define MOUNTV6_LAZY 0x8   /* the bitmaps are built by a background thread, see mountv6_wait_bitmaps() */
+
+/* size of the buffer cache set up by mountv6_with(), in sectors
+ * (change it with sector_cache_setup(u->dev, ...) once mounted) */
+#define MOUNTV6_CACHE_SECTORS 1024
+
+/* number of inodes kept in memory by a mounted filesystem */
+#define MOUNTV6_CACHE_INODES 256
+
+/* values of s_fmod when the bitmaps are kept in their regions of the disk
+ * (s_fbm_start, s_ibm_start), as mountv6_mkfs() sets it up; with any other
+ * value (older disks) the bitmaps are rebuilt from the inodes at each mount */
+#define MOUNTV6_FMOD_DIRTY 1   /* mounted, or not unmounted cleanly: the bitmaps on the disk may be stale */
+#define MOUNTV6_FMOD_CLEAN 2   /* unmounted cleanly: the bitmaps on the disk are up to date */
+
+struct inode_cache;
+struct inode_pool;
+struct bm_builder;
+
 struct unix_filesystem {
-    FILE *f;
+    struct sector_device *dev;     /* the opened virtual disk */
+    int flags;                     /* MOUNTV6_* flags given at mount time */
     struct superblock s;           /* copy of the superblock */
     struct bmblock_array *fbm;     /* block bitmmap -- ignore before WEEK 10 */
     struct bmblock_array *ibm;     /* inode bitmap  -- ignore before WEEK 10 */
+    struct inode_cache *icache;    /* in-core inodes, NULL if none */
+    struct inode_pool *ipool;      /* free inodes ready to allocate, NULL if none */
+    int bm_on_disk;                /* the bitmaps are written back to the disk (MOUNTV6_FMOD_*) */
+    struct bm_builder *builder;    /* background build of the bitmaps (MOUNTV6_LAZY), NULL if none */
 };
 
 
@@ -44,6 +73,25 @@ void fill_fbm(struct unix_filesystem * u);
  */
 int mountv6(const char *filename, struct unix_filesystem *u);
 
+/**
+ * @brief  mount a unix v6 filesystem with the given options
+ * @param filename name of the unixv6 filesystem on the underlying disk (IN)
+ * @param u the filesystem (OUT)
+ * @param flags MOUNTV6_* flags
+ * @return 0 on success; <0 on error
+ */
+int mountv6_with(const char *filename, struct unix_filesystem *u, int flags);
+
+/**
+ * @brief wait until the bitmaps of u can be used: with MOUNTV6_LAZY, until
+ *        the background thread has built them; at once otherwise. Every
+ *        function that reads or changes u->fbm or u->ibm calls it first.
+ * @param u - the mounted filesytem
+ * @return 0 on success; ERR_IO if u is mounted MOUNTV6_RDONLY (it has no
+ *         bitmaps)
+ */
+int mountv6_wait_bitmaps(struct unix_filesystem *u);
+
 /**
  * @brief print to stdout the content of the superblock
  * @param u - the mounted filesytem
@@ -51,7 +99,25 @@ int mountv6(const char *filename, struct unix_filesystem *u);
 void mountv6_print_superblock(const struct unix_filesystem *u);
 
 /**
- * @brief umount the given filesystem
+ * @brief write the modified inodes, the bitmaps if they are kept on the
+ *        disk, then all the modified sectors of the buffer cache, to the disk
+ * @param u - the mounted filesytem
+ * @return 0 on success; <0 on error
+ */
+int mountv6_sync(struct unix_filesystem *u);
+
+/**
+ * @brief give the free data sectors (according to the fbm) back to the
+ *        underlying filesystem: they are discarded (see sector_discard())
+ *        and become holes of the virtual disk
+ * @param u - the mounted filesytem
+ * @return >=0: the number of sectors discarded; <0 on error
+ */
+int mountv6_trim(struct unix_filesystem *u);
+
+/**
+ * @brief umount the given filesystem; when the bitmaps are kept on the
+ *        disk, they are written and the superblock is marked clean
  * @param u - the mounted filesytem
  * @return 0 on success; <0 on error
  */
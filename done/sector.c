@@ -9,46 +9,697 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
 #include "error.h"
 #include "unixv6fs.h"
+#include "sector.h"
+#include "sector_cache.h"
+
+// nombre maximal de requêtes en vol pour sector_readv()
+#define READV_MAX_REQS 32
+
+static const char * const class_names[SECTOR_NB_CLASSES] = {
+    "other", "superblock", "inode", "indirect", "dirdata", "filedata", "bitmap"
+};
+
+/**
+ * @brief count count sectors read in the current class of dev
+ * @param dev the device
+ * @param count the number of sectors read
+ * @param hits how many of them were served from memory
+ */
+static void count_reads(struct sector_device *dev, uint32_t count, uint32_t hits)
+{
+    struct sector_class_stats *st = &(dev -> stats.classes[dev -> io_class]);
+
+    st -> reads += count;
+    st -> hits += hits;
+    st -> misses += count - hits;
+    st -> bytes_read += (uint64_t) count * SECTOR_SIZE;
+}
+
+/**
+ * @brief count count sectors written in the current class of dev
+ */
+static void count_writes(struct sector_device *dev, uint32_t count)
+{
+    struct sector_class_stats *st = &(dev -> stats.classes[dev -> io_class]);
+
+    st -> writes += count;
+    st -> bytes_written += (uint64_t) count * SECTOR_SIZE;
+}
+
+/**
+ * @brief open a virtual disk with the given backend
+ * @param ops the backend to use (NULL for the default one)
+ * @param filename the name of the virtual disk on the underlying filesystem
+ * @param flags SECTOR_OPEN_* flags
+ * @param dev the opened device (OUT)
+ * @return 0 on success; <0 on error
+ */
+int sector_open(const struct sector_ops *ops, const char *filename, int flags, struct sector_device **dev)
+{
+    M_REQUIRE_NON_NULL(filename);
+    M_REQUIRE_NON_NULL(dev);
+
+    struct sector_device *d = NULL;
+    int err = 0;
+
+    *dev = NULL;
+    if (ops == NULL) {
+        ops = &sector_fd_ops;
+    }
+
+    d = calloc(1, sizeof(struct sector_device));
+    if (d == NULL) {
+        return ERR_NOMEM;
+    }
+    d -> ops = ops;
+    d -> fd = -1;
+    d -> flags = flags;
+    d -> filename = malloc(strlen(filename) + 1);
+    if (d -> filename == NULL) {
+        free(d);
+        return ERR_NOMEM;
+    }
+    strcpy(d -> filename, filename);
+
+    err = ops -> open(d, filename, flags);
+    if (err) {
+        free(d -> filename);
+        free(d);
+        return err;
+    }
+
+    *dev = d;
+    return 0;
+}
+
+/**
+ * @brief open the virtual disk of dev again, with the same backend: the
+ *        copy has its own file descriptor and no buffer cache, it can be
+ *        used by another thread than dev
+ * @param dev the opened device
+ * @param flags SECTOR_OPEN_* flags (SECTOR_OPEN_CREATE is ignored)
+ * @param copy the new device (OUT)
+ * @return 0 on success; <0 on error
+ */
+int sector_reopen(const struct sector_device *dev, int flags, struct sector_device **copy)
+{
+    M_REQUIRE_NON_NULL(dev);
+
+    // recréer le disque effacerait son contenu
+    return sector_open(dev -> ops, dev -> filename, flags & ~SECTOR_OPEN_CREATE, copy);
+}
+
+/**
+ * @brief flush and close a virtual disk; dev is freed
+ * @param dev the device to close
+ * @return 0 on success; <0 on error
+ */
+int sector_close(struct sector_device *dev)
+{
+    M_REQUIRE_NON_NULL(dev);
+
+    int err = sector_flush(dev);
+    int err_close = 0;
+
+    // les préchargements en vol écrivent dans le cache
+    if (dev -> ops -> complete != NULL) {
+        dev -> ops -> complete(dev);
+    }
+    err_close = dev -> ops -> close(dev);
+
+    sector_cache_free(dev -> cache);
+    free(dev -> filename);
+    free(dev);
+    return err ? err : err_close;
+}
+
+/**
+ * @brief write the dirty cached sectors, then ask the backend to push all
+ *        pending writes to the virtual disk
+ * @param dev the device
+ * @return 0 on success; <0 on error
+ */
+int sector_flush(struct sector_device *dev)
+{
+    M_REQUIRE_NON_NULL(dev);
+
+    if (dev -> cache != NULL) {
+        int err = sector_cache_flush(dev);
+        if (err) {
+            return err;
+        }
+    }
+    if (dev -> ops -> flush == NULL) {
+        return 0;
+    }
+    return dev -> ops -> flush(dev);
+}
+
+/**
+ * @brief put a buffer cache of nb_sectors sectors in front of the backend,
+ *        replacing the current one (which is flushed first).
+ * @param dev the device
+ * @param nb_sectors the size of the cache, in sectors (0: no cache)
+ * @return 0 on success; <0 on error
+ */
+int sector_cache_setup(struct sector_device *dev, size_t nb_sectors)
+{
+    M_REQUIRE_NON_NULL(dev);
+
+    struct sector_cache *cache = NULL;
+
+    // le disque est déjà en mémoire: un cache ne ferait que des copies
+    if (dev -> ops -> map != NULL) {
+        return 0;
+    }
+
+    if (nb_sectors > 0) {
+        cache = sector_cache_alloc(nb_sectors);
+        if (cache == NULL) {
+            return ERR_NOMEM;
+        }
+    }
+
+    if (dev -> cache != NULL) {
+        int err = sector_cache_flush(dev);
+        if (!err && dev -> ops -> complete != NULL) {
+            err = dev -> ops -> complete(dev);
+        }
+        if (err) {
+            sector_cache_free(cache);
+            return err;
+        }
+        sector_cache_free(dev -> cache);
+    }
+    dev -> cache = cache;
+    return 0;
+}
 
 /**
  * @brief read one 512-byte sector from the virtual disk
- * @param f open file of the virtual disk
+ * @param dev the opened virtual disk
  * @param sector the location (in sector units, not bytes) within the virtual disk
  * @param data a pointer to 512-bytes of memory (OUT)
  * @return 0 on success; <0 on error
  */
-int sector_read(FILE *f, uint32_t sector, void *data)
+int sector_read(struct sector_device *dev, uint32_t sector, void *data)
 {
-    M_REQUIRE_NON_NULL(f);
-    if (fseek(f, sector * SECTOR_SIZE, SEEK_SET) == -1) {
-        return ERR_IO;
+    M_REQUIRE_NON_NULL(dev);
+    M_REQUIRE_NON_NULL(data);
+
+    int hit = 0;
+    int err = 0;
+
+    if (dev -> cache != NULL) {
+        err = sector_cache_read(dev, sector, data, &hit);
+    } else {
+        err = dev -> ops -> read(dev, sector, data);
+    }
+    if (!err) {
+        count_reads(dev, 1, (uint32_t) hit);
+    }
+    return err;
+}
+
+/**
+ * @brief read one 512-byte sector without copying it when the backend
+ *        can map it in memory.
+ * @param dev the opened virtual disk
+ * @param sector the location (in sector units, not bytes) within the virtual disk
+ * @param buf a pointer to 512-bytes of memory, used only if the backend
+ *        cannot map the sector (OUT)
+ * @param data set to the address of the content of the sector (OUT)
+ * @return 0 on success; <0 on error
+ */
+int sector_read_ref(struct sector_device *dev, uint32_t sector, void *buf, const void **data)
+{
+    M_REQUIRE_NON_NULL(dev);
+    M_REQUIRE_NON_NULL(buf);
+    M_REQUIRE_NON_NULL(data);
+
+    if (dev -> ops -> map != NULL) {
+        *data = dev -> ops -> map(dev, sector);
+        if (*data != NULL) {
+            count_reads(dev, 1, 1);
+            return 0;
+        }
+    }
+
+    *data = buf;
+    return sector_read(dev, sector, buf);
+}
+
+/**
+ * @brief sector_read_range() without the statistics
+ */
+static int range_read(struct sector_device *dev, uint32_t first, uint32_t count, void *data)
+{
+    uint8_t *ptr = data;
+    int err = 0;
+
+    // les secteurs modifiés dans le cache doivent d'abord atteindre le disque
+    if (dev -> cache != NULL) {
+        err = sector_cache_writeback(dev, first, count);
+        if (err) {
+            return err;
+        }
+    }
+
+    if (dev -> ops -> read_range != NULL) {
+        return dev -> ops -> read_range(dev, first, count, data);
     }
-    if (fread(data, SECTOR_SIZE, 1, f) != 1) {
+
+    for (uint32_t i = 0; i < count && !err; ++i) {
+        err = dev -> ops -> read(dev, first + i, ptr + (size_t) i * SECTOR_SIZE);
+    }
+    return err;
+}
+
+/**
+ * @brief read count contiguous sectors from the virtual disk, with a
+ *        single I/O when the backend supports it
+ * @param dev the opened virtual disk
+ * @param first the first sector to read
+ * @param count the number of sectors to read
+ * @param data a pointer to count*512 bytes of memory (OUT)
+ * @return 0 on success; <0 on error
+ */
+int sector_read_range(struct sector_device *dev, uint32_t first, uint32_t count, void *data)
+{
+    M_REQUIRE_NON_NULL(dev);
+    M_REQUIRE_NON_NULL(data);
+
+    int err = range_read(dev, first, count, data);
+    if (!err) {
+        count_reads(dev, count, 0);
+    }
+    return err;
+}
+
+/**
+ * @brief read a list of sectors into consecutive 512-byte slots of data.
+ *        Runs of contiguous sectors in the list are read with one
+ *        sector_read_range() each.
+ * @param dev the opened virtual disk
+ * @param sectors the sectors to read, in the order they must be stored
+ * @param count the number of sectors in the list
+ * @param data a pointer to count*512 bytes of memory (OUT)
+ * @return 0 on success; <0 on error
+ */
+int sector_readv(struct sector_device *dev, const uint32_t *sectors, size_t count, void *data)
+{
+    M_REQUIRE_NON_NULL(dev);
+    M_REQUIRE_NON_NULL(sectors);
+    M_REQUIRE_NON_NULL(data);
+
+    uint8_t *ptr = data;
+    struct sector_req reqs[READV_MAX_REQS];
+    size_t nb_reqs = 0;
+    size_t i = 0;
+    int err = 0;
+
+    while (i < count && !err) {
+        // longueur de la suite de secteurs contigus
+        size_t run = 1;
+        while (i + run < count && sectors[i + run] == sectors[i] + run) {
+            ++run;
+        }
+
+        reqs[nb_reqs].sector = sectors[i];
+        reqs[nb_reqs].count = (uint32_t) run;
+        reqs[nb_reqs].data = ptr + i * SECTOR_SIZE;
+        reqs[nb_reqs].write = 0;
+        err = sector_submit(dev, &reqs[nb_reqs]);
+        ++nb_reqs;
+        i += run;
+
+        // toutes les suites sont en vol en même temps, par paquets de READV_MAX_REQS
+        if (nb_reqs == READV_MAX_REQS || i >= count || err) {
+            int err_wait = sector_complete(dev);
+            for (size_t k = 0; k < nb_reqs && !err; ++k) {
+                err = reqs[k].result;
+            }
+            if (!err) {
+                err = err_wait;
+            }
+            nb_reqs = 0;
+        }
+    }
+    return err;
+}
+
+/**
+ * @brief queue an asynchronous read or write. With a backend that has no
+ *        asynchronous support, the request is done before returning.
+ * @param dev the opened virtual disk
+ * @param req the request; it must stay valid until it has completed
+ * @return 0 if the request was queued; <0 on error
+ */
+int sector_submit(struct sector_device *dev, struct sector_req *req)
+{
+    M_REQUIRE_NON_NULL(dev);
+    M_REQUIRE_NON_NULL(req);
+    M_REQUIRE_NON_NULL(req -> data);
+
+    const uint8_t *ptr = req -> data;
+    int err = 0;
+
+    if (req -> write && (dev -> flags & SECTOR_OPEN_RDONLY)) {
+        req -> result = ERR_IO;
         return ERR_IO;
     }
+
+    if (dev -> cache != NULL && req -> write) {
+        // en asynchrone, le résultat n'est connu qu'après sector_complete(): les
+        // copies en cache (même modifiées, l'écriture les remplace) sont oubliées;
+        // sinon elles sont rafraîchies plus bas, une fois l'écriture réussie
+        if (dev -> ops -> submit != NULL) {
+            sector_cache_discard(dev, req -> sector, req -> count);
+        }
+    } else if (dev -> cache != NULL) {
+        if (sector_cache_lookup(dev, req -> sector, req -> count, req -> data)) {
+            // suite entièrement en cache (lue d'avance par exemple): pas d'I/O
+            count_reads(dev, req -> count, req -> count);
+            req -> result = 0;
+            return 0;
+        } else {
+            // une lecture en vol doit voir les secteurs modifiés dans le cache
+            err = sector_cache_writeback(dev, req -> sector, req -> count);
+            if (err) {
+                req -> result = err;
+                return err;
+            }
+        }
+    }
+
+    // comptée à la soumission: le résultat n'est connu qu'après sector_complete()
+    if (req -> write) {
+        count_writes(dev, req -> count);
+    } else {
+        count_reads(dev, req -> count, 0);
+    }
+
+    req -> result = SECTOR_REQ_PENDING;
+    if (dev -> ops -> submit != NULL) {
+        err = dev -> ops -> submit(dev, req);
+        if (err) {
+            req -> result = err;
+        }
+        return err;
+    }
+
+    // pas d'I/O asynchrone: on fait la requête tout de suite
+    if (req -> write && dev -> ops -> write_range != NULL) {
+        err = dev -> ops -> write_range(dev, req -> sector, req -> count, req -> data);
+    } else if (req -> write) {
+        for (uint32_t i = 0; i < req -> count && !err; ++i) {
+            err = dev -> ops -> write(dev, req -> sector + i, ptr + (size_t) i * SECTOR_SIZE);
+        }
+    } else {
+        err = range_read(dev, req -> sector, req -> count, req -> data);
+    }
+    if (!err && req -> write && dev -> cache != NULL) {
+        sector_cache_update(dev, req -> sector, req -> count, req -> data);
+    }
+    req -> result = err;
+    return 0;
+}
+
+/**
+ * @brief wait for all the requests given to sector_submit() to complete
+ * @param dev the opened virtual disk
+ * @return 0 on success; <0 on error
+ */
+int sector_complete(struct sector_device *dev)
+{
+    M_REQUIRE_NON_NULL(dev);
+
+    if (dev -> ops -> complete == NULL) {
+        return 0;
+    }
+    return dev -> ops -> complete(dev);
+}
+
+/**
+ * @brief hint that the given sectors will be read soon: they are loaded in
+ *        the buffer cache, asynchronously when the backend supports it.
+ * @param dev the opened virtual disk
+ * @param sectors the sectors that will be read
+ * @param count the number of sectors in the list
+ * @return 0 on success; <0 on error
+ */
+int sector_prefetch(struct sector_device *dev, const uint32_t *sectors, size_t count)
+{
+    M_REQUIRE_NON_NULL(dev);
+    M_REQUIRE_NON_NULL(sectors);
+
+    int loaded = 0;
+
+    if (dev -> cache == NULL) {
+        return 0;
+    }
+    loaded = sector_cache_prefetch(dev, sectors, count);
+    if (loaded < 0) {
+        return loaded;
+    }
+    dev -> stats.classes[dev -> io_class].prefetched += (uint64_t) loaded;
     return 0;
 }
 
 /**
  * @brief write one 512-byte sector from the virtual disk
- * @param f open file of the virtual disk
+ * @param dev the opened virtual disk
  * @param sector the location (in sector units, not bytes) within the virtual disk
  * @param data a pointer to 512-bytes of memory (IN)
  * @return 0 on success; <0 on error
  */
-int sector_write(FILE *f, uint32_t sector, const void  *data)
+int sector_write(struct sector_device *dev, uint32_t sector, const void  *data)
 {
-    M_REQUIRE_NON_NULL(f);
+    M_REQUIRE_NON_NULL(dev);
     M_REQUIRE_NON_NULL(data);
 
-    if (fseek(f, sector * SECTOR_SIZE, SEEK_SET) == -1) {
+    if (dev -> flags & SECTOR_OPEN_RDONLY) {
         return ERR_IO;
     }
-    if (fwrite(data, SECTOR_SIZE, 1, f) != 1) {
+    int err = 0;
+
+    if (dev -> cache != NULL) {
+        err = sector_cache_write(dev, sector, data);
+    } else {
+        err = dev -> ops -> write(dev, sector, data);
+    }
+    if (!err) {
+        count_writes(dev, 1);
+    }
+    return err;
+}
+
+/**
+ * @brief write count contiguous sectors from data, with a single I/O when
+ *        the backend supports it; cached copies of the sectors are refreshed
+ *        once the write has succeeded (dropped with an asynchronous backend)
+ * @param dev the opened virtual disk
+ * @param first the first sector to write
+ * @param count the number of sectors to write
+ * @param data a pointer to count*512 bytes of memory (IN)
+ * @return 0 on success; <0 on error
+ */
+int sector_write_range(struct sector_device *dev, uint32_t first, uint32_t count, const void *data)
+{
+    M_REQUIRE_NON_NULL(dev);
+    M_REQUIRE_NON_NULL(data);
+
+    struct sector_req req;
+    int err = 0;
+
+    req.sector = first;
+    req.count = count;
+    req.data = (void *) data;  // seulement lu pour une écriture
+    req.write = 1;
+    err = sector_submit(dev, &req);
+    if (err) {
+        return err;
+    }
+    err = sector_complete(dev);
+    return req.result != 0 ? req.result : err;
+}
+
+/**
+ * @brief set the size of the virtual disk to nb_sectors sectors; the new
+ *        sectors read as zeros
+ * @param dev the opened virtual disk
+ * @param nb_sectors the new size, in sectors
+ * @return 0 on success; <0 on error
+ */
+int sector_resize(struct sector_device *dev, uint32_t nb_sectors)
+{
+    M_REQUIRE_NON_NULL(dev);
+
+    uint8_t zeros[SECTOR_SIZE];
+
+    if (dev -> flags & SECTOR_OPEN_RDONLY) {
         return ERR_IO;
     }
+    if (dev -> ops -> resize != NULL) {
+        return dev -> ops -> resize(dev, nb_sectors);
+    }
+    if (nb_sectors == 0) {
+        return 0;
+    }
 
-    return 0;
+    // sans support du backend: écrire le dernier secteur agrandit le disque
+    memset(zeros, 0, SECTOR_SIZE);
+    return dev -> ops -> write(dev, nb_sectors - 1, zeros);
+}
+
+/**
+ * @brief tell that count sectors from first are no longer used: they read
+ *        as zeros afterwards, and their storage is given back when the
+ *        backend can
+ * @param dev the opened virtual disk
+ * @param first the first sector
+ * @param count the number of sectors
+ * @return 0 on success; <0 on error
+ */
+int sector_discard(struct sector_device *dev, uint32_t first, uint32_t count)
+{
+    M_REQUIRE_NON_NULL(dev);
+
+    uint8_t zeros[SECTOR_SIZE];
+    int err = 0;
+
+    if (dev -> flags & SECTOR_OPEN_RDONLY) {
+        return ERR_IO;
+    }
+    if (count == 0) {
+        return 0;
+    }
+
+    // les copies en cache ne doivent pas être réécrites par-dessus les trous
+    if (dev -> cache != NULL) {
+        sector_cache_discard(dev, first, count);
+    }
+    // une écriture en vol sur ces secteurs doit être terminée avant
+    err = sector_complete(dev);
+    if (err) {
+        return err;
+    }
+
+    if (dev -> ops -> discard != NULL) {
+        return dev -> ops -> discard(dev, first, count);
+    }
+
+    memset(zeros, 0, SECTOR_SIZE);
+    for (uint32_t i = 0; i < count && !err; ++i) {
+        err = dev -> ops -> write(dev, first + i, zeros);
+    }
+    return err;
+}
+
+/**
+ * @brief count the next accesses to dev in the given class
+ * @param dev the opened virtual disk
+ * @param cls the new class
+ * @return the previous class
+ */
+enum sector_class sector_set_class(struct sector_device *dev, enum sector_class cls)
+{
+    enum sector_class prev = SECTOR_CLASS_OTHER;
+
+    if (dev == NULL) {
+        return prev;
+    }
+    prev = dev -> io_class;
+    if (cls >= SECTOR_CLASS_OTHER && cls < SECTOR_NB_CLASSES) {
+        dev -> io_class = cls;
+    }
+    return prev;
+}
+
+/**
+ * @brief the name of a class, as printed by sector_stats_print()
+ * @param cls the class
+ * @return a constant string
+ */
+const char *sector_class_name(enum sector_class cls)
+{
+    if (cls < SECTOR_CLASS_OTHER || cls >= SECTOR_NB_CLASSES) {
+        return "?";
+    }
+    return class_names[cls];
+}
+
+/**
+ * @brief reset the I/O statistics of dev
+ * @param dev the opened virtual disk
+ */
+void sector_stats_reset(struct sector_device *dev)
+{
+    if (dev != NULL) {
+        memset(&(dev -> stats), 0, sizeof(struct sector_stats));
+    }
+}
+
+/**
+ * @brief add the I/O statistics of another device to those of dev (the
+ *        accesses made through a copy from sector_reopen(), for instance)
+ * @param dev the opened virtual disk
+ * @param from the device whose statistics are added
+ */
+void sector_stats_add(struct sector_device *dev, const struct sector_device *from)
+{
+    if (dev == NULL || from == NULL) {
+        return;
+    }
+    for (int c = 0; c < SECTOR_NB_CLASSES; ++c) {
+        struct sector_class_stats *st = &(dev -> stats.classes[c]);
+        const struct sector_class_stats *add = &(from -> stats.classes[c]);
+        st -> reads += add -> reads;
+        st -> hits += add -> hits;
+        st -> misses += add -> misses;
+        st -> prefetched += add -> prefetched;
+        st -> writes += add -> writes;
+        st -> bytes_read += add -> bytes_read;
+        st -> bytes_written += add -> bytes_written;
+    }
+}
+
+/**
+ * @brief print the I/O statistics of dev, one line per class and the total
+ * @param output the stream to print to
+ * @param dev the opened virtual disk
+ */
+void sector_stats_print(FILE *output, const struct sector_device *dev)
+{
+    struct sector_class_stats total;
+
+    if (output == NULL || dev == NULL) {
+        return;
+    }
+    memset(&total, 0, sizeof(total));
+
+    fprintf(output, "%-10s %10s %10s %10s %10s %10s %12s %12s\n", "class", "reads", "hits",
+            "misses", "prefetch", "writes", "bytes read", "bytes write");
+    for (int c = 0; c <= SECTOR_NB_CLASSES; ++c) {
+        const struct sector_class_stats *st = &total;
+        if (c < SECTOR_NB_CLASSES) {
+            st = &(dev -> stats.classes[c]);
+            total.reads += st -> reads;
+            total.hits += st -> hits;
+            total.misses += st -> misses;
+            total.prefetched += st -> prefetched;
+            total.writes += st -> writes;
+            total.bytes_read += st -> bytes_read;
+            total.bytes_written += st -> bytes_written;
+        }
+        fprintf(output, "%-10s %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64
+                " %12" PRIu64 " %12" PRIu64 "\n", c < SECTOR_NB_CLASSES ? class_names[c] : "total",
+                st -> reads, st -> hits, st -> misses, st -> prefetched, st -> writes,
+                st -> bytes_read, st -> bytes_written);
+    }
 }
@@ -4,10 +4,24 @@
  * @file  sector.h
  * @brief block-level accessor function.
  *
+ * All the accesses to the virtual disk go through a struct sector_device,
+ * which holds a table of backend operations (open/read/write/flush/close).
+ * The default backend (sector_fd_ops) uses positional I/O (pread/pwrite)
+ * on a plain file descriptor; sector_mmap_ops maps the whole virtual disk
+ * in memory and can hand out pointers to the sectors (see sector_read_ref());
+ * sector_uring_ops keeps many requests in flight with io_uring
+ * (see sector_submit()).
+ *
+ * A write-back buffer cache can be put in front of the backend (see
+ * sector_cache_setup()): sector_read() and sector_write() then work on
+ * cached copies, and dirty sectors are written at eviction time and by
+ * sector_flush().
+ *
  * @author Edouard Bugnion
  * @date summer 2016
  */
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 
@@ -15,29 +29,319 @@
 extern "C" {
 #endif
 
+/* flags for sector_open() */
+#define SECTOR_OPEN_RDONLY 0x1  /* open the virtual disk read-only */
+#define SECTOR_OPEN_CREATE 0x2  /* create (or truncate) the virtual disk */
+
+struct sector_device;
+struct sector_cache;
+
+/**
+ * @brief the part of the filesystem a sector access is made for; the
+ *        accesses are counted per class (see sector_set_class())
+ */
+enum sector_class {
+    SECTOR_CLASS_OTHER = 0,
+    SECTOR_CLASS_SUPERBLOCK,   /* boot sector and superblock */
+    SECTOR_CLASS_INODE,        /* inode table */
+    SECTOR_CLASS_INDIRECT,     /* sectors of addresses of large files */
+    SECTOR_CLASS_DIRDATA,      /* content of directories */
+    SECTOR_CLASS_FILEDATA,     /* content of regular files */
+    SECTOR_CLASS_BITMAP,       /* free-sector and inode bitmaps kept on the disk */
+    SECTOR_NB_CLASSES
+};
+
+/**
+ * @brief counters of the accesses of one class, in sectors (or bytes)
+ */
+struct sector_class_stats {
+    uint64_t reads;            /* sectors read by the callers */
+    uint64_t hits;             /* reads served from memory (cache or mapping) */
+    uint64_t misses;           /* reads that went to the backend */
+    uint64_t prefetched;       /* sectors loaded in the cache ahead of the reads */
+    uint64_t writes;           /* sectors written by the callers */
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+};
+
+/**
+ * @brief I/O statistics of a device
+ */
+struct sector_stats {
+    struct sector_class_stats classes[SECTOR_NB_CLASSES];
+};
+
+/* value of sector_req.result while the request is in flight */
+#define SECTOR_REQ_PENDING 1
+
+/**
+ * @brief an asynchronous request, see sector_submit()
+ */
+struct sector_req {
+    uint32_t sector;   /* first sector */
+    uint32_t count;    /* number of contiguous sectors */
+    void *data;        /* count*512 bytes of memory */
+    int write;         /* 0: read the sectors into data; 1: write data to them */
+    int result;        /* SECTOR_REQ_PENDING, then 0 on success or <0 on error (OUT) */
+};
+
+/**
+ * @brief operations implemented by a block-device backend
+ */
+struct sector_ops {
+    const char *name;    /* name of the backend (for debugging purposes) */
+    int (*open)(struct sector_device *dev, const char *filename, int flags);
+    int (*read)(struct sector_device *dev, uint32_t sector, void *data);
+    int (*write)(struct sector_device *dev, uint32_t sector, const void *data);
+    int (*flush)(struct sector_device *dev);
+    int (*close)(struct sector_device *dev);
+    /* optional: address of the sector in memory, NULL if not available */
+    const void *(*map)(struct sector_device *dev, uint32_t sector);
+    /* optional: read/write count contiguous sectors in a single I/O */
+    int (*read_range)(struct sector_device *dev, uint32_t first, uint32_t count, void *data);
+    int (*write_range)(struct sector_device *dev, uint32_t first, uint32_t count, const void *data);
+    /* optional: queue an asynchronous request / wait for all of them */
+    int (*submit)(struct sector_device *dev, struct sector_req *req);
+    int (*complete)(struct sector_device *dev);
+    /* optional: set the size of the virtual disk / free the storage of sectors */
+    int (*resize)(struct sector_device *dev, uint32_t nb_sectors);
+    int (*discard)(struct sector_device *dev, uint32_t first, uint32_t count);
+};
+
+/**
+ * @brief an opened virtual disk
+ */
+struct sector_device {
+    const struct sector_ops *ops;  /* the backend */
+    int fd;                        /* file descriptor of the virtual disk */
+    int flags;                     /* SECTOR_OPEN_* flags given at open time */
+    char *filename;                /* name given at open time, see sector_reopen() */
+    void *priv;                    /* backend private data */
+    struct sector_cache *cache;    /* buffer cache, NULL if none */
+    enum sector_class io_class;    /* class the next accesses are counted in */
+    struct sector_stats stats;     /* I/O statistics since open or the last reset */
+};
+
+/* default backend: pread/pwrite on a file descriptor */
+extern const struct sector_ops sector_fd_ops;
+
+/* the whole virtual disk is mmap()ed; reads can be zero-copy */
+extern const struct sector_ops sector_mmap_ops;
+
+/* io_uring: reads and writes are kept in flight; open fails with ERR_IO
+ * when the kernel does not support it, fall back to sector_fd_ops then */
+extern const struct sector_ops sector_uring_ops;
+
+/**
+ * @brief open a virtual disk with the given backend
+ * @param ops the backend to use (NULL for the default one)
+ * @param filename the name of the virtual disk on the underlying filesystem
+ * @param flags SECTOR_OPEN_* flags
+ * @param dev the opened device (OUT)
+ * @return 0 on success; <0 on error
+ */
+int sector_open(const struct sector_ops *ops, const char *filename, int flags, struct sector_device **dev);
+
+/**
+ * @brief open the virtual disk of dev again, with the same backend: the
+ *        copy has its own file descriptor and no buffer cache, it can be
+ *        used by another thread than dev
+ * @param dev the opened device
+ * @param flags SECTOR_OPEN_* flags (SECTOR_OPEN_CREATE is ignored)
+ * @param copy the new device (OUT)
+ * @return 0 on success; <0 on error
+ */
+int sector_reopen(const struct sector_device *dev, int flags, struct sector_device **copy);
+
+/**
+ * @brief flush and close a virtual disk; dev is freed
+ * @param dev the device to close
+ * @return 0 on success; <0 on error
+ */
+int sector_close(struct sector_device *dev);
+
+/**
+ * @brief write the dirty cached sectors, then ask the backend to push all
+ *        pending writes to the virtual disk
+ * @param dev the device
+ * @return 0 on success; <0 on error
+ */
+int sector_flush(struct sector_device *dev);
+
+/**
+ * @brief put a buffer cache of nb_sectors sectors in front of the backend,
+ *        replacing the current one (which is flushed first).
+ *        nb_sectors == 0 removes the cache. A backend that maps the disk
+ *        in memory (sector_mmap_ops) is its own cache: nothing is done.
+ * @param dev the device
+ * @param nb_sectors the size of the cache, in sectors
+ * @return 0 on success; <0 on error
+ */
+int sector_cache_setup(struct sector_device *dev, size_t nb_sectors);
+
 // Implemented WEEK 4
 /**
  * @brief read one 512-byte sector from the virtual disk
- * @param f open file of the virtual disk
+ * @param dev the opened virtual disk
  * @param sector the location (in sector units, not bytes) within the virtual disk
  * @param data a pointer to 512-bytes of memory (OUT)
  * @return 0 on success; <0 on error
  */
-int sector_read(FILE *f, uint32_t sector, void *data);
+int sector_read(struct sector_device *dev, uint32_t sector, void *data);
+
+/**
+ * @brief read one 512-byte sector without copying it when the backend
+ *        can map it in memory.
+ *        The returned pointer is valid until the next write to that
+ *        sector or until the device is closed.
+ * @param dev the opened virtual disk
+ * @param sector the location (in sector units, not bytes) within the virtual disk
+ * @param buf a pointer to 512-bytes of memory, used only if the backend
+ *        cannot map the sector (OUT)
+ * @param data set to the address of the content of the sector; either
+ *        inside the mapping or buf (OUT)
+ * @return 0 on success; <0 on error
+ */
+int sector_read_ref(struct sector_device *dev, uint32_t sector, void *buf, const void **data);
+
+/**
+ * @brief read count contiguous sectors from the virtual disk, with a
+ *        single I/O when the backend supports it
+ * @param dev the opened virtual disk
+ * @param first the first sector to read
+ * @param count the number of sectors to read
+ * @param data a pointer to count*512 bytes of memory (OUT)
+ * @return 0 on success; <0 on error
+ */
+int sector_read_range(struct sector_device *dev, uint32_t first, uint32_t count, void *data);
+
+/**
+ * @brief read a list of sectors into consecutive 512-byte slots of data.
+ *        Runs of contiguous sectors in the list are read with one
+ *        sector_read_range() each.
+ * @param dev the opened virtual disk
+ * @param sectors the sectors to read, in the order they must be stored
+ * @param count the number of sectors in the list
+ * @param data a pointer to count*512 bytes of memory (OUT)
+ * @return 0 on success; <0 on error
+ */
+int sector_readv(struct sector_device *dev, const uint32_t *sectors, size_t count, void *data);
+
+/**
+ * @brief queue an asynchronous read or write. With a backend that has no
+ *        asynchronous support, the request is done before returning.
+ *        Requests in flight are not ordered with respect to each other:
+ *        call sector_complete() before accessing the same sectors again.
+ * @param dev the opened virtual disk
+ * @param req the request; it must stay valid until it has completed
+ *        (req->result is set to SECTOR_REQ_PENDING, then to the result)
+ * @return 0 if the request was queued; <0 on error
+ */
+int sector_submit(struct sector_device *dev, struct sector_req *req);
+
+/**
+ * @brief wait for all the requests given to sector_submit() to complete
+ * @param dev the opened virtual disk
+ * @return 0 on success; <0 on error (the result of each request is in
+ *         its result field)
+ */
+int sector_complete(struct sector_device *dev);
+
+/**
+ * @brief hint that the given sectors will be read soon: they are loaded in
+ *        the buffer cache, asynchronously when the backend supports it.
+ *        They only take the cold quarter of the cache, whose entries are
+ *        reused first by later prefetches: metadata is not evicted.
+ *        Nothing is done if the device has no cache.
+ * @param dev the opened virtual disk
+ * @param sectors the sectors that will be read
+ * @param count the number of sectors in the list
+ * @return 0 on success; <0 on error
+ */
+int sector_prefetch(struct sector_device *dev, const uint32_t *sectors, size_t count);
+
+/**
+ * @brief count the next accesses to dev in the given class
+ * @param dev the opened virtual disk
+ * @param cls the new class
+ * @return the previous class, to be restored by the caller once its
+ *         accesses are done
+ */
+enum sector_class sector_set_class(struct sector_device *dev, enum sector_class cls);
 
+/**
+ * @brief the name of a class, as printed by sector_stats_print()
+ * @param cls the class
+ * @return a constant string
+ */
+const char *sector_class_name(enum sector_class cls);
+
+/**
+ * @brief reset the I/O statistics of dev
+ * @param dev the opened virtual disk
+ */
+void sector_stats_reset(struct sector_device *dev);
+
+/**
+ * @brief add the I/O statistics of another device to those of dev (the
+ *        accesses made through a copy from sector_reopen(), for instance)
+ * @param dev the opened virtual disk
+ * @param from the device whose statistics are added
+ */
+void sector_stats_add(struct sector_device *dev, const struct sector_device *from);
+
+/**
+ * @brief print the I/O statistics of dev, one line per class and the total
+ * @param output the stream to print to
+ * @param dev the opened virtual disk
+ */
+void sector_stats_print(FILE *output, const struct sector_device *dev);
 
 // Implemented WEEK 11
 /**
  * @brief write one 512-byte sector from the virtual disk
- * @param f open file of the virtual disk
+ * @param dev the opened virtual disk
  * @param sector the location (in sector units, not bytes) within the virtual disk
  * @param data a pointer to 512-bytes of memory (IN)
  * @return 0 on success; <0 on error
  */
-int sector_write(FILE *f, uint32_t sector, const void *data);
+int sector_write(struct sector_device *dev, uint32_t sector, const void *data);
+
+/**
+ * @brief write count contiguous sectors from data, with a single I/O when
+ *        the backend supports it; cached copies of the sectors are refreshed
+ *        once the write has succeeded (dropped with an asynchronous backend)
+ * @param dev the opened virtual disk
+ * @param first the first sector to write
+ * @param count the number of sectors to write
+ * @param data a pointer to count*512 bytes of memory (IN)
+ * @return 0 on success; <0 on error
+ */
+int sector_write_range(struct sector_device *dev, uint32_t first, uint32_t count, const void *data);
+
+/**
+ * @brief set the size of the virtual disk to nb_sectors sectors. The new
+ *        sectors read as zeros; with sector_fd_ops they take no space on
+ *        the underlying filesystem (sparse file).
+ * @param dev the opened virtual disk
+ * @param nb_sectors the new size, in sectors
+ * @return 0 on success; <0 on error
+ */
+int sector_resize(struct sector_device *dev, uint32_t nb_sectors);
+
+/**
+ * @brief tell that count sectors from first are no longer used: they read
+ *        as zeros afterwards, and their storage is given back to the
+ *        underlying filesystem when the backend can (hole punching).
+ *        Their cached copies, even dirty, are dropped.
+ * @param dev the opened virtual disk
+ * @param first the first sector
+ * @param count the number of sectors
+ * @return 0 on success; <0 on error
+ */
+int sector_discard(struct sector_device *dev, uint32_t first, uint32_t count);
 
 #ifdef __cplusplus
 }
 #endif
 
-
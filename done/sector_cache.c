@@ -0,0 +1,610 @@
+/**
+ * @file  sector_cache.c
+ * @brief write-back buffer cache of the block-level layer.
+ *
+ * The cached sectors are found through a hash table (chaining) keyed by
+ * the sector number and are kept in a doubly-linked LRU list: the most
+ * recently used sector is at the head, the victim is taken at the tail.
+ * A prefetched sector is pending until its read has completed; it is
+ * waited for only when it is accessed (or evicted).
+ *
+ * Prefetched sectors (file and directory data read ahead) are kept in a
+ * second LRU list, the cold one, of at most a quarter of the cache: once
+ * it is full, read-ahead recycles its own entries instead of evicting the
+ * metadata of the main list. A cold sector stays cold when it is read.
+ *
+ * Dirty sectors are written back in sector order (elevator), and runs of
+ * adjacent dirty sectors become a single write_range() of the backend.
+ * Evicting a dirty sector writes back all the dirty sectors of the cache
+ * this way, so that a bulk import is flushed as a few large writes rather
+ * than one random write per eviction.
+ *
+ * @author José Ferro Pinto
+ * @author Marc Favrod-Coune
+ * @date march 2017
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "error.h"
+#include "unixv6fs.h"
+#include "sector.h"
+#include "sector_cache.h"
+
+struct cache_entry {
+    uint32_t sector;
+    int valid;                  // contient une copie du secteur
+    int dirty;                  // modifié depuis la dernière écriture sur le disque
+    int pending;                // lecture asynchrone en cours dans req
+    int cold;                   // chargé d'avance: dans la liste froide
+    struct sector_req req;
+    struct cache_entry *hnext;  // chaînage dans la table de hachage
+    struct cache_entry *prev;   // liste LRU
+    struct cache_entry *next;
+    uint8_t data[SECTOR_SIZE];
+};
+
+// nombre maximal de secteurs contigus lus en une fois par sector_cache_prefetch()
+#define PREFETCH_MAX_RUN 32
+
+// nombre maximal de secteurs adjacents écrits en une fois lors d'une vidange
+#define FLUSH_MAX_RUN 64
+
+struct sector_cache {
+    size_t size;                   // nombre d'entrées
+    uint32_t mask;                 // nombre de seaux - 1 (puissance de 2)
+    struct cache_entry **buckets;
+    struct cache_entry *entries;
+    struct cache_entry **sorted;   // entrées modifiées à écrire, triées par secteur
+    uint8_t *stage;                // FLUSH_MAX_RUN secteurs adjacents à écrire en une fois
+    struct cache_entry lru;        // sentinelle: lru.next le plus récent, lru.prev le plus ancien
+    struct cache_entry cold;       // sentinelle de la liste froide, dans le même ordre
+    size_t nb_cold;                // nombre d'entrées de la liste froide
+    size_t cold_max;               // taille maximale de la liste froide
+};
+
+/**
+ * @brief remove e from the LRU list
+ */
+static void lru_unlink(struct cache_entry *e)
+{
+    e -> prev -> next = e -> next;
+    e -> next -> prev = e -> prev;
+}
+
+/**
+ * @brief the sentinel of the LRU list of e (cold or not)
+ */
+static struct cache_entry *lru_list(struct sector_cache *c, const struct cache_entry *e)
+{
+    return e -> cold ? &(c -> cold) : &(c -> lru);
+}
+
+/**
+ * @brief insert e at the head (most recently used) of the list of sentinel head
+ */
+static void lru_push_front(struct cache_entry *head, struct cache_entry *e)
+{
+    e -> prev = head;
+    e -> next = head -> next;
+    head -> next -> prev = e;
+    head -> next = e;
+}
+
+/**
+ * @brief e has just been used: move it to the head of its list
+ */
+static void lru_touch(struct sector_cache *c, struct cache_entry *e)
+{
+    lru_unlink(e);
+    lru_push_front(lru_list(c, e), e);
+}
+
+/**
+ * @brief the cached copy of sector, NULL if it is not in the cache
+ */
+static struct cache_entry *cache_find(const struct sector_cache *c, uint32_t sector)
+{
+    struct cache_entry *e = c -> buckets[sector & c -> mask];
+    while (e != NULL && e -> sector != sector) {
+        e = e -> hnext;
+    }
+    return e;
+}
+
+/**
+ * @brief remove e from the hash table
+ */
+static void hash_remove(struct sector_cache *c, struct cache_entry *e)
+{
+    struct cache_entry **p = &(c -> buckets[e -> sector & c -> mask]);
+    while (*p != e) {
+        p = &((*p) -> hnext);
+    }
+    *p = e -> hnext;
+    e -> hnext = NULL;
+}
+
+/**
+ * @brief write a dirty entry back to the backend
+ */
+static int cache_clean(struct sector_device *dev, struct cache_entry *e)
+{
+    int err = dev -> ops -> write(dev, e -> sector, e -> data);
+    if (!err) {
+        e -> dirty = 0;
+    }
+    return err;
+}
+
+/**
+ * @brief forget an entry whose content could not be read; it becomes the next victim
+ */
+static void cache_drop(struct sector_cache *c, struct cache_entry *e)
+{
+    struct cache_entry *head = lru_list(c, e);
+
+    hash_remove(c, e);
+    e -> valid = 0;
+    e -> dirty = 0;
+    e -> pending = 0;
+    lru_unlink(e);
+    e -> prev = head -> prev;
+    e -> next = head;
+    head -> prev -> next = e;
+    head -> prev = e;
+}
+
+/**
+ * @brief wait for the prefetch of e; e is dropped if it failed
+ * @return 0 if e now holds the sector; <0 on error
+ */
+static int cache_settle(struct sector_device *dev, struct cache_entry *e)
+{
+    int err = 0;
+
+    if (!(e -> pending)) {
+        return 0;
+    }
+    if (e -> req.result == SECTOR_REQ_PENDING && dev -> ops -> complete != NULL) {
+        err = dev -> ops -> complete(dev);
+    }
+    e -> pending = 0;
+    if (!err) {
+        err = e -> req.result;
+    }
+    if (err) {
+        cache_drop(dev -> cache, e);
+        return err;
+    }
+    e -> valid = 1;
+    return 0;
+}
+
+/**
+ * @brief order of two entries by sector number, for qsort()
+ */
+static int cache_entry_cmp(const void *a, const void *b)
+{
+    const struct cache_entry *ea = *(const struct cache_entry * const *) a;
+    const struct cache_entry *eb = *(const struct cache_entry * const *) b;
+
+    return (ea -> sector > eb -> sector) - (ea -> sector < eb -> sector);
+}
+
+/**
+ * @brief write the n dirty entries of c->sorted to the backend, by increasing
+ *        sector number; adjacent sectors are merged in a single write
+ * @param dev the device
+ * @param n the number of entries in c->sorted
+ * @return 0 on success; <0 on error
+ */
+static int cache_write_sorted(struct sector_device *dev, size_t n)
+{
+    struct sector_cache *c = dev -> cache;
+    struct cache_entry **sorted = c -> sorted;
+    size_t i = 0;
+    int err = 0;
+
+    qsort(sorted, n, sizeof(struct cache_entry *), cache_entry_cmp);
+
+    while (i < n && !err) {
+        size_t run = 1;
+        while (i + run < n && run < FLUSH_MAX_RUN && sorted[i + run] -> sector == sorted[i] -> sector + run) {
+            ++run;
+        }
+
+        if (run == 1 || dev -> ops -> write_range == NULL) {
+            for (size_t k = 0; k < run && !err; ++k) {
+                err = cache_clean(dev, sorted[i + k]);
+            }
+        } else {
+            for (size_t k = 0; k < run; ++k) {
+                memcpy(c -> stage + k * SECTOR_SIZE, sorted[i + k] -> data, SECTOR_SIZE);
+            }
+            err = dev -> ops -> write_range(dev, sorted[i] -> sector, (uint32_t) run, c -> stage);
+            for (size_t k = 0; k < run && !err; ++k) {
+                sorted[i + k] -> dirty = 0;
+            }
+        }
+        i += run;
+    }
+    return err;
+}
+
+/**
+ * @brief take the least recently used entry and give it to sector; the
+ *        victim comes from the cold list once it is full, from the main
+ *        list otherwise. If the victim is dirty, the whole cache is
+ *        written back first
+ * @param dev the device
+ * @param sector the sector the entry is for
+ * @param cold 1 if the sector is read ahead (cold list), 0 otherwise
+ * @param entry the entry, at the head of its LRU list (OUT)
+ * @return 0 on success; <0 on error
+ */
+static int cache_alloc_entry(struct sector_device *dev, uint32_t sector, int cold, struct cache_entry **entry)
+{
+    struct sector_cache *c = dev -> cache;
+    struct cache_entry *e = c -> lru.prev;
+
+    if (c -> nb_cold > 0 && c -> nb_cold >= c -> cold_max) {
+        e = c -> cold.prev;
+    }
+
+    // un échec du préchargement libère aussi l'entrée
+    cache_settle(dev, e);
+    if (e -> valid) {
+        if (e -> dirty) {
+            int err = sector_cache_flush(dev);
+            if (err) {
+                return err;
+            }
+        }
+        hash_remove(c, e);
+    }
+
+    e -> sector = sector;
+    e -> valid = 0;
+    e -> dirty = 0;
+    e -> pending = 0;
+    e -> hnext = c -> buckets[sector & c -> mask];
+    c -> buckets[sector & c -> mask] = e;
+    lru_unlink(e);
+    c -> nb_cold -= (size_t) e -> cold;
+    e -> cold = cold;
+    c -> nb_cold += (size_t) cold;
+    lru_push_front(lru_list(c, e), e);
+
+    *entry = e;
+    return 0;
+}
+
+/**
+ * @brief allocate a cache of nb_sectors sectors
+ * @param nb_sectors the number of sectors the cache can hold (>0)
+ * @return the new cache or NULL on failure
+ */
+struct sector_cache *sector_cache_alloc(size_t nb_sectors)
+{
+    struct sector_cache *c = NULL;
+    size_t nb_buckets = 1;
+
+    if (nb_sectors == 0 || nb_sectors > UINT32_MAX / 2) {
+        return NULL;
+    }
+    while (nb_buckets < nb_sectors) {
+        nb_buckets <<= 1;
+    }
+
+    c = calloc(1, sizeof(struct sector_cache));
+    if (c == NULL) {
+        return NULL;
+    }
+    c -> buckets = calloc(nb_buckets, sizeof(struct cache_entry *));
+    c -> entries = calloc(nb_sectors, sizeof(struct cache_entry));
+    c -> sorted = calloc(nb_sectors, sizeof(struct cache_entry *));
+    c -> stage = malloc(FLUSH_MAX_RUN * SECTOR_SIZE);
+    if (c -> buckets == NULL || c -> entries == NULL || c -> sorted == NULL || c -> stage == NULL) {
+        sector_cache_free(c);
+        return NULL;
+    }
+    c -> size = nb_sectors;
+    c -> mask = (uint32_t) (nb_buckets - 1);
+
+    c -> cold_max = nb_sectors / 4;
+
+    c -> lru.prev = &(c -> lru);
+    c -> lru.next = &(c -> lru);
+    c -> cold.prev = &(c -> cold);
+    c -> cold.next = &(c -> cold);
+    for (size_t i = 0; i < nb_sectors; ++i) {
+        lru_push_front(&(c -> lru), &(c -> entries[i]));
+    }
+    return c;
+}
+
+/**
+ * @brief free a cache; dirty sectors are lost (see sector_cache_flush())
+ * @param cache the cache to free (may be NULL)
+ */
+void sector_cache_free(struct sector_cache *cache)
+{
+    if (cache == NULL) {
+        return;
+    }
+    free(cache -> buckets);
+    free(cache -> entries);
+    free(cache -> sorted);
+    free(cache -> stage);
+    free(cache);
+}
+
+/**
+ * @brief read one sector through the cache of dev
+ * @param dev the device (dev->cache != NULL)
+ * @param sector the sector to read
+ * @param data a pointer to 512-bytes of memory (OUT)
+ * @param hit set to 1 if the sector was in the cache, 0 otherwise (OUT)
+ * @return 0 on success; <0 on error
+ */
+int sector_cache_read(struct sector_device *dev, uint32_t sector, void *data, int *hit)
+{
+    struct sector_cache *c = dev -> cache;
+    struct cache_entry *e = cache_find(c, sector);
+    int err = 0;
+
+    *hit = 0;
+    if (e != NULL && cache_settle(dev, e) != 0) {
+        e = NULL;  // on relit le secteur de manière synchrone
+    }
+    if (e != NULL) {
+        *hit = 1;
+        lru_touch(c, e);
+    } else {
+        err = cache_alloc_entry(dev, sector, 0, &e);
+        if (err) {
+            return err;
+        }
+        err = dev -> ops -> read(dev, sector, e -> data);
+        if (err) {
+            cache_drop(c, e);
+            return err;
+        }
+        e -> valid = 1;
+    }
+
+    memcpy(data, e -> data, SECTOR_SIZE);
+    return 0;
+}
+
+/**
+ * @brief copy [first, first+count) from the cache of dev if all these
+ *        sectors are in it (prefetched ones are waited for)
+ * @param dev the device (dev->cache != NULL)
+ * @param first the first sector of the range
+ * @param count the number of sectors of the range
+ * @param data count*512 bytes of memory (OUT); undefined if 0 is returned
+ * @return 1 if the range was copied; 0 if a sector is not cached
+ */
+int sector_cache_lookup(struct sector_device *dev, uint32_t first, uint32_t count, void *data)
+{
+    struct sector_cache *c = dev -> cache;
+    uint8_t *ptr = data;
+
+    for (uint32_t i = 0; i < count; ++i) {
+        struct cache_entry *e = cache_find(c, first + i);
+        if (e == NULL || cache_settle(dev, e) != 0) {
+            return 0;
+        }
+        lru_touch(c, e);
+        memcpy(ptr + (size_t) i * SECTOR_SIZE, e -> data, SECTOR_SIZE);
+    }
+    return 1;
+}
+
+/**
+ * @brief write one sector in the cache of dev; it becomes dirty
+ * @param dev the device (dev->cache != NULL)
+ * @param sector the sector to write
+ * @param data a pointer to 512-bytes of memory (IN)
+ * @return 0 on success; <0 on error
+ */
+int sector_cache_write(struct sector_device *dev, uint32_t sector, const void *data)
+{
+    struct sector_cache *c = dev -> cache;
+    struct cache_entry *e = cache_find(c, sector);
+
+    if (e != NULL && cache_settle(dev, e) != 0) {
+        e = NULL;
+    }
+    if (e != NULL) {
+        lru_touch(c, e);
+    } else {
+        // le secteur est écrit en entier: inutile de le lire avant
+        int err = cache_alloc_entry(dev, sector, 0, &e);
+        if (err) {
+            return err;
+        }
+    }
+
+    memcpy(e -> data, data, SECTOR_SIZE);
+    e -> valid = 1;
+    e -> dirty = 1;
+    return 0;
+}
+
+/**
+ * @brief write the dirty cached sectors of [first, first+count) to the backend
+ * @param dev the device (dev->cache != NULL)
+ * @param first the first sector of the range
+ * @param count the number of sectors of the range
+ * @return 0 on success; <0 on error
+ */
+int sector_cache_writeback(struct sector_device *dev, uint32_t first, uint32_t count)
+{
+    struct sector_cache *c = dev -> cache;
+    size_t n = 0;
+
+    if (count > c -> size) {
+        // plus court de parcourir le cache que la plage
+        for (size_t i = 0; i < c -> size; ++i) {
+            struct cache_entry *e = &(c -> entries[i]);
+            if (e -> valid && e -> dirty && e -> sector - first < count) {
+                c -> sorted[n++] = e;
+            }
+        }
+    } else {
+        for (uint32_t i = 0; i < count; ++i) {
+            struct cache_entry *e = cache_find(c, first + i);
+            if (e != NULL && e -> valid && e -> dirty) {
+                c -> sorted[n++] = e;
+            }
+        }
+    }
+
+    if (n == 0) {
+        return 0;
+    }
+    return cache_write_sorted(dev, n);
+}
+
+/**
+ * @brief the sectors [first, first+count) have been written to the backend
+ *        without the cache: refresh the cached copies
+ * @param dev the device (dev->cache != NULL)
+ * @param first the first sector written
+ * @param count the number of sectors written
+ * @param data the count*512 bytes written
+ */
+void sector_cache_update(struct sector_device *dev, uint32_t first, uint32_t count, const void *data)
+{
+    struct sector_cache *c = dev -> cache;
+    const uint8_t *ptr = data;
+
+    for (uint32_t i = 0; i < count; ++i) {
+        struct cache_entry *e = cache_find(c, first + i);
+        if (e != NULL && cache_settle(dev, e) == 0) {
+            memcpy(e -> data, ptr + (size_t) i * SECTOR_SIZE, SECTOR_SIZE);
+            e -> dirty = 0;
+        }
+    }
+}
+
+/**
+ * @brief forget the cached copies of [first, first+count), even dirty ones
+ * @param dev the device (dev->cache != NULL)
+ * @param first the first sector of the range
+ * @param count the number of sectors of the range
+ */
+void sector_cache_discard(struct sector_device *dev, uint32_t first, uint32_t count)
+{
+    struct sector_cache *c = dev -> cache;
+
+    for (size_t i = 0; i < c -> size; ++i) {
+        struct cache_entry *e = &(c -> entries[i]);
+        // une lecture en vol écrirait encore dans l'entrée
+        if ((e -> valid || e -> pending) && e -> sector - first < count
+            && cache_settle(dev, e) == 0) {
+            cache_drop(c, e);
+        }
+    }
+}
+
+/**
+ * @brief write all the dirty cached sectors to the backend
+ * @param dev the device (dev->cache != NULL)
+ * @return 0 on success; <0 on error
+ */
+int sector_cache_flush(struct sector_device *dev)
+{
+    struct sector_cache *c = dev -> cache;
+    size_t n = 0;
+
+    for (size_t i = 0; i < c -> size; ++i) {
+        struct cache_entry *e = &(c -> entries[i]);
+        if (e -> valid && e -> dirty) {
+            c -> sorted[n++] = e;
+        }
+    }
+
+    if (n == 0) {
+        return 0;
+    }
+    return cache_write_sorted(dev, n);
+}
+
+/**
+ * @brief start loading the given sectors in the cold list of the cache of dev
+ * @param dev the device (dev->cache != NULL)
+ * @param sectors the sectors to load
+ * @param count the number of sectors in the list
+ * @return >=0: the number of sectors read ahead; <0 on error
+ */
+int sector_cache_prefetch(struct sector_device *dev, const uint32_t *sectors, size_t count)
+{
+    struct sector_cache *c = dev -> cache;
+    struct cache_entry *e = NULL;
+    uint8_t buf[PREFETCH_MAX_RUN * SECTOR_SIZE];
+    size_t i = 0;
+    int loaded = 0;
+    int err = 0;
+
+    // pas plus que la liste froide, pour ne pas évincer ce qui est préchargé
+    if (count > c -> cold_max) {
+        count = c -> cold_max;
+    }
+
+    while (i < count && !err) {
+        if (cache_find(c, sectors[i]) != NULL) {
+            ++i;
+            continue;
+        }
+
+        if (dev -> ops -> submit != NULL) {
+            // asynchrone: une requête par entrée, attendue au premier accès
+            err = cache_alloc_entry(dev, sectors[i], 1, &e);
+            if (!err) {
+                e -> pending = 1;
+                e -> req.sector = sectors[i];
+                e -> req.count = 1;
+                e -> req.data = e -> data;
+                e -> req.write = 0;
+                e -> req.result = SECTOR_REQ_PENDING;
+                err = dev -> ops -> submit(dev, &(e -> req));
+                if (err) {
+                    cache_drop(c, e);
+                } else {
+                    ++loaded;
+                }
+            }
+            ++i;
+            continue;
+        }
+
+        // synchrone: une seule lecture pour toute une suite de secteurs contigus absents
+        size_t run = 1;
+        while (i + run < count && run < PREFETCH_MAX_RUN && sectors[i + run] == sectors[i] + run
+               && cache_find(c, sectors[i + run]) == NULL) {
+            ++run;
+        }
+        if (dev -> ops -> read_range != NULL) {
+            err = dev -> ops -> read_range(dev, sectors[i], (uint32_t) run, buf);
+        } else {
+            for (size_t k = 0; k < run && !err; ++k) {
+                err = dev -> ops -> read(dev, sectors[i] + (uint32_t) k, buf + k * SECTOR_SIZE);
+            }
+        }
+        for (size_t k = 0; k < run && !err; ++k) {
+            err = cache_alloc_entry(dev, sectors[i] + (uint32_t) k, 1, &e);
+            if (!err) {
+                memcpy(e -> data, buf + k * SECTOR_SIZE, SECTOR_SIZE);
+                e -> valid = 1;
+                ++loaded;
+            }
+        }
+        i += run;
+    }
+    return err ? err : loaded;
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+/**
+ * @file  sector_cache.h
+ * @brief write-back buffer cache of the block-level layer.
+ *
+ * The cache sits between sector_read()/sector_write() and the backend of
+ * a struct sector_device: sectors are kept in memory (LRU replacement),
+ * writes only mark them dirty. Dirty sectors reach the backend when they
+ * are evicted and when the device is flushed (sync, umount).
+ *
+ * Only sector.c uses these functions; see sector_cache_setup() in
+ * sector.h to enable or resize the cache of a device.
+ *
+ * @author José Ferro Pinto
+ * @author Marc Favrod-Coune
+ * @date march 2017
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "sector.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief allocate a cache of nb_sectors sectors
+ * @param nb_sectors the number of sectors the cache can hold (>0)
+ * @return the new cache or NULL on failure
+ */
+struct sector_cache *sector_cache_alloc(size_t nb_sectors);
+
+/**
+ * @brief free a cache; dirty sectors are lost (see sector_cache_flush())
+ * @param cache the cache to free (may be NULL)
+ */
+void sector_cache_free(struct sector_cache *cache);
+
+/**
+ * @brief read one sector through the cache of dev
+ * @param dev the device (dev->cache != NULL)
+ * @param sector the sector to read
+ * @param data a pointer to 512-bytes of memory (OUT)
+ * @param hit set to 1 if the sector was in the cache, 0 otherwise (OUT)
+ * @return 0 on success; <0 on error
+ */
+int sector_cache_read(struct sector_device *dev, uint32_t sector, void *data, int *hit);
+
+/**
+ * @brief copy [first, first+count) from the cache of dev if all these
+ *        sectors are in it (prefetched ones are waited for)
+ * @param dev the device (dev->cache != NULL)
+ * @param first the first sector of the range
+ * @param count the number of sectors of the range
+ * @param data count*512 bytes of memory (OUT); undefined if 0 is returned
+ * @return 1 if the range was copied; 0 if a sector is not cached
+ */
+int sector_cache_lookup(struct sector_device *dev, uint32_t first, uint32_t count, void *data);
+
+/**
+ * @brief write one sector in the cache of dev; it becomes dirty
+ * @param dev the device (dev->cache != NULL)
+ * @param sector the sector to write
+ * @param data a pointer to 512-bytes of memory (IN)
+ * @return 0 on success; <0 on error
+ */
+int sector_cache_write(struct sector_device *dev, uint32_t sector, const void *data);
+
+/**
+ * @brief write the dirty cached sectors of [first, first+count) to the backend
+ * @param dev the device (dev->cache != NULL)
+ * @param first the first sector of the range
+ * @param count the number of sectors of the range
+ * @return 0 on success; <0 on error
+ */
+int sector_cache_writeback(struct sector_device *dev, uint32_t first, uint32_t count);
+
+/**
+ * @brief the sectors [first, first+count) have been written to the backend
+ *        without the cache: refresh the cached copies
+ * @param dev the device (dev->cache != NULL)
+ * @param first the first sector written
+ * @param count the number of sectors written
+ * @param data the count*512 bytes written
+ */
+void sector_cache_update(struct sector_device *dev, uint32_t first, uint32_t count, const void *data);
+
+/**
+ * @brief forget the cached copies of [first, first+count), even dirty ones
+ *        (the sectors are discarded, see sector_discard())
+ * @param dev the device (dev->cache != NULL)
+ * @param first the first sector of the range
+ * @param count the number of sectors of the range
+ */
+void sector_cache_discard(struct sector_device *dev, uint32_t first, uint32_t count);
+
+/**
+ * @brief start loading the given sectors in the cache of dev: asynchronously
+ *        if the backend supports it, otherwise with one read per run of
+ *        contiguous sectors. Sectors already cached are skipped. They go to
+ *        the cold list (a quarter of the cache, which bounds count), so
+ *        read-ahead does not evict the other cached sectors.
+ * @param dev the device (dev->cache != NULL)
+ * @param sectors the sectors to load
+ * @param count the number of sectors in the list
+ * @return >=0: the number of sectors read ahead; <0 on error
+ */
+int sector_cache_prefetch(struct sector_device *dev, const uint32_t *sectors, size_t count);
+
+/**
+ * @brief write all the dirty cached sectors to the backend
+ * @param dev the device (dev->cache != NULL)
+ * @return 0 on success; <0 on error
+ */
+int sector_cache_flush(struct sector_device *dev);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,264 @@
+/**
+ * @file  sector_fd.c
+ * @brief default block-device backend: positional I/O (pread/pwrite)
+ *        on a file descriptor, thus no seek state and no stdio buffering.
+ *
+ *        The backend is aware of sparse images: at open time, the holes
+ *        of the file (SEEK_HOLE/SEEK_DATA) give a map of the sectors known
+ *        to be all zeros. Reading such a sector needs no system call, and
+ *        writing zeros to it needs none either, so the image stays sparse.
+ *        The map is kept up to date by the writes, sector_resize()
+ *        (ftruncate) and sector_discard() (fallocate(PUNCH_HOLE)).
+ *
+ * @author José Ferro Pinto
+ * @author Marc Favrod-Coune
+ * @date march 2017
+ */
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "error.h"
+#include "unixv6fs.h"
+#include "sector.h"
+
+struct fd_disk {
+    uint8_t *zero;          /* bit i: sector i is known to be all zeros */
+    uint32_t nb_sectors;    /* number of sectors covered by the map */
+};
+
+static int zero_get(const struct fd_disk *disk, uint32_t sector)
+{
+    return sector < disk -> nb_sectors && (disk -> zero[sector / 8] >> (sector % 8)) & 1;
+}
+
+static void zero_set(struct fd_disk *disk, uint32_t first, uint32_t count, int value)
+{
+    for (uint32_t s = first; s < first + count && s < disk -> nb_sectors; ++s) {
+        if (value) {
+            disk -> zero[s / 8] |= (uint8_t) (1 << (s % 8));
+        } else {
+            disk -> zero[s / 8] &= (uint8_t) ~(1 << (s % 8));
+        }
+    }
+}
+
+static int is_zero(const void *data, size_t len)
+{
+    const uint8_t *p = data;
+
+    for (size_t i = 0; i < len; ++i) {
+        if (p[i] != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* (re)size the map to nb_sectors; the new sectors are marked as zeros */
+static int zero_resize(struct fd_disk *disk, uint32_t nb_sectors)
+{
+    uint8_t *zero = realloc(disk -> zero, (size_t) nb_sectors / 8 + 1);
+    uint32_t old = disk -> nb_sectors;
+
+    if (zero == NULL) {
+        return ERR_NOMEM;
+    }
+    disk -> zero = zero;
+    disk -> nb_sectors = nb_sectors;
+    if (nb_sectors > old) {
+        zero_set(disk, old, nb_sectors - old, 1);
+    }
+    return 0;
+}
+
+/* mark the holes of the file in the map */
+static void zero_scan(struct sector_device *dev, struct fd_disk *disk, off_t size)
+{
+    off_t off = 0;
+
+    while (off < size) {
+        off_t data = lseek(dev -> fd, off, SEEK_DATA);
+        off_t hole = 0;
+
+        if (data < 0) {
+            // ENXIO: que des trous jusqu'à la fin; sinon SEEK_DATA n'est pas supporté
+            if (errno == ENXIO) {
+                data = size;
+            } else {
+                return;
+            }
+        }
+        // seuls les secteurs entièrement dans le trou sont marqués
+        if (data > off) {
+            uint32_t first = (uint32_t) ((off + SECTOR_SIZE - 1) / SECTOR_SIZE);
+            uint32_t end = (uint32_t) (data / SECTOR_SIZE);
+            if (end > first) {
+                zero_set(disk, first, end - first, 1);
+            }
+        }
+        if (data >= size) {
+            return;
+        }
+        hole = lseek(dev -> fd, data, SEEK_HOLE);
+        if (hole < 0 || hole <= data) {
+            return;
+        }
+        off = hole;
+    }
+}
+
+static int fd_open(struct sector_device *dev, const char *filename, int flags)
+{
+    int oflags = (flags & SECTOR_OPEN_RDONLY) ? O_RDONLY : O_RDWR;
+    struct fd_disk *disk = NULL;
+    struct stat st;
+
+    if (flags & SECTOR_OPEN_CREATE) {
+        oflags |= O_CREAT | O_TRUNC;
+    }
+
+    dev -> fd = open(filename, oflags, 0644);
+    if (dev -> fd < 0) {
+        return ERR_IO;
+    }
+
+    disk = calloc(1, sizeof(struct fd_disk));
+    if (disk == NULL || fstat(dev -> fd, &st) != 0
+        || zero_resize(disk, (uint32_t) (st.st_size / SECTOR_SIZE)) != 0) {
+        free(disk);
+        close(dev -> fd);
+        dev -> fd = -1;
+        return disk == NULL ? ERR_NOMEM : ERR_IO;
+    }
+    // rien n'est connu avant d'avoir cherché les trous
+    zero_set(disk, 0, disk -> nb_sectors, 0);
+    zero_scan(dev, disk, st.st_size);
+
+    dev -> priv = disk;
+    return 0;
+}
+
+static int fd_read(struct sector_device *dev, uint32_t sector, void *data)
+{
+    if (zero_get(dev -> priv, sector)) {
+        memset(data, 0, SECTOR_SIZE);
+        return 0;
+    }
+    if (pread(dev -> fd, data, SECTOR_SIZE, (off_t) sector * SECTOR_SIZE) != SECTOR_SIZE) {
+        return ERR_IO;
+    }
+    return 0;
+}
+
+static int fd_read_range(struct sector_device *dev, uint32_t first, uint32_t count, void *data)
+{
+    const ssize_t len = (ssize_t) count * SECTOR_SIZE;
+    uint32_t zeros = 0;
+
+    while (zeros < count && zero_get(dev -> priv, first + zeros)) {
+        ++zeros;
+    }
+    if (zeros == count) {
+        memset(data, 0, (size_t) len);
+        return 0;
+    }
+
+    if (pread(dev -> fd, data, (size_t) len, (off_t) first * SECTOR_SIZE) != len) {
+        return ERR_IO;
+    }
+    return 0;
+}
+
+static int fd_write(struct sector_device *dev, uint32_t sector, const void *data)
+{
+    struct fd_disk *disk = dev -> priv;
+    int zero = is_zero(data, SECTOR_SIZE);
+
+    // des zéros dans un trou: rien à écrire, l'image reste creuse
+    if (zero && zero_get(disk, sector)) {
+        return 0;
+    }
+    if (pwrite(dev -> fd, data, SECTOR_SIZE, (off_t) sector * SECTOR_SIZE) != SECTOR_SIZE) {
+        return ERR_IO;
+    }
+    zero_set(disk, sector, 1, zero);
+    return 0;
+}
+
+static int fd_write_range(struct sector_device *dev, uint32_t first, uint32_t count, const void *data)
+{
+    const ssize_t len = (ssize_t) count * SECTOR_SIZE;
+
+    if (pwrite(dev -> fd, data, (size_t) len, (off_t) first * SECTOR_SIZE) != len) {
+        return ERR_IO;
+    }
+    zero_set(dev -> priv, first, count, 0);
+    return 0;
+}
+
+static int fd_resize(struct sector_device *dev, uint32_t nb_sectors)
+{
+    struct fd_disk *disk = dev -> priv;
+
+    if (ftruncate(dev -> fd, (off_t) nb_sectors * SECTOR_SIZE) != 0) {
+        return ERR_IO;
+    }
+    return zero_resize(disk, nb_sectors);
+}
+
+static int fd_discard(struct sector_device *dev, uint32_t first, uint32_t count)
+{
+    const off_t off = (off_t) first * SECTOR_SIZE;
+    const off_t len = (off_t) count * SECTOR_SIZE;
+
+    if (fallocate(dev -> fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, off, len) != 0) {
+        // pas de trous sur ce système de fichiers: on écrit des zéros
+        uint8_t zeros[SECTOR_SIZE];
+        memset(zeros, 0, SECTOR_SIZE);
+        for (uint32_t s = first; s < first + count; ++s) {
+            if (pwrite(dev -> fd, zeros, SECTOR_SIZE, (off_t) s * SECTOR_SIZE) != SECTOR_SIZE) {
+                return ERR_IO;
+            }
+        }
+    }
+    zero_set(dev -> priv, first, count, 1);
+    return 0;
+}
+
+static int fd_close(struct sector_device *dev)
+{
+    struct fd_disk *disk = dev -> priv;
+    int err = close(dev -> fd);
+
+    if (disk != NULL) {
+        free(disk -> zero);
+        free(disk);
+    }
+    dev -> priv = NULL;
+    dev -> fd = -1;
+    return err ? ERR_IO : 0;
+}
+
+const struct sector_ops sector_fd_ops = {
+    .name  = "fd",
+    .open  = fd_open,
+    .read  = fd_read,
+    .write = fd_write,
+    .flush = NULL,     /* pwrite() goes straight to the kernel */
+    .close = fd_close,
+    .map   = NULL,
+    .read_range = fd_read_range,
+    .write_range = fd_write_range,
+    .submit = NULL,
+    .complete = NULL,
+    .resize = fd_resize,
+    .discard = fd_discard,
+};
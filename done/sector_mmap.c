@@ -0,0 +1,163 @@
+/**
+ * @file  sector_mmap.c
+ * @brief block-device backend mapping the whole virtual disk in memory.
+ *        A disk has at most 2^16 sectors (s_fsize is 16 bits), i.e. 32 MB,
+ *        so the mapping is always affordable. Reads can then be served
+ *        without any copy (see sector_read_ref()).
+ *
+ * @author José Ferro Pinto
+ * @author Marc Favrod-Coune
+ * @date march 2017
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "error.h"
+#include "unixv6fs.h"
+#include "sector.h"
+
+struct mmap_disk {
+    uint8_t *base;   /* start of the mapping */
+    size_t size;     /* size of the mapping, in bytes */
+};
+
+static int mmap_open(struct sector_device *dev, const char *filename, int flags)
+{
+    struct mmap_disk *disk = NULL;
+    struct stat st;
+    int prot = PROT_READ;
+
+    if (flags & SECTOR_OPEN_CREATE) {
+        // nothing to map in an empty file
+        return ERR_BAD_PARAMETER;
+    }
+
+    dev -> fd = open(filename, (flags & SECTOR_OPEN_RDONLY) ? O_RDONLY : O_RDWR);
+    if (dev -> fd < 0) {
+        return ERR_IO;
+    }
+
+    if (fstat(dev -> fd, &st) != 0 || st.st_size < SECTOR_SIZE) {
+        close(dev -> fd);
+        return ERR_IO;
+    }
+
+    disk = calloc(1, sizeof(struct mmap_disk));
+    if (disk == NULL) {
+        close(dev -> fd);
+        return ERR_NOMEM;
+    }
+
+    if (!(flags & SECTOR_OPEN_RDONLY)) {
+        prot |= PROT_WRITE;
+    }
+    disk -> size = (size_t) st.st_size;
+    disk -> base = mmap(NULL, disk -> size, prot, MAP_SHARED, dev -> fd, 0);
+    if (disk -> base == MAP_FAILED) {
+        free(disk);
+        close(dev -> fd);
+        return ERR_IO;
+    }
+
+    dev -> priv = disk;
+    return 0;
+}
+
+static const void *mmap_map(struct sector_device *dev, uint32_t sector)
+{
+    const struct mmap_disk *disk = dev -> priv;
+    size_t off = (size_t) sector * SECTOR_SIZE;
+
+    if (off + SECTOR_SIZE > disk -> size) {
+        return NULL;
+    }
+    return disk -> base + off;
+}
+
+static int mmap_read(struct sector_device *dev, uint32_t sector, void *data)
+{
+    const void *src = mmap_map(dev, sector);
+
+    if (src == NULL) {
+        return ERR_IO;
+    }
+    memcpy(data, src, SECTOR_SIZE);
+    return 0;
+}
+
+static int mmap_read_range(struct sector_device *dev, uint32_t first, uint32_t count, void *data)
+{
+    const struct mmap_disk *disk = dev -> priv;
+    size_t off = (size_t) first * SECTOR_SIZE;
+    size_t len = (size_t) count * SECTOR_SIZE;
+
+    if (off + len > disk -> size) {
+        return ERR_IO;
+    }
+    memcpy(data, disk -> base + off, len);
+    return 0;
+}
+
+static int mmap_write(struct sector_device *dev, uint32_t sector, const void *data)
+{
+    // the mapping is writable unless the device was opened read-only,
+    // which sector_write() already refuses
+    void *dst = (void *) mmap_map(dev, sector);
+
+    if (dst == NULL) {
+        return ERR_IO;
+    }
+    memcpy(dst, data, SECTOR_SIZE);
+    return 0;
+}
+
+static int mmap_flush(struct sector_device *dev)
+{
+    const struct mmap_disk *disk = dev -> priv;
+
+    if (dev -> flags & SECTOR_OPEN_RDONLY) {
+        return 0;
+    }
+    return msync(disk -> base, disk -> size, MS_SYNC) ? ERR_IO : 0;
+}
+
+static int mmap_close(struct sector_device *dev)
+{
+    struct mmap_disk *disk = dev -> priv;
+    int err = 0;
+
+    if (munmap(disk -> base, disk -> size) != 0) {
+        err = ERR_IO;
+    }
+    if (close(dev -> fd) != 0) {
+        err = ERR_IO;
+    }
+    free(disk);
+    dev -> priv = NULL;
+    dev -> fd = -1;
+    return err;
+}
+
+const struct sector_ops sector_mmap_ops = {
+    .name  = "mmap",
+    .open  = mmap_open,
+    .read  = mmap_read,
+    .write = mmap_write,
+    .flush = mmap_flush,
+    .close = mmap_close,
+    .map   = mmap_map,
+    .read_range = mmap_read_range,
+    .write_range = NULL,  /* no buffer cache in front of a mapping */
+    .submit = NULL,
+    .complete = NULL,
+    .resize = NULL,
+    .discard = NULL,
+};
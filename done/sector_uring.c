@@ -0,0 +1,461 @@
+/**
+ * @file  sector_uring.c
+ * @brief block-device backend using Linux io_uring, so that many sector
+ *        reads and writes are in flight at the same time.
+ *
+ *        sector_submit()/sector_complete() map directly onto the rings.
+ *        A plain sector_write() is copied into one of URING_DEPTH write
+ *        slots and returns at once (write-behind); reads of a sector with
+ *        a write in flight are served from its slot. sector_flush() waits
+ *        for everything.
+ *
+ *        No liburing: the rings are set up with the raw system calls.
+ *        When the kernel has no io_uring (or no IORING_OP_READ/WRITE),
+ *        opening fails with ERR_IO and the caller falls back to
+ *        sector_fd_ops.
+ *
+ * @author José Ferro Pinto
+ * @author Marc Favrod-Coune
+ * @date march 2017
+ */
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "error.h"
+#include "unixv6fs.h"
+#include "sector.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+#ifdef HAVE_IO_URING
+
+#include <linux/io_uring.h>
+
+#define URING_DEPTH 64          /* entries of the submission queue */
+#define URING_SUBMIT_BATCH 16   /* queued writes before io_uring_enter() */
+
+struct uring_slot {
+    struct sector_req req;      /* req.result != SECTOR_REQ_PENDING: slot free */
+    uint8_t buf[SECTOR_SIZE];
+};
+
+struct uring_disk {
+    int ring_fd;
+    unsigned sq_entries;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr;
+    void *cq_ptr;
+    size_t sq_len;
+    size_t cq_len;
+    size_t sqes_len;
+    unsigned to_submit;         /* queued in the SQ, not yet given to the kernel */
+    unsigned inflight;          /* queued or submitted, not completed */
+    int write_error;            /* first error of a write-behind slot */
+    struct uring_slot slots[URING_DEPTH];
+};
+
+static int is_slot(const struct uring_disk *r, const struct sector_req *req)
+{
+    const uint8_t *p = (const uint8_t *) req;
+    const uint8_t *first = (const uint8_t *) r -> slots;
+
+    return p >= first && p < first + sizeof(r -> slots);
+}
+
+/* collect the completion queue */
+static void uring_reap(struct uring_disk *r)
+{
+    unsigned head = *(r -> cq_head);
+    unsigned tail = __atomic_load_n(r -> cq_tail, __ATOMIC_ACQUIRE);
+
+    while (head != tail) {
+        const struct io_uring_cqe *cqe = &(r -> cqes[head & *(r -> cq_mask)]);
+        struct sector_req *req = (struct sector_req *) (uintptr_t) cqe -> user_data;
+
+        req -> result = (cqe -> res == (int) (req -> count * SECTOR_SIZE)) ? 0 : ERR_IO;
+        if (is_slot(r, req) && req -> result && !r -> write_error) {
+            r -> write_error = req -> result;
+        }
+        --(r -> inflight);
+        ++head;
+    }
+    __atomic_store_n(r -> cq_head, head, __ATOMIC_RELEASE);
+}
+
+/* give the queued entries to the kernel and wait for min_complete completions */
+static int uring_enter(struct uring_disk *r, unsigned min_complete)
+{
+    int ret = 0;
+
+    do {
+        ret = (int) syscall(__NR_io_uring_enter, r -> ring_fd, r -> to_submit, min_complete,
+                            min_complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret < 0) {
+        return ERR_IO;
+    }
+    if ((unsigned) ret >= r -> to_submit) {
+        r -> to_submit = 0;
+    } else {
+        r -> to_submit -= (unsigned) ret;
+    }
+    uring_reap(r);
+    return 0;
+}
+
+static int uring_wait(struct uring_disk *r, const struct sector_req *req)
+{
+    int err = 0;
+
+    while (req -> result == SECTOR_REQ_PENDING && !err) {
+        err = uring_enter(r, 1);
+    }
+    return err;
+}
+
+static int uring_wait_all(struct uring_disk *r)
+{
+    int err = 0;
+
+    while (r -> inflight > 0 && !err) {
+        err = uring_enter(r, r -> inflight);
+    }
+    return err;
+}
+
+/* queue one request in the SQ; the request is given to the kernel later */
+static int uring_queue(struct sector_device *dev, struct sector_req *req)
+{
+    struct uring_disk *r = dev -> priv;
+    struct io_uring_sqe *sqe = NULL;
+    unsigned tail = 0;
+    unsigned idx = 0;
+    int err = 0;
+
+    // jamais plus de requêtes en vol que d'entrées dans la SQ (la CQ ne déborde pas)
+    while (r -> inflight >= r -> sq_entries && !err) {
+        err = uring_enter(r, 1);
+    }
+    if (err) {
+        return err;
+    }
+
+    tail = *(r -> sq_tail);
+    idx = tail & *(r -> sq_mask);
+    sqe = &(r -> sqes[idx]);
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe -> opcode = req -> write ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe -> fd = dev -> fd;
+    sqe -> off = (uint64_t) req -> sector * SECTOR_SIZE;
+    sqe -> addr = (uint64_t) (uintptr_t) req -> data;
+    sqe -> len = req -> count * SECTOR_SIZE;
+    sqe -> user_data = (uint64_t) (uintptr_t) req;
+    r -> sq_array[idx] = idx;
+    __atomic_store_n(r -> sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    req -> result = SECTOR_REQ_PENDING;
+    ++(r -> to_submit);
+    ++(r -> inflight);
+    return 0;
+}
+
+/* write-behind slot holding the given sector, NULL if none */
+static struct uring_slot *uring_pending_write(struct uring_disk *r, uint32_t sector)
+{
+    for (size_t i = 0; i < URING_DEPTH; ++i) {
+        if (r -> slots[i].req.result == SECTOR_REQ_PENDING && r -> slots[i].req.sector == sector) {
+            return &(r -> slots[i]);
+        }
+    }
+    return NULL;
+}
+
+/* writes in flight on [first, first+count) must reach the disk before a read */
+static int uring_order(struct uring_disk *r, uint32_t first, uint32_t count)
+{
+    for (size_t i = 0; i < URING_DEPTH; ++i) {
+        const struct sector_req *w = &(r -> slots[i].req);
+        if (w -> result == SECTOR_REQ_PENDING && w -> sector >= first && w -> sector < first + count) {
+            return uring_wait_all(r);
+        }
+    }
+    return 0;
+}
+
+static int uring_submit(struct sector_device *dev, struct sector_req *req)
+{
+    struct uring_disk *r = dev -> priv;
+    int err = uring_order(r, req -> sector, req -> count);
+
+    if (err) {
+        return err;
+    }
+    return uring_queue(dev, req);
+}
+
+static int uring_complete(struct sector_device *dev)
+{
+    return uring_wait_all(dev -> priv);
+}
+
+static int uring_read_range(struct sector_device *dev, uint32_t first, uint32_t count, void *data)
+{
+    struct sector_req req = { first, count, data, 0, 0 };
+    int err = uring_submit(dev, &req);
+
+    if (!err) {
+        err = uring_wait(dev -> priv, &req);
+    }
+    return err ? err : req.result;
+}
+
+static int uring_write_range(struct sector_device *dev, uint32_t first, uint32_t count, const void *data)
+{
+    // la requête ne modifie pas data
+    struct sector_req req = { first, count, (void *) data, 1, 0 };
+    int err = uring_submit(dev, &req);
+
+    if (!err) {
+        err = uring_wait(dev -> priv, &req);
+    }
+    return err ? err : req.result;
+}
+
+static int uring_read(struct sector_device *dev, uint32_t sector, void *data)
+{
+    const struct uring_slot *slot = uring_pending_write(dev -> priv, sector);
+
+    if (slot != NULL) {
+        memcpy(data, slot -> buf, SECTOR_SIZE);
+        return 0;
+    }
+    return uring_read_range(dev, sector, 1, data);
+}
+
+static int uring_write(struct sector_device *dev, uint32_t sector, const void *data)
+{
+    struct uring_disk *r = dev -> priv;
+    struct uring_slot *slot = uring_pending_write(r, sector);
+    int err = 0;
+
+    // deux écritures du même secteur en vol pourraient se terminer dans le désordre
+    if (slot != NULL) {
+        err = uring_wait(r, &(slot -> req));
+    }
+
+    slot = NULL;
+    while (slot == NULL && !err) {
+        for (size_t i = 0; i < URING_DEPTH && slot == NULL; ++i) {
+            if (r -> slots[i].req.result != SECTOR_REQ_PENDING) {
+                slot = &(r -> slots[i]);
+            }
+        }
+        if (slot == NULL) {
+            err = uring_enter(r, 1);
+        }
+    }
+    if (err) {
+        return err;
+    }
+
+    memcpy(slot -> buf, data, SECTOR_SIZE);
+    slot -> req.sector = sector;
+    slot -> req.count = 1;
+    slot -> req.data = slot -> buf;
+    slot -> req.write = 1;
+    err = uring_queue(dev, &(slot -> req));
+
+    if (!err && r -> to_submit >= URING_SUBMIT_BATCH) {
+        err = uring_enter(r, 0);
+    }
+    return err;
+}
+
+static int uring_flush(struct sector_device *dev)
+{
+    struct uring_disk *r = dev -> priv;
+    int err = uring_wait_all(r);
+
+    if (!err) {
+        err = r -> write_error;
+    }
+    r -> write_error = 0;
+    return err;
+}
+
+static void uring_unmap(struct uring_disk *r)
+{
+    if (r -> sqes != NULL && r -> sqes != MAP_FAILED) {
+        munmap(r -> sqes, r -> sqes_len);
+    }
+    if (r -> cq_ptr != NULL && r -> cq_ptr != MAP_FAILED && r -> cq_ptr != r -> sq_ptr) {
+        munmap(r -> cq_ptr, r -> cq_len);
+    }
+    if (r -> sq_ptr != NULL && r -> sq_ptr != MAP_FAILED) {
+        munmap(r -> sq_ptr, r -> sq_len);
+    }
+    if (r -> ring_fd >= 0) {
+        close(r -> ring_fd);
+    }
+}
+
+static int uring_setup(struct uring_disk *r)
+{
+    struct io_uring_params p;
+    uint8_t *sq = NULL;
+    uint8_t *cq = NULL;
+
+    memset(&p, 0, sizeof(p));
+    r -> ring_fd = (int) syscall(__NR_io_uring_setup, URING_DEPTH, &p);
+    if (r -> ring_fd < 0) {
+        return ERR_IO;
+    }
+
+    r -> sq_entries = p.sq_entries;
+    r -> sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r -> cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        r -> sq_len = r -> cq_len > r -> sq_len ? r -> cq_len : r -> sq_len;
+    }
+
+    r -> sq_ptr = mmap(NULL, r -> sq_len, PROT_READ | PROT_WRITE, MAP_SHARED, r -> ring_fd, IORING_OFF_SQ_RING);
+    if (r -> sq_ptr == MAP_FAILED) {
+        return ERR_IO;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        r -> cq_ptr = r -> sq_ptr;
+    } else {
+        r -> cq_ptr = mmap(NULL, r -> cq_len, PROT_READ | PROT_WRITE, MAP_SHARED, r -> ring_fd, IORING_OFF_CQ_RING);
+        if (r -> cq_ptr == MAP_FAILED) {
+            return ERR_IO;
+        }
+    }
+    r -> sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    r -> sqes = mmap(NULL, r -> sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED, r -> ring_fd, IORING_OFF_SQES);
+    if (r -> sqes == MAP_FAILED) {
+        return ERR_IO;
+    }
+
+    sq = r -> sq_ptr;
+    cq = r -> cq_ptr;
+    r -> sq_head = (unsigned *) (sq + p.sq_off.head);
+    r -> sq_tail = (unsigned *) (sq + p.sq_off.tail);
+    r -> sq_mask = (unsigned *) (sq + p.sq_off.ring_mask);
+    r -> sq_array = (unsigned *) (sq + p.sq_off.array);
+    r -> cq_head = (unsigned *) (cq + p.cq_off.head);
+    r -> cq_tail = (unsigned *) (cq + p.cq_off.tail);
+    r -> cq_mask = (unsigned *) (cq + p.cq_off.ring_mask);
+    r -> cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+    return 0;
+}
+
+static int uring_open(struct sector_device *dev, const char *filename, int flags)
+{
+    struct uring_disk *r = NULL;
+    uint8_t probe[SECTOR_SIZE];
+    int err = 0;
+
+    if (flags & SECTOR_OPEN_CREATE) {
+        return ERR_BAD_PARAMETER;
+    }
+
+    r = calloc(1, sizeof(struct uring_disk));
+    if (r == NULL) {
+        return ERR_NOMEM;
+    }
+    r -> ring_fd = -1;
+    dev -> priv = r;
+
+    dev -> fd = open(filename, (flags & SECTOR_OPEN_RDONLY) ? O_RDONLY : O_RDWR);
+    if (dev -> fd < 0) {
+        err = ERR_IO;
+    }
+    if (!err) {
+        err = uring_setup(r);
+    }
+    // le noyau connaît-il IORING_OP_READ ? (sinon: repli sur sector_fd_ops)
+    if (!err) {
+        err = uring_read_range(dev, BOOTBLOCK_SECTOR, 1, probe);
+    }
+
+    if (err) {
+        uring_unmap(r);
+        if (dev -> fd >= 0) {
+            close(dev -> fd);
+        }
+        free(r);
+        dev -> priv = NULL;
+        dev -> fd = -1;
+    }
+    return err;
+}
+
+static int uring_close(struct sector_device *dev)
+{
+    struct uring_disk *r = dev -> priv;
+    int err = uring_wait_all(r);
+
+    uring_unmap(r);
+    if (close(dev -> fd) != 0 && !err) {
+        err = ERR_IO;
+    }
+    free(r);
+    dev -> priv = NULL;
+    dev -> fd = -1;
+    return err;
+}
+
+const struct sector_ops sector_uring_ops = {
+    .name  = "uring",
+    .open  = uring_open,
+    .read  = uring_read,
+    .write = uring_write,
+    .flush = uring_flush,
+    .close = uring_close,
+    .map   = NULL,
+    .read_range = uring_read_range,
+    .write_range = uring_write_range,
+    .submit = uring_submit,
+    .complete = uring_complete,
+    .resize = NULL,
+    .discard = NULL,
+};
+
+#else /* HAVE_IO_URING */
+
+static int uring_unsupported(struct sector_device *dev, const char *filename, int flags)
+{
+    (void) dev;
+    (void) filename;
+    (void) flags;
+    return ERR_IO;
+}
+
+const struct sector_ops sector_uring_ops = {
+    .name  = "uring",
+    .open  = uring_unsupported,
+};
+
+#endif /* HAVE_IO_URING */
@@ -8,6 +8,7 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <openssl/sha.h>
 #include <string.h>
 #include "mount.h"
@@ -65,27 +66,24 @@ void print_sha_inode(struct unix_filesystem *u, struct inode inode, int inr)
     if (inode.i_mode & IFDIR) {
         printf("no SHA for directories.");
     } else {
-        uint8_t content[inode_getsize(&inode)+1];
-        uint8_t subcontent[SECTOR_SIZE+1];
+        // jusqu'à 16MB avec le secteur doublement indirect: pas sur la pile
+        uint8_t *content = malloc((size_t) inode_getsize(&inode) + 1);
         size_t length = 0;
         struct filev6 f;
-        int error = filev6_open(u, (uint16_t) inr, &f);
+        int error = content == NULL ? ERR_NOMEM : filev6_open(u, (uint16_t) inr, &f);
 
         if (!error) {
-            int lu = 0;
             //getting all the content from inode
-            do {
-                lu = filev6_readblock(&f, subcontent);
-                for(int i = 0; i < lu; ++i) {
-                    content[length + (size_t) + i] = subcontent[i];
-                }
-                length += (size_t)lu;
-                content[length] = 0;
-            } while(lu > 0);
+            int lu = filev6_readbytes(&f, content, inode_getsize(&inode));
+            if (lu > 0) {
+                length = (size_t) lu;
+            }
+            content[length] = 0;
             print_sha_from_content(content, length);
         } else {
             puts(ERR_MESSAGES[error - ERR_FIRST]);
         }
+        free(content);
     }
     printf("\n");
 }
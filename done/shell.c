@@ -16,9 +16,11 @@
 #include "error.h"
 #include "inode.h"
 #include "sha.h"
+#include "histo.h"
+#include "inode_pool.h"
 
 #define MAX_READ 255
-#define NB_CMDS 13
+#define NB_CMDS 22
 #define ERR_OK 0
 #define EXIT 1
 #define ERR_ARGS 2
@@ -28,6 +30,8 @@
 #define NB_ARGS 1
 
 struct unix_filesystem u;
+int mount_flags = 0;   // MOUNTV6_MMAP ou MOUNTV6_URING pour le prochain montage
+int mount_mode = 0;    // MOUNTV6_RDONLY ou MOUNTV6_LAZY pour le prochain montage
 
 typedef int (*shell_fct)(char** fct);
 
@@ -63,6 +67,24 @@ int do_mkdir(char**);
 
 int do_add(char**);
 
+int do_backend(char**);
+
+int do_mode(char**);
+
+int do_sync();
+
+int do_cache(char**);
+
+int do_trim();
+
+int do_iostat();
+
+int do_ioreset();
+
+int do_latency();
+
+int do_ipool();
+
 int tokenize_input (char*, char***, int*);
 
 struct shell_map shell_cmds[] = {
@@ -71,6 +93,8 @@ struct shell_map shell_cmds[] = {
     {"quit", do_exit, "exit shell.", 0, NULL},
     {"mkfs", do_mkfs, "create a new filesystem.", 3, "<diskname> <#inodes> <#blocks>"},
     {"mount", do_mount, "mount the provided filesystem.", 1, "<diskname>"},
+    {"backend", do_backend, "select how the next mount accesses the disk.", 1, "<fd|mmap|uring>"},
+    {"mode", do_mode, "select how the next mount builds the bitmaps (ro: none).", 1, "<rw|lazy|ro>"},
     {"mkdir", do_mkdir, "create a new directory.", 1, "<dirname>"},
     {"lsall", do_lsall, "list all directories and files contained in the currently mounted filesystem.", 0, ""},
     {"add", do_add, "add a new file.", 2, "<src-fullpath> <dst>"},
@@ -78,7 +102,14 @@ struct shell_map shell_cmds[] = {
     {"istat", do_istat, "display information about the provided inode.", 1, "<inode_nr>"},
     {"inode", do_inode, "display the inode number of a file.", 1, "<pathname>"},
     {"sha", do_sha, "display the SHA of a file.", 1, "<pathname>"},
-    {"psb", do_psb, "Print SuperBlock of the currently mounted filesystem.", 0, NULL}
+    {"psb", do_psb, "Print SuperBlock of the currently mounted filesystem.", 0, NULL},
+    {"sync", do_sync, "write the modified sectors of the cache to the disk.", 0, NULL},
+    {"cache", do_cache, "resize the sector cache of the mounted filesystem (0: no cache).", 1, "<#sectors>"},
+    {"trim", do_trim, "punch holes in the disk at the free data sectors.", 0, NULL},
+    {"iostat", do_iostat, "display the sector I/O statistics of the mounted filesystem.", 0, NULL},
+    {"ioreset", do_ioreset, "reset the sector I/O statistics and the latency histograms.", 0, NULL},
+    {"latency", do_latency, "display p50/p99/p999/max latency of the filesystem operations.", 0, NULL},
+    {"ipool", do_ipool, "display the statistics of the free-inode pool of the mounted filesystem.", 0, NULL}
 };
 
 int main()
@@ -149,7 +180,7 @@ int main()
         }
     }
 
-    if (u.f != NULL) {
+    if (u.dev != NULL) {
         umountv6(&u);
     }
 
@@ -245,15 +276,15 @@ int do_mount(char** args)
 {
 
     int err = 0;
-    if (u.f != NULL) {
+    if (u.dev != NULL) {
         err = umountv6(&u);
     }
 
     if (err != 0) return err;
 
-    u.f = NULL;
+    u.dev = NULL;
 
-    err = mountv6(args[1], &u);
+    err = mountv6_with(args[1], &u, mount_flags | mount_mode);
 
     if (err < 0) {
         return err;
@@ -262,9 +293,39 @@ int do_mount(char** args)
     return ERR_OK;
 }
 
+int do_backend(char** args)
+{
+    if (!strcmp(args[1], "fd")) {
+        mount_flags = 0;
+    } else if (!strcmp(args[1], "mmap")) {
+        mount_flags = MOUNTV6_MMAP;
+    } else if (!strcmp(args[1], "uring")) {
+        mount_flags = MOUNTV6_URING;
+    } else {
+        printf("ERROR SHELL: unknown backend %s\n", args[1]);
+        return ERR_ARGS;
+    }
+    return ERR_OK;
+}
+
+int do_mode(char** args)
+{
+    if (!strcmp(args[1], "rw")) {
+        mount_mode = 0;
+    } else if (!strcmp(args[1], "lazy")) {
+        mount_mode = MOUNTV6_LAZY;
+    } else if (!strcmp(args[1], "ro")) {
+        mount_mode = MOUNTV6_RDONLY;
+    } else {
+        printf("ERROR SHELL: unknown mode %s\n", args[1]);
+        return ERR_ARGS;
+    }
+    return ERR_OK;
+}
+
 int do_lsall()
 {
-    if (u.f == NULL) {
+    if (u.dev == NULL) {
         printf("ERROR SHELL: mount the FS before operation\n");
         return ERR_NOT_MOUNTED;
     }
@@ -280,7 +341,7 @@ int do_lsall()
 
 int do_psb()
 {
-    if (u.f == NULL) {
+    if (u.dev == NULL) {
         printf("ERROR SHELL: mount the FS before operation\n");
         return ERR_NOT_MOUNTED;
     }
@@ -296,7 +357,7 @@ int do_cat(char** args)
     struct filev6 file;
     char content[SECTOR_SIZE+1] = "";
 
-    if (u.f == NULL) {
+    if (u.dev == NULL) {
         printf("ERROR SHELL: mount the FS before operation\n");
         return ERR_NOT_MOUNTED;
     }
@@ -335,7 +396,7 @@ int do_sha(char** args)
     int err = 0;
     struct filev6 file;
 
-    if (u.f == NULL) {
+    if (u.dev == NULL) {
         printf("ERROR SHELL: mount the FS before operation\n");
         return ERR_NOT_MOUNTED;
     }
@@ -362,7 +423,7 @@ int do_inode (char** args)
 {
     int inode_nb = 0;
 
-    if (u.f == NULL) {
+    if (u.dev == NULL) {
         printf("ERROR SHELL: mount the FS before operation\n");
         return ERR_NOT_MOUNTED;
     }
@@ -383,7 +444,7 @@ int do_istat(char** args)
 
     struct inode i;
 
-    if (u.f == NULL) {
+    if (u.dev == NULL) {
         printf("ERROR SHELL: mount the FS before operation\n");
         return ERR_NOT_MOUNTED;
     }
@@ -430,7 +491,7 @@ int do_mkfs(char** args)
 int do_mkdir(char** args)
 {
     int err = 0;
-    if (u.f == NULL) {
+    if (u.dev == NULL) {
         printf("ERROR SHELL: mount the FS before operation\n");
         return ERR_NOT_MOUNTED;
     }
@@ -451,7 +512,7 @@ int do_add(char** args)
     char* data = NULL;
     int k = 0;
 
-    if (u.f == NULL) {
+    if (u.dev == NULL) {
         printf("ERROR SHELL: mount the FS before operation\n");
         return ERR_NOT_MOUNTED;
     }
@@ -512,3 +573,98 @@ int do_add(char** args)
     return ERR_OK;
 }
 
+int do_sync()
+{
+    if (u.dev == NULL) {
+        printf("ERROR SHELL: mount the FS before operation\n");
+        return ERR_NOT_MOUNTED;
+    }
+
+    int err = mountv6_sync(&u);
+    if (err < 0) {
+        return err;
+    }
+
+    return ERR_OK;
+}
+
+int do_cache(char** args)
+{
+    if (u.dev == NULL) {
+        printf("ERROR SHELL: mount the FS before operation\n");
+        return ERR_NOT_MOUNTED;
+    }
+
+    int nb_sectors = atoi(args[1]);
+    if (nb_sectors < 0) {
+        printf("ERROR SHELL: invalid cache size\n");
+        return ERR_ARGS;
+    }
+
+    int err = sector_cache_setup(u.dev, (size_t) nb_sectors);
+    if (err < 0) {
+        return err;
+    }
+
+    return ERR_OK;
+}
+
+int do_trim()
+{
+    if (u.dev == NULL) {
+        printf("ERROR SHELL: mount the FS before operation\n");
+        return ERR_NOT_MOUNTED;
+    }
+
+    int discarded = mountv6_trim(&u);
+    if (discarded < 0) {
+        return discarded;
+    }
+    printf("%d sectors discarded\n", discarded);
+
+    return ERR_OK;
+}
+
+int do_iostat()
+{
+    if (u.dev == NULL) {
+        printf("ERROR SHELL: mount the FS before operation\n");
+        return ERR_NOT_MOUNTED;
+    }
+
+    sector_stats_print(stdout, u.dev);
+
+    return ERR_OK;
+}
+
+int do_ioreset()
+{
+    if (u.dev == NULL) {
+        printf("ERROR SHELL: mount the FS before operation\n");
+        return ERR_NOT_MOUNTED;
+    }
+
+    sector_stats_reset(u.dev);
+    histo_reset();
+
+    return ERR_OK;
+}
+
+int do_latency()
+{
+    histo_print(stdout);
+
+    return ERR_OK;
+}
+
+int do_ipool()
+{
+    if (u.dev == NULL) {
+        printf("ERROR SHELL: mount the FS before operation\n");
+        return ERR_NOT_MOUNTED;
+    }
+
+    inode_pool_print(stdout, &u);
+
+    return ERR_OK;
+}
@@ -0,0 +1,174 @@
+/**
+ * @file test-bigfile.c
+ * @brief tests of the write path of large files (filev6.c)
+ *
+ * A file is written on a fresh disk across INODE_DOUBLE_OFF (the first
+ * sector found through the double-indirect sector i_addr[7]) and up to
+ * INODE_MAX_SIZE, then read back before and after a remount; one more
+ * byte is ERR_FILE_TOO_LARGE. The disk is created in the temporary
+ * directory ($TMPDIR, /tmp by default) and removed at the end.
+ *
+ * @author José Ferro Pinto
+ * @author Marc Favrod-Coune
+ * @date march 2017
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "error.h"
+#include "mount.h"
+#include "filev6.h"
+#include "inode.h"
+#include "unixv6fs.h"
+
+#define BIG_CHUNK 65536
+
+static int failures = 0;
+
+static void check(int ok, const char *what)
+{
+    printf("%s: %s\n", what, ok ? "ok" : "FAILED");
+    if (!ok) {
+        ++failures;
+    }
+}
+
+//Helper: the byte at offset off of the big file
+static uint8_t big_byte(int32_t off)
+{
+    return (uint8_t) (off * 31 + off / SECTOR_SIZE);
+}
+
+//Helper: write the bytes [from, to) of the big file
+static int big_write(struct unix_filesystem *u, struct filev6 *f, int32_t from, int32_t to)
+{
+    uint8_t *data = malloc(BIG_CHUNK);
+    int err = data == NULL ? ERR_NOMEM : 0;
+
+    while (!err && from < to) {
+        const int len = to - from < BIG_CHUNK ? to - from : BIG_CHUNK;
+        for (int k = 0; k < len; ++k) {
+            data[k] = big_byte(from + k);
+        }
+        err = filev6_writebytes(u, f, data, len);
+        from += len;
+    }
+    free(data);
+    return err;
+}
+
+//Helper: read back the bytes [from, to) of the big file; 0 if they are right
+static int big_check(const struct unix_filesystem *u, uint16_t inr, int32_t from, int32_t to)
+{
+    struct filev6 f;
+    uint8_t *data = malloc(BIG_CHUNK);
+    int err = data == NULL ? ERR_NOMEM : filev6_open(u, inr, &f);
+
+    if (!err) {
+        err = filev6_lseek(&f, from);
+    }
+    while (!err && from < to) {
+        const int len = to - from < BIG_CHUNK ? to - from : BIG_CHUNK;
+        int nb = filev6_readbytes(&f, data, len);
+        if (nb != len) {
+            err = nb < 0 ? nb : ERR_IO;
+        }
+        for (int k = 0; !err && k < len; ++k) {
+            if (data[k] != big_byte(from + k)) {
+                printf("byte %d differs\n", from + k);
+                err = ERR_IO;
+            }
+        }
+        from += len;
+    }
+    free(data);
+    return err;
+}
+
+static void test_big_file(const char *disk)
+{
+    struct unix_filesystem big;
+    struct filev6 f;
+    const int32_t across = INODE_DOUBLE_OFF * SECTOR_SIZE + 1000;
+    int mounted = 0;
+    int err = mountv6_mkfs(disk, 65535, 16);
+
+    if (!err) {
+        err = mountv6(disk, &big);
+        mounted = !err;
+    }
+    if (!err) {
+        err = inode_alloc(&big);
+    }
+    if (err >= 0) {
+        f.i_number = (uint16_t) err;
+        err = filev6_create(&big, IALLOC, &f);
+    }
+    check(err == 0, "create the file");
+
+    if (!err) {
+        err = big_write(&big, &f, 0, across);
+        if (!err) {
+            err = big_check(&big, f.i_number, across - 2 * SECTOR_SIZE - 1000, across);
+        }
+        check(err == 0, "across the double-indirect sector");
+    }
+    if (!err) {
+        err = big_write(&big, &f, across, INODE_MAX_SIZE);
+        check(err == 0, "up to INODE_MAX_SIZE");
+    }
+    if (!err) {
+        uint8_t one = 0;
+        check(filev6_writebytes(&big, &f, &one, 1) == ERR_FILE_TOO_LARGE,
+              "one more byte is ERR_FILE_TOO_LARGE");
+    }
+
+    if (!err) {
+        mounted = 0;
+        err = umountv6(&big);
+        if (!err) {
+            err = mountv6(disk, &big);
+            mounted = !err;
+        }
+        check(err == 0, "remount");
+    }
+    if (!err) {
+        err = big_check(&big, f.i_number, 0, INODE_MAX_SIZE);
+        check(err == 0, "read back after remount");
+    }
+    if (err) {
+        printf("%s\n", ERR_MESSAGES[err - ERR_FIRST]);
+    }
+    if (mounted) {
+        umountv6(&big);
+    }
+}
+
+int main(void)
+{
+    const char *dir = getenv("TMPDIR");
+    char disk[4096];
+    int fd = -1;
+
+    if (dir == NULL || dir[0] == '\0') {
+        dir = "/tmp";
+    }
+    snprintf(disk, sizeof(disk), "%s/test-bigfile-XXXXXX", dir);
+    fd = mkstemp(disk);
+    if (fd < 0) {
+        printf("cannot create a disk in %s\n", dir);
+        return 1;
+    }
+    close(fd);
+
+    test_big_file(disk);
+    remove(disk);
+
+    printf("big files: %s\n", failures == 0 ? "ok" : "FAILED");
+    return failures == 0 ? 0 : 1;
+}
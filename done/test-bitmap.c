@@ -1,9 +1,330 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 #include "bmblock.h"
 #include "error.h"
 
+/*
+ * Each function below changes a bitmap and a naive model of it (one byte
+ * per value, 1 = used) the same way, then compares them: the bits, the two
+ * summary levels, bm_count() and bm_find_zero(). The checks are run with
+ * each kernel set of this CPU.
+ */
+
+// nombre de valeurs des bitmaps testées: mots partiels, mots entiers, deux mots de top[]
+static const uint64_t sizes[] = { 1, 63, 64, 65, 130, 4096 + 70, 64 * 4096 + 5 };
+
+#define TEST_MIN UINT64_C(4)
+
+static int failures = 0;
+static uint64_t rand_state = 88172645463325252u;
+
+static uint64_t test_rand(void)
+{
+    // xorshift64: la même suite à chaque exécution
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 7;
+    rand_state ^= rand_state << 17;
+    return rand_state;
+}
+
+static void check(int ok, const char *what, uint64_t nb, uint64_t arg)
+{
+    if (!ok) {
+        ++failures;
+        printf("FAIL %s (size %lu, %lu)\n", what, (unsigned long) nb, (unsigned long) arg);
+    }
+}
+
+/**
+ * @brief compare b with its model m, and the summary levels with the bits
+ */
+static void check_model(struct bmblock_array *b, const uint8_t *m, const char *what)
+{
+    const uint64_t nb = b -> max - b -> min + 1;
+    uint64_t used = 0;
+
+    for (uint64_t k = 0; k < nb; ++k) {
+        used += m[k];
+        if (bm_get(b, b -> min + k) != m[k]) {
+            check(0, what, nb, k);
+            return;
+        }
+    }
+    check(bm_count(b) == used, what, nb, used);
+
+    for (size_t i = 0; i < b -> length; ++i) {
+        int free_bit = 0;
+        for (uint64_t k = i * BITS_PER_VECTOR; k < (i + 1) * BITS_PER_VECTOR && k < nb; ++k) {
+            free_bit |= !m[k];
+        }
+        check(!!(b -> summary[i / BITS_PER_VECTOR] & (UINT64_C(1) << (i % BITS_PER_VECTOR))) == free_bit,
+              "summary", nb, i);
+    }
+    for (size_t j = 0; j < (b -> length + BITS_PER_VECTOR - 1) / BITS_PER_VECTOR; ++j) {
+        check(!!(b -> top[j / BITS_PER_VECTOR] & (UINT64_C(1) << (j % BITS_PER_VECTOR))) == (b -> summary[j] != 0),
+              "top", nb, j);
+    }
+
+    // le premier libre depuis quelques points, dont les bords de mots
+    const uint64_t starts[] = { 0, 1, 63, 64, 65, nb / 2, nb - 1 };
+    for (size_t s = 0; s < sizeof(starts) / sizeof(starts[0]); ++s) {
+        int expected = ERR_NO_PLACE;
+        for (uint64_t k = starts[s]; k < nb; ++k) {
+            if (!m[k]) {
+                expected = (int) (b -> min + k);
+                break;
+            }
+        }
+        if (starts[s] < nb) {
+            check(bm_find_zero(b, b -> min + starts[s]) == expected, "bm_find_zero", nb, starts[s]);
+        }
+    }
+}
+
+/**
+ * @brief bm_set_range() and bm_clear_range() over word boundaries, the last
+ *        partial word and past max
+ */
+static void test_ranges(uint64_t nb)
+{
+    struct bmblock_array *b = bm_alloc(TEST_MIN, TEST_MIN + nb - 1);
+    uint8_t *m = calloc(nb, 1);
+    const uint64_t firsts[] = { 0, 1, 63, 64, 65, 127, nb - 1 };
+    const uint64_t lengths[] = { 1, 62, 63, 64, 65, 128, 129, nb };
+
+    if (b == NULL || m == NULL) {
+        check(0, "alloc", nb, 0);
+        free(b);
+        free(m);
+        return;
+    }
+    for (size_t f = 0; f < sizeof(firsts) / sizeof(firsts[0]); ++f) {
+        for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); ++l) {
+            const uint64_t x = firsts[f];
+            const int set = (f + l) % 2 == 0;
+            if (x >= nb) {
+                continue;
+            }
+            // la partie après max est ignorée
+            for (uint64_t k = x; k < x + lengths[l] && k < nb; ++k) {
+                m[k] = (uint8_t) set;
+            }
+            if (set) {
+                bm_set_range(b, TEST_MIN + x, lengths[l]);
+            } else {
+                bm_clear_range(b, TEST_MIN + x, lengths[l]);
+            }
+        }
+        check_model(b, m, "bm_set_range/bm_clear_range");
+    }
+    free(b);
+    free(m);
+}
+
+/**
+ * @brief the summary bits when the bitmap becomes full, then one bit free
+ *        in the last (partial) word, in the middle word, then empty
+ */
+static void test_summary(uint64_t nb)
+{
+    struct bmblock_array *b = bm_alloc(TEST_MIN, TEST_MIN + nb - 1);
+    uint8_t *m = calloc(nb, 1);
+
+    if (b == NULL || m == NULL) {
+        check(0, "alloc", nb, 0);
+        free(b);
+        free(m);
+        return;
+    }
+    check_model(b, m, "empty");
+
+    bm_set_range(b, TEST_MIN, nb);
+    memset(m, 1, nb);
+    check_model(b, m, "full");
+    check(bm_find_next(b) == ERR_NO_PLACE, "bm_find_next full", nb, 0);
+
+    bm_clear(b, TEST_MIN + nb - 1);
+    m[nb - 1] = 0;
+    check_model(b, m, "last bit free");
+    check(bm_find_next(b) == (int) (TEST_MIN + nb - 1), "bm_find_next last", nb, 0);
+
+    bm_set(b, TEST_MIN + nb - 1);
+    bm_clear(b, TEST_MIN + nb / 2);
+    m[nb - 1] = 1;
+    m[nb / 2] = 0;
+    check_model(b, m, "middle bit free");
+
+    bm_clear_range(b, TEST_MIN, nb);
+    memset(m, 0, nb);
+    check_model(b, m, "empty again");
+    free(b);
+    free(m);
+}
+
+/**
+ * @brief the first run of n free values of the model: from goal on, else
+ *        one starting before goal (which may end past it)
+ */
+static int model_find_run(const uint8_t *m, uint64_t nb, uint64_t n, uint64_t from)
+{
+    for (int pass = 0; pass < 2; ++pass) {
+        const uint64_t lo = pass == 0 ? from : 0;
+        const uint64_t hi = pass == 0 ? nb : from;
+        for (uint64_t s = lo; s < hi && s + n <= nb; ++s) {
+            uint64_t k = 0;
+            while (k < n && !m[s + k]) {
+                ++k;
+            }
+            if (k == n) {
+                return (int) (TEST_MIN + s);
+            }
+        }
+    }
+    return ERR_NO_PLACE;
+}
+
+/**
+ * @brief bm_find_run() on random bitmaps, and a run found in the second
+ *        pass that ends past the goal
+ */
+static void test_find_run(uint64_t nb)
+{
+    struct bmblock_array *b = bm_alloc(TEST_MIN, TEST_MIN + nb - 1);
+    uint8_t *m = calloc(nb, 1);
+    const uint64_t runs[] = { 1, 2, 63, 64, 65, 200 };
+
+    if (b == NULL || m == NULL) {
+        check(0, "alloc", nb, 0);
+        free(b);
+        free(m);
+        return;
+    }
+    for (uint64_t k = 0; k < nb; ++k) {
+        // des suites libres de longueurs variées
+        m[k] = (uint8_t) ((test_rand() % 100) < 3);
+        if (m[k]) {
+            bm_set(b, TEST_MIN + k);
+        }
+    }
+    for (int t = 0; t < 20; ++t) {
+        const uint64_t n = runs[test_rand() % (sizeof(runs) / sizeof(runs[0]))];
+        const uint64_t from = test_rand() % nb;
+        const int expected = model_find_run(m, nb, n, from);
+        const int found = bm_find_run(b, n, TEST_MIN + from);
+        check(found == expected, "bm_find_run", nb, n);
+        if (found >= 0) {
+            memset(m + (found - TEST_MIN), 1, n);
+        }
+    }
+    check_model(b, m, "bm_find_run");
+
+    if (nb >= 130) {
+        // seules [90, 110) sont libres: la suite de 20 commence avant le but 100
+        bm_set_range(b, TEST_MIN, nb);
+        bm_clear_range(b, TEST_MIN + 90, 20);
+        check(bm_find_run(b, 20, TEST_MIN + 100) == (int) (TEST_MIN + 90), "bm_find_run past goal", nb, 20);
+        check(bm_find_run(b, 1, TEST_MIN + 100) == ERR_NO_PLACE, "bm_find_run full", nb, 1);
+    }
+    free(b);
+    free(m);
+}
+
+/**
+ * @brief bm_export() byte layout, bm_import() (the bits after max are
+ *        ignored) and bm_combine()
+ */
+static void test_export_combine(uint64_t nb)
+{
+    struct bmblock_array *a = bm_alloc(TEST_MIN, TEST_MIN + nb - 1);
+    struct bmblock_array *b = bm_alloc(TEST_MIN, TEST_MIN + nb - 1);
+    struct bmblock_array *other = bm_alloc(TEST_MIN + 1, TEST_MIN + nb);
+    uint8_t *ma = calloc(nb, 1);
+    uint8_t *mb = calloc(nb, 1);
+    uint8_t *data = NULL;
+
+    if (a == NULL || b == NULL || other == NULL || ma == NULL || mb == NULL
+        || (data = calloc(bm_size(a), 1)) == NULL) {
+        check(0, "alloc", nb, 0);
+    } else {
+        for (uint64_t k = 0; k < nb; ++k) {
+            ma[k] = (uint8_t) (test_rand() & 1);
+            mb[k] = (uint8_t) (test_rand() & 1);
+            if (ma[k]) {
+                bm_set(a, TEST_MIN + k);
+            }
+            if (mb[k]) {
+                bm_set(b, TEST_MIN + k);
+            }
+        }
+
+        bm_export(a, data);
+        for (uint64_t k = 0; k < nb; ++k) {
+            if (((data[k / 8] >> (k % 8)) & 1) != ma[k]) {
+                check(0, "bm_export", nb, k);
+                break;
+            }
+        }
+        // des bits au-delà de max dans les données lues
+        memset(data + (nb + 7) / 8, 0xff, bm_size(a) - (nb + 7) / 8);
+        if (nb % 8 != 0) {
+            data[nb / 8] |= (uint8_t) (0xff << (nb % 8));
+        }
+        bm_import(b, data);
+        check_model(b, ma, "bm_import");
+        // et ne reviennent pas à l'export
+        bm_export(b, data);
+        for (uint64_t k = nb; k < 8 * (uint64_t) bm_size(b); ++k) {
+            if ((data[k / 8] >> (k % 8)) & 1) {
+                check(0, "bm_import after max", nb, k);
+                break;
+            }
+        }
+
+        for (uint64_t k = 0; k < nb; ++k) {
+            mb[k] = (uint8_t) (test_rand() & 1);
+        }
+        bm_clear_range(b, TEST_MIN, nb);
+        for (uint64_t k = 0; k < nb; ++k) {
+            if (mb[k]) {
+                bm_set(b, TEST_MIN + k);
+            }
+        }
+        const enum bm_op ops[] = { BM_AND, BM_OR, BM_XOR };
+        for (size_t o = 0; o < sizeof(ops) / sizeof(ops[0]); ++o) {
+            check(bm_combine(a, b, ops[o]) == 0, "bm_combine", nb, o);
+            for (uint64_t k = 0; k < nb; ++k) {
+                ma[k] = (uint8_t) (ops[o] == BM_AND ? ma[k] & mb[k] : ops[o] == BM_OR ? ma[k] | mb[k] : ma[k] ^ mb[k]);
+            }
+            check_model(a, ma, "bm_combine");
+        }
+        check(bm_combine(a, other, BM_OR) == ERR_BAD_PARAMETER, "bm_combine other values", nb, 0);
+    }
+    free(a);
+    free(b);
+    free(other);
+    free(ma);
+    free(mb);
+    free(data);
+}
+
+/**
+ * @brief run all the checks with the kernels in use
+ */
+static void test_kernel(void)
+{
+    const int before = failures;
+
+    for (size_t k = 0; k < sizeof(sizes) / sizeof(sizes[0]); ++k) {
+        test_ranges(sizes[k]);
+        test_summary(sizes[k]);
+        test_find_run(sizes[k]);
+        test_export_combine(sizes[k]);
+    }
+    printf("kernel %s: %s\n", bm_kernel_name(), failures == before ? "ok" : "FAILED");
+}
+
 int main ()
 {
     struct bmblock_array* b;
@@ -43,5 +364,13 @@ int main ()
     } else {
         printf("Probleme!\n");
     }
-    return 0;
+
+    const enum bm_kernel kinds[] = { BM_KERNEL_SCALAR, BM_KERNEL_SSE, BM_KERNEL_AVX2 };
+    for (size_t k = 0; k < sizeof(kinds) / sizeof(kinds[0]); ++k) {
+        if (bm_set_kernel(kinds[k]) == 0) {
+            test_kernel();
+        }
+    }
+    bm_set_kernel(BM_KERNEL_AUTO);
+    return failures == 0 ? 0 : 1;
 }
@@ -0,0 +1,420 @@
+/**
+ * @file test-cache.c
+ * @brief tests of the write-back sector cache (sector_cache.c)
+ *
+ * The device is opened with a spy backend: sector_fd_ops, plus a log of
+ * the reads and writes the cache gives to the backend. The log shows the
+ * elevator order, the merge of adjacent dirty sectors (FLUSH_MAX_RUN) and
+ * the write-back before a range read; a second device without cache reads
+ * the disk back to check its contents.
+ *
+ * @author José Ferro Pinto
+ * @author Marc Favrod-Coune
+ * @date march 2017
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "error.h"
+#include "unixv6fs.h"
+#include "sector.h"
+
+#define TEST_DISK "test-cache.uv6"
+#define NB_SECTORS 1024
+#define CACHE_SIZE 128
+#define LOG_SIZE 512
+
+// une opération reçue par le backend
+struct spy_op {
+    char op;          // 'r' read, 'R' read_range, 'w' write, 'W' write_range
+    uint32_t first;
+    uint32_t count;
+};
+
+static struct spy_op spy_log[LOG_SIZE];
+static size_t spy_len = 0;
+static int spy_fail = 0;   // les écritures de plages échouent
+static int failures = 0;
+
+// contenu attendu du disque
+static uint8_t model[NB_SECTORS][SECTOR_SIZE];
+
+static void spy_record(char op, uint32_t first, uint32_t count)
+{
+    if (spy_len < LOG_SIZE) {
+        spy_log[spy_len].op = op;
+        spy_log[spy_len].first = first;
+        spy_log[spy_len].count = count;
+    }
+    ++spy_len;
+}
+
+static int spy_open(struct sector_device *dev, const char *filename, int flags)
+{
+    return sector_fd_ops.open(dev, filename, flags);
+}
+
+static int spy_read(struct sector_device *dev, uint32_t sector, void *data)
+{
+    spy_record('r', sector, 1);
+    return sector_fd_ops.read(dev, sector, data);
+}
+
+static int spy_write(struct sector_device *dev, uint32_t sector, const void *data)
+{
+    spy_record('w', sector, 1);
+    return sector_fd_ops.write(dev, sector, data);
+}
+
+static int spy_close(struct sector_device *dev)
+{
+    return sector_fd_ops.close(dev);
+}
+
+static int spy_read_range(struct sector_device *dev, uint32_t first, uint32_t count, void *data)
+{
+    spy_record('R', first, count);
+    return sector_fd_ops.read_range(dev, first, count, data);
+}
+
+static int spy_write_range(struct sector_device *dev, uint32_t first, uint32_t count, const void *data)
+{
+    spy_record('W', first, count);
+    if (spy_fail) {
+        return ERR_IO;
+    }
+    return sector_fd_ops.write_range(dev, first, count, data);
+}
+
+// synchrone (pas de submit): les requêtes passent par read_range/write_range
+static const struct sector_ops spy_ops = {
+    .name = "spy",
+    .open = spy_open,
+    .read = spy_read,
+    .write = spy_write,
+    .flush = NULL,
+    .close = spy_close,
+    .read_range = spy_read_range,
+    .write_range = spy_write_range
+};
+
+static void check(int ok, const char *what)
+{
+    if (!ok) {
+        ++failures;
+        printf("FAIL %s\n", what);
+    }
+}
+
+//Helper: check that the backend received exactly the n operations of ops
+static void check_log(const struct spy_op *ops, size_t n, const char *what)
+{
+    int ok = spy_len == n;
+
+    for (size_t i = 0; ok && i < n; ++i) {
+        ok = spy_log[i].op == ops[i].op && spy_log[i].first == ops[i].first
+             && spy_log[i].count == ops[i].count;
+    }
+    if (!ok) {
+        printf("backend log of %s:", what);
+        for (size_t i = 0; i < spy_len && i < LOG_SIZE; ++i) {
+            printf(" %c(%u,%u)", spy_log[i].op, spy_log[i].first, spy_log[i].count);
+        }
+        printf("\n");
+    }
+    check(ok, what);
+    spy_len = 0;
+}
+
+//Helper: a new content of sector, written in buf and in the model
+static void fill(uint32_t sector, uint8_t version, uint8_t *buf)
+{
+    for (int k = 0; k < SECTOR_SIZE; ++k) {
+        buf[k] = (uint8_t) (sector * 7 + version * 13 + k);
+    }
+}
+
+//Helper: write sector through dev and the model
+static int put(struct sector_device *dev, uint32_t sector, uint8_t version)
+{
+    fill(sector, version, model[sector]);
+    return sector_write(dev, sector, model[sector]);
+}
+
+//Helper: read the whole disk without cache and compare it with the model
+static void check_disk(const struct sector_device *dev, const char *what)
+{
+    struct sector_device *raw = NULL;
+    uint8_t buf[SECTOR_SIZE];
+    int err = sector_reopen(dev, SECTOR_OPEN_RDONLY, &raw);
+
+    if (!err) {
+        // la copie lit le disque sans passer par l'espion: rien dans le journal
+        raw -> ops = &sector_fd_ops;
+    }
+    for (uint32_t s = 0; !err && s < NB_SECTORS; ++s) {
+        err = sector_read(raw, s, buf);
+        if (!err && memcmp(buf, model[s], SECTOR_SIZE) != 0) {
+            printf("sector %u differs\n", s);
+            err = ERR_IO;
+        }
+    }
+    if (raw != NULL) {
+        sector_close(raw);
+    }
+    check(err == 0, what);
+}
+
+static uint64_t total_writes(const struct sector_device *dev)
+{
+    uint64_t n = 0;
+    for (int c = 0; c < SECTOR_NB_CLASSES; ++c) {
+        n += dev -> stats.classes[c].writes;
+    }
+    return n;
+}
+
+static uint64_t total_hits(const struct sector_device *dev)
+{
+    uint64_t n = 0;
+    for (int c = 0; c < SECTOR_NB_CLASSES; ++c) {
+        n += dev -> stats.classes[c].hits;
+    }
+    return n;
+}
+
+/*
+ * 100 adjacent sectors written in reverse order and two isolated ones:
+ * nothing reaches the disk before the flush, which writes them by
+ * increasing sector number, in runs of at most 64 sectors.
+ */
+static void test_flush(struct sector_device *dev)
+{
+    const struct spy_op expected[] = {
+        { 'W', 10, 64 }, { 'W', 74, 36 }, { 'w', 200, 1 }, { 'w', 202, 1 }
+    };
+    int err = 0;
+
+    sector_stats_reset(dev);
+    err = put(dev, 202, 1);
+    for (uint32_t s = 110; !err && s-- > 10;) {
+        err = put(dev, s, 1);
+    }
+    if (!err) {
+        err = put(dev, 200, 1);
+    }
+    check(err == 0, "flush: writes in the cache");
+    check_log(NULL, 0, "flush: writes stay in the cache");
+
+    err = sector_flush(dev);
+    check(err == 0, "flush: sector_flush");
+    check_log(expected, sizeof(expected) / sizeof(expected[0]), "flush: elevator order, runs of 64");
+    check(total_writes(dev) == 102, "flush: stats count the 102 sectors written");
+    check(dev -> stats.classes[SECTOR_CLASS_OTHER].bytes_written == 102 * SECTOR_SIZE,
+          "flush: stats count the bytes written");
+    check_disk(dev, "flush: disk contents");
+
+    err = sector_flush(dev);
+    check(err == 0, "flush: second sector_flush");
+    check_log(NULL, 0, "flush: clean sectors are not written again");
+}
+
+/*
+ * A full cache of dirty sectors: the next sector needs a victim, and the
+ * whole cache is written back (in two runs) before it is reused.
+ */
+static void test_victim(struct sector_device *dev)
+{
+    const struct spy_op expected[] = {
+        { 'W', 300, 64 }, { 'W', 364, 64 }
+    };
+    int err = 0;
+
+    for (uint32_t s = 300; !err && s < 300 + CACHE_SIZE; ++s) {
+        err = put(dev, s, 2);
+    }
+    check(err == 0, "victim: fill the cache");
+    check_log(NULL, 0, "victim: a full cache is not written back");
+
+    err = put(dev, 600, 2);
+    check(err == 0, "victim: one more sector");
+    check_log(expected, sizeof(expected) / sizeof(expected[0]), "victim: dirty victim writes the whole cache back");
+
+    err = sector_flush(dev);
+    const struct spy_op last[] = { { 'w', 600, 1 } };
+    check(err == 0, "victim: sector_flush");
+    check_log(last, 1, "victim: only the new sector is left dirty");
+    check_disk(dev, "victim: disk contents");
+}
+
+/*
+ * Range accesses go around the cache: a range read writes the dirty
+ * sectors of the range back first; a range write refreshes the cached
+ * copies, which are clean afterwards; a discard drops them, even dirty.
+ */
+static void test_ranges(struct sector_device *dev)
+{
+    uint8_t buf[4 * SECTOR_SIZE];
+    uint8_t one[SECTOR_SIZE];
+    uint64_t hits = 0;
+    int err = 0;
+
+    // lecture d'une plage dont un secteur est modifié dans le cache
+    err = put(dev, 701, 3);
+    if (!err) {
+        err = put(dev, 702, 3);
+    }
+    spy_len = 0;
+    if (!err) {
+        err = sector_read_range(dev, 700, 4, buf);
+    }
+    const struct spy_op rd[] = { { 'W', 701, 2 }, { 'R', 700, 4 } };
+    check(err == 0, "read_range");
+    check_log(rd, 2, "read_range: dirty sectors written back first");
+    check(memcmp(buf, model[700], sizeof(buf)) == 0, "read_range: data");
+
+    // écriture d'une plage dont les secteurs sont en cache, propres ou modifiés
+    err = sector_read(dev, 800, one);
+    if (!err) {
+        err = put(dev, 801, 4);
+    }
+    for (uint32_t s = 800; s < 804; ++s) {
+        fill(s, 5, model[s]);
+    }
+    spy_len = 0;
+    if (!err) {
+        err = sector_write_range(dev, 800, 4, model[800]);
+    }
+    const struct spy_op wr[] = { { 'W', 800, 4 } };
+    check(err == 0, "write_range");
+    check_log(wr, 1, "write_range: a single write");
+
+    hits = total_hits(dev);
+    err = sector_read(dev, 800, one);
+    if (!err) {
+        err = memcmp(one, model[800], SECTOR_SIZE) == 0 ? 0 : ERR_IO;
+    }
+    if (!err) {
+        err = sector_read(dev, 801, one);
+    }
+    if (!err) {
+        err = memcmp(one, model[801], SECTOR_SIZE) == 0 ? 0 : ERR_IO;
+    }
+    check(err == 0, "write_range: cached copies refreshed");
+    check(total_hits(dev) == hits + 2, "write_range: refreshed copies are hits");
+    check_log(NULL, 0, "write_range: no read of the refreshed copies");
+
+    err = sector_flush(dev);
+    check(err == 0, "write_range: sector_flush");
+    check_log(NULL, 0, "write_range: refreshed copies are clean");
+
+    // une écriture qui échoue laisse le cache tel quel: la copie propre reste
+    // l'ancienne, la copie modifiée sera encore écrite
+    err = sector_read(dev, 850, one);
+    if (!err) {
+        err = put(dev, 851, 7);
+    }
+    uint8_t lost[2 * SECTOR_SIZE];
+    fill(850, 8, lost);
+    fill(851, 8, lost + SECTOR_SIZE);
+    spy_fail = 1;
+    check(err == 0 && sector_write_range(dev, 850, 2, lost) == ERR_IO, "failed write_range");
+    spy_fail = 0;
+    err = sector_read(dev, 850, one);
+    check(err == 0 && memcmp(one, model[850], SECTOR_SIZE) == 0, "failed write_range: clean copy unchanged");
+    spy_len = 0;
+    err = sector_flush(dev);
+    const struct spy_op again[] = { { 'w', 851, 1 } };
+    check(err == 0, "failed write_range: sector_flush");
+    check_log(again, 1, "failed write_range: dirty copy still written");
+
+    // un secteur modifié puis abandonné n'est jamais écrit
+    err = put(dev, 900, 6);
+    if (!err) {
+        memset(model[900], 0, SECTOR_SIZE);
+        err = sector_discard(dev, 900, 1);
+    }
+    check(err == 0, "discard");
+    spy_len = 0;
+    err = sector_flush(dev);
+    check(err == 0, "discard: sector_flush");
+    check_log(NULL, 0, "discard: the dropped copy is not written");
+    check_disk(dev, "ranges: disk contents");
+}
+
+/*
+ * Read-ahead goes to the cold quarter of the cache: prefetching twice as
+ * many sectors as the cold list holds, then reading them, leaves the
+ * sectors read before in the cache.
+ */
+static void test_prefetch(struct sector_device *dev)
+{
+    uint32_t ahead[CACHE_SIZE / 4];
+    uint8_t one[SECTOR_SIZE];
+    uint64_t hits = 0;
+    int err = 0;
+
+    // 96 secteurs lus à la demande: les métadonnées du cache
+    for (uint32_t s = 0; !err && s < 96; ++s) {
+        err = sector_read(dev, s, one);
+    }
+    for (uint32_t round = 0; !err && round < 2; ++round) {
+        for (uint32_t k = 0; k < CACHE_SIZE / 4; ++k) {
+            ahead[k] = 500 + round * CACHE_SIZE / 4 + k;
+        }
+        err = sector_prefetch(dev, ahead, CACHE_SIZE / 4);
+        hits = total_hits(dev);
+        for (uint32_t k = 0; !err && k < CACHE_SIZE / 4; ++k) {
+            err = sector_read(dev, ahead[k], one);
+            if (!err && memcmp(one, model[ahead[k]], SECTOR_SIZE) != 0) {
+                err = ERR_IO;
+            }
+        }
+        check(err == 0 && total_hits(dev) == hits + CACHE_SIZE / 4, "prefetch: read-ahead sectors are hits");
+    }
+    spy_len = 0;
+
+    hits = total_hits(dev);
+    for (uint32_t s = 0; !err && s < 96; ++s) {
+        err = sector_read(dev, s, one);
+    }
+    check(err == 0, "prefetch: read again");
+    check(total_hits(dev) == hits + 96, "prefetch: read-ahead did not evict the other sectors");
+    check_log(NULL, 0, "prefetch: no backend read for the other sectors");
+}
+
+int main(void)
+{
+    struct sector_device *dev = NULL;
+    int err = sector_open(&spy_ops, TEST_DISK, SECTOR_OPEN_CREATE, &dev);
+
+    memset(model, 0, sizeof(model));
+    if (!err) {
+        err = sector_resize(dev, NB_SECTORS);
+    }
+    if (!err) {
+        err = sector_cache_setup(dev, CACHE_SIZE);
+    }
+    if (err) {
+        printf("cannot set up %s: %s\n", TEST_DISK, ERR_MESSAGES[err - ERR_FIRST]);
+        if (dev != NULL) {
+            sector_close(dev);
+        }
+        remove(TEST_DISK);
+        return 1;
+    }
+    spy_len = 0;
+
+    test_flush(dev);
+    test_victim(dev);
+    test_ranges(dev);
+    test_prefetch(dev);
+
+    sector_close(dev);
+    remove(TEST_DISK);
+
+    printf("sector cache: %s\n", failures == 0 ? "ok" : "FAILED");
+    return failures == 0 ? 0 : 1;
+}
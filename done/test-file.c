@@ -38,6 +38,16 @@ void printTheInode(const struct unix_filesystem *u, uint16_t inr, struct filev6
     }
 }
 
+//Helper to print the SHA of each allocated inode, called by inode_scan()
+int print_sha_one(const struct unix_filesystem *fs, uint16_t inr, const struct inode *inode, void *arg)
+{
+    (void) fs;
+    if (inode != NULL) {
+        print_sha_inode(arg, *inode, inr);
+    }
+    return 0;
+}
+
 int test(struct unix_filesystem *u)
 {
     int err = 0;
@@ -48,34 +58,8 @@ int test(struct unix_filesystem *u)
     printTheInode(u, 5, &f);
     printf("----\n\nListing inodes SHA:\n");
 
-    uint16_t count = 0;
-
-    /*
-    struct inode i;
-    err = inode_read(u, count, &i);
-
-    while(err == 0 || (u -> s.s_isize) * INODES_PER_SECTOR < count) {
-        print_sha_inode(u, i, count);
-        ++count;
-        err = inode_read(u, count, &i);
-    }
-    // */
-    struct inode inode_data[INODES_PER_SECTOR];
-    for (uint32_t i = 0; i < u -> s.s_isize; ++i) {
-        err = sector_read(u -> f, u -> s.s_inode_start + i, inode_data);
-        if (!err) {
-            for (uint16_t k = 0; k < INODES_PER_SECTOR; ++k) {
-                print_sha_inode(u, inode_data[k], count);
-                ++count;
-            }
-        }
-    }
-    if (err == ERR_UNALLOCATED_INODE && count > 1) {
-        /* puisque le signal d'arrêt est une errur, on remet à zéro si il a bien
-         * fait le travail au moins une fois
-         */
-        err = 0;
-    }
+    // seuls les inodes alloués sont passés à print_sha_one
+    err = inode_scan(u, print_sha_one, u);
 
     return err;
 }